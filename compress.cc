@@ -7,6 +7,15 @@
 // append a header, a trailer and a checksum so that the concatenated
 // data is valid zlib-format data.
 //
+// Zstandard is easier to parallelize. A zstd stream may consist of
+// multiple frames, so we just compress each shard into a frame and
+// concatenate them.
+//
+// Callers give us data as a list of shards written by a callback.
+// Each shard is written to a per-thread buffer and compressed right
+// away, so that the entire uncompressed data is never materialized in
+// memory.
+//
 // Using threads to compress data has a downside. Since the dictionary
 // is reset on boundaries of shards, compression ratio is sacrificed
 // a little bit. However, if a shard size is large enough, that loss
@@ -14,9 +23,14 @@
 
 #include "mold.h"
 
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for_each.h>
 #include <zlib.h>
 
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
 namespace mold {
 
 static constexpr i64 SHARD_SIZE = 1024 * 1024;
@@ -33,6 +47,20 @@ static std::vector<std::string_view> split(std::string_view input) {
   return shards;
 }
 
+// Calls `fn` with the contents of each shard in parallel.
+static void
+for_each_shard(std::span<i64> sizes, ShardWriter &write_shard,
+               std::function<void(i64, std::string_view)> fn) {
+  tbb::enumerable_thread_specific<std::vector<u8>> bufs;
+
+  tbb::parallel_for((i64)0, (i64)sizes.size(), [&](i64 i) {
+    std::vector<u8> &buf = bufs.local();
+    buf.resize(sizes[i]);
+    write_shard(i, buf.data());
+    fn(i, {(char *)buf.data(), buf.size()});
+  });
+}
+
 static std::vector<u8> do_compress(std::string_view input) {
   // Initialize zlib stream. Since debug info is generally compressed
   // pretty well, we chose compression level 3.
@@ -63,21 +91,19 @@ static std::vector<u8> do_compress(std::string_view input) {
   return buf;
 }
 
-ZlibCompressor::ZlibCompressor(std::string_view input) {
-  std::vector<std::string_view> inputs = split(input);
-  std::vector<u64> adlers(inputs.size());
-  shards.resize(inputs.size());
+ZlibCompressor::ZlibCompressor(std::span<i64> shard_sizes,
+                               ShardWriter write_shard) {
+  std::vector<u64> adlers(shard_sizes.size());
+  shards.resize(shard_sizes.size());
 
-  // Compress each shard
-  tbb::parallel_for((i64)0, (i64)inputs.size(), [&](i64 i) {
-    adlers[i] = adler32(1, (u8 *)inputs[i].data(), inputs[i].size());
-    shards[i] = do_compress(inputs[i]);
+  for_each_shard(shard_sizes, write_shard, [&](i64 i, std::string_view data) {
+    adlers[i] = adler32(1, (u8 *)data.data(), data.size());
+    shards[i] = do_compress(data);
   });
 
-  // Combine checksums
   checksum = adlers[0];
-  for (i64 i = 1; i < inputs.size(); i++)
-    checksum = adler32_combine(checksum, adlers[i], inputs[i].size());
+  for (i64 i = 1; i < shard_sizes.size(); i++)
+    checksum = adler32_combine(checksum, adlers[i], shard_sizes[i]);
 }
 
 i64 ZlibCompressor::size() const {
@@ -163,4 +189,49 @@ void GzipCompressor::write_to(u8 *buf) {
   *(u32 *)(end - 4) = uncompressed_size;
 }
 
+#ifdef HAVE_ZSTD
+static std::vector<u8> do_zstd_compress(std::string_view input, i64 level,
+                                        std::atomic_size_t &error) {
+  std::vector<u8> buf(ZSTD_compressBound(input.size()));
+  size_t sz = ZSTD_compress(buf.data(), buf.size(), input.data(),
+                            input.size(), level);
+  if (ZSTD_isError(sz)) {
+    error = sz;
+    return {};
+  }
+  buf.resize(sz);
+  return buf;
+}
+
+ZstdCompressor::ZstdCompressor(std::span<i64> shard_sizes,
+                               ShardWriter write_shard, i64 level) {
+  shards.resize(shard_sizes.size());
+
+  for_each_shard(shard_sizes, write_shard, [&](i64 i, std::string_view data) {
+    shards[i] = do_zstd_compress(data, level, error);
+  });
+}
+
+const char *ZstdCompressor::get_error() const {
+  return error ? ZSTD_getErrorName(error) : nullptr;
+}
+
+i64 ZstdCompressor::size() const {
+  i64 size = 0;
+  for (const std::vector<u8> &shard : shards)
+    size += shard.size();
+  return size;
+}
+
+void ZstdCompressor::write_to(u8 *buf) {
+  std::vector<i64> offsets(shards.size());
+  for (i64 i = 1; i < shards.size(); i++)
+    offsets[i] = offsets[i - 1] + shards[i - 1].size();
+
+  tbb::parallel_for((i64)0, (i64)shards.size(), [&](i64 i) {
+    memcpy(&buf[offsets[i]], shards[i].data(), shards[i].size());
+  });
+}
+#endif
+
 } // namespace mold
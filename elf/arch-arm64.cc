@@ -2,10 +2,15 @@
 
 namespace mold::elf {
 
-static void write_adr(u8 *buf, u64 val) {
+// Returns the immhi:immlo fields of an ADR/ADRP instruction.
+static u32 adr_imm(u64 val) {
   u32 hi = (val & 0x1ffffc) << 3;
   u32 lo = (val & 3) << 29;
-  *(u32 *)buf = (*(u32 *)buf & 0x9f00001f) | hi | lo;
+  return hi | lo;
+}
+
+static void write_adr(u8 *buf, u64 val) {
+  *(u32 *)buf = (*(u32 *)buf & 0x9f00001f) | adr_imm(val);
 }
 
 // Returns [hi:lo] bits of val.
@@ -122,6 +127,71 @@ void EhFrameSection<ARM64>::apply_reloc(Context<ARM64> &ctx,
   Fatal(ctx) << "unsupported relocation in .eh_frame: " << rel;
 }
 
+// Resolves R_AARCH64_ABS64, R_AARCH64_CALL26, R_AARCH64_JUMP26 and
+// R_AARCH64_ADR_PREL_PG_HI21 ahead of apply_reloc_alloc().
+// See PreResolvedRelocs.
+template <>
+void InputSection<ARM64>::pre_resolve_relocs(Context<ARM64> &ctx) {
+  std::span<ElfRel<ARM64>> rels = get_rels(ctx);
+  if (rels.empty())
+    return;
+
+  pre_resolved.reset(new PreResolvedRelocs);
+  pre_resolved->is_resolved.resize(rels.size());
+  i64 frag_idx = 0;
+
+  for (i64 i = 0; i < rels.size(); i++) {
+    const ElfRel<ARM64> &rel = rels[i];
+    Symbol<ARM64> &sym = *file.symbols[rel.r_sym];
+
+    const SectionFragmentRef<ARM64> *ref = nullptr;
+    if (rel_fragments && rel_fragments[frag_idx].idx == i)
+      ref = &rel_fragments[frag_idx++];
+
+    if (needs_dynrel[i] || needs_baserel[i])
+      continue;
+
+#define S   (ref ? ref->frag->get_addr(ctx) : sym.get_addr(ctx))
+#define A   (ref ? ref->addend : rel.r_addend)
+#define P   (output_section->shdr.sh_addr + offset + rel.r_offset)
+
+    // Out-of-range values and weak undefined branch targets are
+    // handled by apply_reloc_alloc().
+    switch (rel.r_type) {
+    case R_AARCH64_ABS64:
+      pre_resolved->word64.push_back({(u32)rel.r_offset, S + A});
+      break;
+    case R_AARCH64_CALL26:
+    case R_AARCH64_JUMP26: {
+      if (sym.esym().is_undef_weak())
+        continue;
+      i64 val = S + A - P;
+      if (val < -((i64)1 << 26) || ((i64)1 << 26) <= val)
+        continue;
+      pre_resolved->insn32.push_back({(u32)rel.r_offset, 0xffffffff,
+                                      (u32)((val >> 2) & 0x3ffffff)});
+      break;
+    }
+    case R_AARCH64_ADR_PREL_PG_HI21: {
+      i64 val = page(S + A) - page(P);
+      if (val < -((i64)1 << 32) || ((i64)1 << 32) <= val)
+        continue;
+      pre_resolved->insn32.push_back({(u32)rel.r_offset, 0x9f00001f,
+                                      adr_imm(bits(val, 32, 12))});
+      break;
+    }
+    default:
+      continue;
+    }
+
+#undef S
+#undef A
+#undef P
+
+    pre_resolved->is_resolved[i] = true;
+  }
+}
+
 template <>
 void InputSection<ARM64>::apply_reloc_alloc(Context<ARM64> &ctx, u8 *base) {
   ElfRel<ARM64> *dynrel = nullptr;
@@ -144,6 +214,9 @@ void InputSection<ARM64>::apply_reloc_alloc(Context<ARM64> &ctx, u8 *base) {
     if (rel_fragments && rel_fragments[frag_idx].idx == i)
       ref = &rel_fragments[frag_idx++];
 
+    if (pre_resolved && pre_resolved->is_resolved[i])
+      continue;
+
     auto overflow_check = [&](i64 val, i64 lo, i64 hi) {
       if (val < lo || hi <= val)
         Error(ctx) << *this << ": relocation " << rel << " against "
@@ -164,7 +237,8 @@ void InputSection<ARM64>::apply_reloc_alloc(Context<ARM64> &ctx, u8 *base) {
     }
 
     if (needs_baserel[i]) {
-      *dynrel++ = {P, R_AARCH64_RELATIVE, 0, (i64)(S + A)};
+      if (!is_relr_reloc(ctx, rel))
+        *dynrel++ = {P, R_AARCH64_RELATIVE, 0, (i64)(S + A)};
       *(u64 *)loc = S + A;
       continue;
     }
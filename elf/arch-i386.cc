@@ -118,6 +118,53 @@ void EhFrameSection<I386>::apply_reloc(Context<I386> &ctx,
   unreachable();
 }
 
+// Resolves R_386_32, R_386_PC32 and R_386_PLT32 ahead of
+// apply_reloc_alloc(). See PreResolvedRelocs.
+template <>
+void InputSection<I386>::pre_resolve_relocs(Context<I386> &ctx) {
+  std::span<ElfRel<I386>> rels = get_rels(ctx);
+  if (rels.empty())
+    return;
+
+  pre_resolved.reset(new PreResolvedRelocs);
+  pre_resolved->is_resolved.resize(rels.size());
+  i64 frag_idx = 0;
+
+  for (i64 i = 0; i < rels.size(); i++) {
+    const ElfRel<I386> &rel = rels[i];
+    Symbol<I386> &sym = *file.symbols[rel.r_sym];
+
+    const SectionFragmentRef<I386> *ref = nullptr;
+    if (rel_fragments && rel_fragments[frag_idx].idx == i)
+      ref = &rel_fragments[frag_idx++];
+
+    if (needs_dynrel[i] || needs_baserel[i])
+      continue;
+
+#define S      (ref ? ref->frag->get_addr(ctx) : sym.get_addr(ctx))
+#define A      (ref ? ref->addend : this->get_addend(rel))
+#define P      (output_section->shdr.sh_addr + offset + rel.r_offset)
+
+    switch (rel.r_type) {
+    case R_386_32:
+      pre_resolved->word32.push_back({(u32)rel.r_offset, (u32)(S + A)});
+      break;
+    case R_386_PC32:
+    case R_386_PLT32:
+      pre_resolved->word32.push_back({(u32)rel.r_offset, (u32)(S + A - P)});
+      break;
+    default:
+      continue;
+    }
+
+#undef S
+#undef A
+#undef P
+
+    pre_resolved->is_resolved[i] = true;
+  }
+}
+
 template <>
 void InputSection<I386>::apply_reloc_alloc(Context<I386> &ctx, u8 *base) {
   ElfRel<I386> *dynrel = nullptr;
@@ -140,6 +187,9 @@ void InputSection<I386>::apply_reloc_alloc(Context<I386> &ctx, u8 *base) {
     if (rel_fragments && rel_fragments[frag_idx].idx == i)
       ref = &rel_fragments[frag_idx++];
 
+    if (pre_resolved && pre_resolved->is_resolved[i])
+      continue;
+
     auto overflow_check = [&](i64 val, i64 lo, i64 hi) {
       if (val < lo || hi <= val)
         Error(ctx) << *this << ": relocation " << rel << " against "
@@ -180,7 +230,8 @@ void InputSection<I386>::apply_reloc_alloc(Context<I386> &ctx, u8 *base) {
     }
 
     if (needs_baserel[i]) {
-      *dynrel++ = {P, R_386_RELATIVE, 0};
+      if (!is_relr_reloc(ctx, rel))
+        *dynrel++ = {P, R_386_RELATIVE, 0};
       *(u32 *)loc = S + A;
       continue;
     }
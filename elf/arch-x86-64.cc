@@ -143,6 +143,64 @@ static u32 relax_gottpoff(u8 *loc) {
   return 0;
 }
 
+// Resolves R_X86_64_64, R_X86_64_PC32 and R_X86_64_PLT32 ahead of
+// apply_reloc_alloc(). See PreResolvedRelocs.
+template <>
+void InputSection<X86_64>::pre_resolve_relocs(Context<X86_64> &ctx) {
+  std::span<ElfRel<X86_64>> rels = get_rels(ctx);
+  if (rels.empty())
+    return;
+
+  pre_resolved.reset(new PreResolvedRelocs);
+  pre_resolved->is_resolved.resize(rels.size());
+  i64 frag_idx = 0;
+
+  for (i64 i = 0; i < rels.size(); i++) {
+    const ElfRel<X86_64> &rel = rels[i];
+    Symbol<X86_64> &sym = *file.symbols[rel.r_sym];
+
+    const SectionFragmentRef<X86_64> *ref = nullptr;
+    if (rel_fragments && rel_fragments[frag_idx].idx == i)
+      ref = &rel_fragments[frag_idx++];
+
+    if (needs_dynrel[i] || needs_baserel[i])
+      continue;
+
+    // A call to __tls_get_addr may be rewritten by TLSGD or TLSLD
+    // relaxation, so we leave it to apply_reloc_alloc().
+    if (i > 0 && (rels[i - 1].r_type == R_X86_64_TLSGD ||
+                  rels[i - 1].r_type == R_X86_64_TLSLD))
+      continue;
+
+#define S   (ref ? ref->frag->get_addr(ctx) : sym.get_addr(ctx))
+#define A   (ref ? ref->addend : rel.r_addend)
+#define P   (output_section->shdr.sh_addr + offset + rel.r_offset)
+
+    switch (rel.r_type) {
+    case R_X86_64_64:
+      pre_resolved->word64.push_back({(u32)rel.r_offset, S + A});
+      break;
+    case R_X86_64_PC32:
+    case R_X86_64_PLT32: {
+      // An out-of-range value is reported by apply_reloc_alloc().
+      i64 val = S + A - P;
+      if (val != (i32)val)
+        continue;
+      pre_resolved->word32.push_back({(u32)rel.r_offset, (u32)val});
+      break;
+    }
+    default:
+      continue;
+    }
+
+#undef S
+#undef A
+#undef P
+
+    pre_resolved->is_resolved[i] = true;
+  }
+}
+
 // Apply relocations to SHF_ALLOC sections (i.e. sections that are
 // mapped to memory at runtime) based on the result of
 // scan_relocations().
@@ -168,6 +226,9 @@ void InputSection<X86_64>::apply_reloc_alloc(Context<X86_64> &ctx, u8 *base) {
     if (rel_fragments && rel_fragments[frag_idx].idx == i)
       ref = &rel_fragments[frag_idx++];
 
+    if (pre_resolved && pre_resolved->is_resolved[i])
+      continue;
+
     auto overflow_check = [&](i64 val, i64 lo, i64 hi) {
       if (val < lo || hi <= val)
         Error(ctx) << *this << ": relocation " << rel << " against "
@@ -218,7 +279,8 @@ void InputSection<X86_64>::apply_reloc_alloc(Context<X86_64> &ctx, u8 *base) {
     }
 
     if (needs_baserel[i]) {
-      *dynrel++ = {P, R_X86_64_RELATIVE, 0, (i64)(S + A)};
+      if (!is_relr_reloc(ctx, rel))
+        *dynrel++ = {P, R_X86_64_RELATIVE, 0, (i64)(S + A)};
       *(u64 *)loc = S + A;
       continue;
     }
@@ -0,0 +1,284 @@
+// An archive index is a list of global symbols defined by each member
+// of a static archive. With an index, we can resolve symbols against an
+// archive without parsing its members. Members are parsed only when
+// they are pulled into the output by mark_live_objects().
+//
+// Computing an index is much cheaper than parsing members, but it
+// still needs to read the symbol table of every member. If
+// --archive-cache-dir is given, we save computed indices to the
+// directory so that we can skip even that for unchanged archives.
+//
+// A cache file is named after a hash of the archive's real path, size
+// and mtime. Its contents are as follows:
+//
+//   "MOLDAIX1"           8 bytes
+//   archive size         u64
+//   archive mtime        u64
+//   path length          u64
+//   number of members    u64
+//   real path            NUL-terminated string
+//
+// followed by a list of NUL-terminated symbol names for each member,
+// each list terminated by an empty string.
+
+#include "mold.h"
+#include "../archive-file.h"
+
+#include <fcntl.h>
+#include <iomanip>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
+
+namespace mold::elf {
+
+static constexpr char INDEX_MAGIC[] = "MOLDAIX1";
+
+struct IndexHeader {
+  char magic[8];
+  u64 archive_size;
+  u64 archive_mtime;
+  u64 pathlen;
+  u64 num_members;
+};
+
+// Returns the names of global symbols defined by a given member.
+// Common symbols are excluded because they never pull out archive
+// members. Returns false if the file looks broken, in which case the
+// caller should parse the file normally to report an error.
+template <typename E>
+static bool read_defined_symbols(MappedFile<Context<E>> *mf,
+                                 std::vector<std::string_view> &vec) {
+  if (get_file_type(mf) != FileType::ELF_OBJ)
+    return true;
+
+  u8 *begin = mf->data;
+  u64 size = mf->size;
+
+  if (size < sizeof(ElfEhdr<E>))
+    return false;
+  ElfEhdr<E> &ehdr = *(ElfEhdr<E> *)begin;
+
+  // Members for other targets are left to the normal parser.
+  u8 elf_class = (E::word_size == 8) ? ELFCLASS64 : ELFCLASS32;
+  if (ehdr.e_ident[EI_CLASS] != elf_class ||
+      ehdr.e_ident[EI_DATA] != ELFDATA2LSB ||
+      ehdr.e_machine != E::e_machine)
+    return false;
+
+  if (ehdr.e_shoff > size ||
+      (size - ehdr.e_shoff) / sizeof(ElfShdr<E>) < 1)
+    return false;
+  ElfShdr<E> *shdrs = (ElfShdr<E> *)(begin + ehdr.e_shoff);
+
+  u64 num_sections = (ehdr.e_shnum == 0) ? shdrs->sh_size : ehdr.e_shnum;
+  if ((size - ehdr.e_shoff) / sizeof(ElfShdr<E>) < num_sections)
+    return false;
+
+  auto in_bounds = [&](ElfShdr<E> &shdr) {
+    return shdr.sh_offset <= size && shdr.sh_size <= size - shdr.sh_offset;
+  };
+
+  for (i64 i = 0; i < num_sections; i++) {
+    ElfShdr<E> &shdr = shdrs[i];
+    if (shdr.sh_type != SHT_SYMTAB)
+      continue;
+
+    if (shdr.sh_link >= num_sections)
+      return false;
+    ElfShdr<E> &strtab = shdrs[shdr.sh_link];
+
+    if (!in_bounds(shdr) || !in_bounds(strtab))
+      return false;
+
+    std::span<ElfSym<E>> syms((ElfSym<E> *)(begin + shdr.sh_offset),
+                              shdr.sh_size / sizeof(ElfSym<E>));
+    std::string_view str((char *)begin + strtab.sh_offset, strtab.sh_size);
+
+    for (i64 j = shdr.sh_info; j < syms.size(); j++) {
+      const ElfSym<E> &esym = syms[j];
+      if (esym.is_undef() || esym.is_common())
+        continue;
+      if (str.size() <= esym.st_name)
+        return false;
+
+      std::string_view name = str.substr(esym.st_name);
+      size_t len = name.find('\0');
+      if (len == name.npos)
+        return false;
+      vec.push_back(name.substr(0, len));
+    }
+    return true;
+  }
+  return true;
+}
+
+template <typename E>
+static std::string get_cache_path(Context<E> &ctx, MappedFile<Context<E>> *mf,
+                                  std::string_view real_path) {
+  std::string key = std::string(real_path) + '\0' + std::to_string(mf->size) +
+                    '\0' + std::to_string(mf->mtime);
+
+  std::ostringstream out;
+  out << ctx.arg.archive_cache_dir << "/" << std::hex << std::setw(16)
+      << std::setfill('0') << hash_string(key) << ".idx";
+  return out.str();
+}
+
+template <typename E>
+static std::optional<ArchiveIndex>
+read_cache(Context<E> &ctx, MappedFile<Context<E>> *mf,
+           std::string_view real_path, std::string path, i64 num_members) {
+  i64 fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return {};
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(IndexHeader)) {
+    close(fd);
+    return {};
+  }
+
+  // The mapping is intentionally kept until the process exits because
+  // the returned index refers to strings in the mapped file.
+  u8 *data = (u8 *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return {};
+
+  auto fail = [&]() -> std::optional<ArchiveIndex> {
+    munmap(data, st.st_size);
+    return {};
+  };
+
+  IndexHeader &hdr = *(IndexHeader *)data;
+  if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) ||
+      hdr.archive_size != mf->size || hdr.archive_mtime != mf->mtime ||
+      hdr.pathlen != real_path.size() || hdr.num_members != num_members)
+    return fail();
+
+  std::string_view rest((char *)data + sizeof(hdr),
+                        st.st_size - sizeof(hdr));
+  if (rest.size() <= hdr.pathlen || rest.substr(0, hdr.pathlen) != real_path ||
+      rest[hdr.pathlen] != '\0')
+    return fail();
+  rest = rest.substr(hdr.pathlen + 1);
+
+  ArchiveIndex index(num_members);
+
+  for (std::vector<std::string_view> &syms : index) {
+    for (;;) {
+      i64 pos = rest.find('\0');
+      if (pos == rest.npos)
+        return fail();
+
+      std::string_view name = rest.substr(0, pos);
+      rest = rest.substr(pos + 1);
+      if (name.empty())
+        break;
+      syms.push_back(name);
+    }
+  }
+
+  if (!rest.empty())
+    return fail();
+  return index;
+}
+
+template <typename E>
+static void write_cache(Context<E> &ctx, MappedFile<Context<E>> *mf,
+                        std::string_view real_path, std::string path,
+                        const ArchiveIndex &index) {
+  std::string buf;
+
+  IndexHeader hdr;
+  memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.archive_size = mf->size;
+  hdr.archive_mtime = mf->mtime;
+  hdr.pathlen = real_path.size();
+  hdr.num_members = index.size();
+
+  buf.append((char *)&hdr, sizeof(hdr));
+  buf += real_path;
+  buf += '\0';
+
+  for (const std::vector<std::string_view> &syms : index) {
+    for (std::string_view name : syms) {
+      buf += name;
+      buf += '\0';
+    }
+    buf += '\0';
+  }
+
+  mkdir(ctx.arg.archive_cache_dir.c_str(), 0755);
+
+  // Other mold processes may be reading or writing the same file,
+  // so we write to a temporary file first and then rename it.
+  std::string tmp = path + ".XXXXXX";
+  i64 fd = mkstemp(tmp.data());
+  if (fd == -1) {
+    Warn(ctx) << "cannot create " << tmp << ": " << errno_string();
+    return;
+  }
+
+  bool ok = (write(fd, buf.data(), buf.size()) == buf.size());
+  close(fd);
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+    Warn(ctx) << "cannot write " << path << ": " << errno_string();
+    unlink(tmp.c_str());
+  }
+}
+
+// Returns an index for a given archive. The index has the same number
+// of elements as the members. Returns std::nullopt if we couldn't
+// compute an index because some member is broken.
+template <typename E>
+std::optional<ArchiveIndex>
+get_archive_index(Context<E> &ctx, MappedFile<Context<E>> *mf,
+                  const std::vector<MappedFile<Context<E>> *> &members) {
+  // Members of a thin archive are separate files that can be updated
+  // without updating the archive itself, so we don't cache them.
+  bool use_cache = !ctx.arg.archive_cache_dir.empty() &&
+                   get_file_type(mf) == FileType::AR;
+
+  // The same relative path may refer to different archives in
+  // different links, so we identify an archive by its real path.
+  std::string real_path;
+  std::string path;
+  if (use_cache) {
+    real_path = get_realpath(mf->name);
+    path = get_cache_path(ctx, mf, real_path);
+    if (std::optional<ArchiveIndex> index =
+          read_cache(ctx, mf, real_path, path, members.size()))
+      return index;
+  }
+
+  ArchiveIndex index(members.size());
+  std::atomic_bool ok = true;
+
+  tbb::parallel_for((i64)0, (i64)members.size(), [&](i64 i) {
+    if (!read_defined_symbols<E>(members[i], index[i]))
+      ok = false;
+  });
+
+  if (!ok)
+    return {};
+
+  if (use_cache)
+    write_cache(ctx, mf, real_path, path, index);
+  return index;
+}
+
+#define INSTANTIATE(E)                                                  \
+  template std::optional<ArchiveIndex>                                  \
+  get_archive_index(Context<E> &, MappedFile<Context<E>> *,             \
+                    const std::vector<MappedFile<Context<E>> *> &);
+
+INSTANTIATE(X86_64);
+INSTANTIATE(I386);
+INSTANTIATE(ARM64);
+
+} // namespace mold::elf
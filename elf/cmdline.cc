@@ -6,6 +6,10 @@
 #include <unistd.h>
 #include <unordered_set>
 
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
 namespace mold::elf {
 
 static const char helpmsg[] = R"(
@@ -49,17 +53,24 @@ Options:
   --Bno-symbolic              Cancel --Bsymbolic and --Bsymbolic-functions
   --Map FILE                  Write map file to a given file
   --allow-multiple-definition Allow multiple definitions
+  --archive-cache-dir DIR     Cache symbol indices of static archives in DIR
   --as-needed                 Only set DT_NEEDED if used
     --no-as-needed
+  --async-write               Write output file in background instead of mmap
+    --no-async-write
   --build-id [none,md5,sha1,sha256,uuid,HEXSTRING]
                               Generate build ID
     --no-build-id
+  --call-graph-profile-sort   Sort sections by .llvm.call-graph-profile (default)
+    --no-call-graph-profile-sort
   --chroot DIR                Set a given path to root directory
   --color-diagnostics         Ignored
-  --compress-debug-sections [none,zlib,zlib-gabi,zlib-gnu]
+  --compress-debug-sections [none,zlib,zlib-gabi,zlib-gnu,zstd[:LEVEL]]
                               Compress .debug_* sections
   --demangle                  Demangle C++ symbols in log messages (default)
     --no-demangle
+  --direct-io                 Bypass page cache to write large debug sections
+    --no-direct-io            (with --async-write)
   --disable-new-dtags         Ignored
   --dynamic-list              Read a list of dynamic symbols
   --eh-frame-hdr              Create .eh_frame_hdr section
@@ -73,12 +84,15 @@ Options:
     --no-fork
   --gc-sections               Remove unreferenced sections
     --no-gc-sections
-  --gdb-index                 Ignored
+  --gdb-index                 Create .gdb_index for faster debugging
+    --no-gdb-index
   --hash-style [sysv,gnu,both]
                               Set hash style
   --icf                       Fold identical code
     --no-icf
   --image-base ADDR           Set the base address to a given value
+  --incremental               Patch changed input files into the previous output in place
+    --no-incremental
   --init SYMBOL               Call SYMBOl at load-time
   --no-undefined              Report undefined symbols (even with --shared)
   --perf                      Print performance statistics
@@ -87,6 +101,10 @@ Options:
   --plugin                    Ignored
   --plugin-opt                Ignored
   --pop-state                 Pop state of flags governing input file handling
+  --pre-resolve-relocs        Resolve relocations before creating output file
+    --no-pre-resolve-relocs
+  --preallocate               Preallocate and prefault output file
+    --no-preallocate
   --preload
     --no-preload
   --print-gc-sections         Print removed unreferenced sections
@@ -101,10 +119,16 @@ Options:
   --repro                     Embed input files to .repro section
   --require-defined SYMBOL    Require SYMBOL be defined in the final output
   --retain-symbols-file FILE  Keep only symbols listed in FILE
+  --reuse-output              Overwrite only changed parts of an existing output file
+    --no-reuse-output
   --rpath DIR                 Add DIR to runtime search path
   --rpath-link DIR            Ignored
   --run COMMAND ARG...        Run COMMAND with mold as /usr/bin/ld
+  --server                    Parse given files once and serve link requests
+  --server-dir DIR            Put the socket of --server and --use-server in DIR
   --shared, --Bshareable      Create a share library
+  --skip-if-unchanged         Skip linking if no input has changed since the last link
+    --no-skip-if-unchanged
   --sort-common               Ignored
   --sort-section              Ignored
   --spare-dynamic-tags NUMBER Reserve give number of tags in .dynamic section
@@ -112,6 +136,7 @@ Options:
     --end-lib                 End the effect of --start-lib
   --static                    Do not link against shared libraries
   --stats                     Print input statistics
+  --symbol-ordering-file FILE Lay out sections in the order of symbols in FILE
   --sysroot DIR               Set target system root directory
   --thread-count COUNT, --threads=COUNT
                               Use COUNT number of threads
@@ -121,6 +146,7 @@ Options:
   --unique PATTERN            Don't merge input sections that match a given pattern
   --unresolved-symbols [report-all,ignore-all,ignore-in-object-files,ignore-in-shared-libs]
                               How to handle unresolved symbols
+  --use-server                Delegate the link to a running `mold --server`
   --version-script FILE       Read version script
   --warn-common               Warn about common symbols
     --no-warn-common
@@ -145,6 +171,8 @@ Options:
   -z nodump                   Mark DSO not available to dldump
   -z now                      Disable lazy function resolution
   -z origin                   Mark object requiring immediate $ORIGIN processing at runtime
+  -z pack-relative-relocs     Use compact .relr.dyn for relative relocations
+    -z nopack-relative-relocs
   -z relro                    Make some sections read-only after relocation (default)
     -z norelro
   -z text                     Report error if DT_TEXTREL is set
@@ -358,6 +386,33 @@ static void read_retain_symbols_file(Context<E> &ctx, std::string_view path) {
   }
 }
 
+template <typename E>
+static std::vector<std::string_view>
+read_symbol_ordering_file(Context<E> &ctx, std::string_view path) {
+  MappedFile<Context<E>> *mf =
+    MappedFile<Context<E>>::must_open(ctx, std::string(path));
+  std::string_view data((char *)mf->data, mf->size);
+  std::vector<std::string_view> vec;
+
+  while (!data.empty()) {
+    size_t pos = data.find('\n');
+    std::string_view name;
+
+    if (pos == data.npos) {
+      name = data;
+      data = "";
+    } else {
+      name = data.substr(0, pos);
+      data = data.substr(pos + 1);
+    }
+
+    name = trim(name);
+    if (!name.empty())
+      vec.push_back(name);
+  }
+  return vec;
+}
+
 static bool is_file(std::string_view path) {
   struct stat st;
   return stat(std::string(path).c_str(), &st) == 0 &&
@@ -447,6 +502,14 @@ void parse_nonpositional_args(Context<E> &ctx,
       ctx.arg.demangle = true;
     } else if (read_flag(args, "no-demangle")) {
       ctx.arg.demangle = false;
+    } else if (read_flag(args, "async-write")) {
+      ctx.arg.async_write = true;
+    } else if (read_flag(args, "no-async-write")) {
+      ctx.arg.async_write = false;
+    } else if (read_flag(args, "direct-io")) {
+      ctx.arg.direct_io = true;
+    } else if (read_flag(args, "no-direct-io")) {
+      ctx.arg.direct_io = false;
     } else if (read_arg(ctx, args, arg, "y") ||
                read_arg(ctx, args, arg, "trace-symbol")) {
       ctx.arg.trace_symbol.push_back(arg);
@@ -533,8 +596,25 @@ void parse_nonpositional_args(Context<E> &ctx,
         ctx.arg.compress_debug_sections = COMPRESS_GNU;
       else if (arg == "none")
         ctx.arg.compress_debug_sections = COMPRESS_NONE;
+      else if (arg == "zstd" || arg.starts_with("zstd:"))
+        ctx.arg.compress_debug_sections = COMPRESS_ZSTD;
       else
         Fatal(ctx) << "invalid --compress-debug-sections argument: " << arg;
+
+#ifdef HAVE_ZSTD
+      if (arg.starts_with("zstd:")) {
+        i64 level = parse_number(ctx, "compress-debug-sections", arg.substr(5));
+        if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel())
+          Fatal(ctx) << "--compress-debug-sections: zstd compression level "
+                     << "must be between " << ZSTD_minCLevel() << " and "
+                     << ZSTD_maxCLevel() << ": " << arg;
+        ctx.arg.compress_level = level;
+      }
+#else
+      if (ctx.arg.compress_debug_sections == COMPRESS_ZSTD)
+        Fatal(ctx) << "--compress-debug-sections=zstd: mold was built "
+                   << "without zstd support";
+#endif
     } else if (read_arg(ctx, args, arg, "wrap")) {
       ctx.arg.wrap.insert(arg);
     } else if (read_flag(args, "omagic") || read_flag(args, "N")) {
@@ -542,6 +622,16 @@ void parse_nonpositional_args(Context<E> &ctx,
       ctx.arg.is_static = true;
     } else if (read_flag(args, "no-omagic")) {
       ctx.arg.omagic = false;
+    } else if (read_flag(args, "gdb-index")) {
+      ctx.arg.gdb_index = true;
+    } else if (read_flag(args, "no-gdb-index")) {
+      ctx.arg.gdb_index = false;
+    } else if (read_arg(ctx, args, arg, "symbol-ordering-file")) {
+      ctx.arg.symbol_ordering_file = read_symbol_ordering_file(ctx, arg);
+    } else if (read_flag(args, "call-graph-profile-sort")) {
+      ctx.arg.call_graph_profile_sort = true;
+    } else if (read_flag(args, "no-call-graph-profile-sort")) {
+      ctx.arg.call_graph_profile_sort = false;
     } else if (read_arg(ctx, args, arg, "retain-symbols-file")) {
       read_retain_symbols_file(ctx, arg);
     } else if (read_flag(args, "repro")) {
@@ -586,6 +676,10 @@ void parse_nonpositional_args(Context<E> &ctx,
       ctx.arg.z_text = false;
     } else if (read_z_flag(args, "origin")) {
       ctx.arg.z_origin = true;
+    } else if (read_z_flag(args, "pack-relative-relocs")) {
+      ctx.arg.z_pack_relative_relocs = true;
+    } else if (read_z_flag(args, "nopack-relative-relocs")) {
+      ctx.arg.z_pack_relative_relocs = false;
     } else if (read_flag(args, "no-undefined")) {
       ctx.arg.z_defs = true;
     } else if (read_flag(args, "fatal-warnings")) {
@@ -613,6 +707,20 @@ void parse_nonpositional_args(Context<E> &ctx,
         Fatal(ctx) << "unknown --icf argument: " << arg;
     } else if (read_flag(args, "no-icf")) {
       ctx.arg.icf = false;
+    } else if (read_flag(args, "incremental")) {
+      ctx.arg.incremental = true;
+    } else if (read_flag(args, "no-incremental")) {
+      ctx.arg.incremental = false;
+    } else if (read_flag(args, "skip-if-unchanged")) {
+      ctx.arg.skip_if_unchanged = true;
+    } else if (read_flag(args, "no-skip-if-unchanged")) {
+      ctx.arg.skip_if_unchanged = false;
+    } else if (read_flag(args, "reuse-output")) {
+      ctx.arg.reuse_output = true;
+    } else if (read_flag(args, "no-reuse-output")) {
+      ctx.arg.reuse_output = false;
+    } else if (read_arg(ctx, args, arg, "archive-cache-dir")) {
+      ctx.arg.archive_cache_dir = arg;
     } else if (read_arg(ctx, args, arg, "image-base")) {
       ctx.arg.image_base = parse_number(ctx, "image-base", arg);
     } else if (read_flag(args, "quick-exit")) {
@@ -702,6 +810,20 @@ void parse_nonpositional_args(Context<E> &ctx,
     } else if (read_arg(ctx, args, arg, "filter") ||
                read_arg(ctx, args, arg, "F")) {
       ctx.arg.filter.push_back(arg);
+    } else if (read_flag(args, "server")) {
+      ctx.arg.server = true;
+    } else if (read_arg(ctx, args, arg, "server-dir")) {
+      ctx.arg.server_dir = arg;
+    } else if (read_flag(args, "use-server")) {
+      ctx.arg.use_server = true;
+    } else if (read_flag(args, "pre-resolve-relocs")) {
+      ctx.arg.pre_resolve_relocs = true;
+    } else if (read_flag(args, "no-pre-resolve-relocs")) {
+      ctx.arg.pre_resolve_relocs = false;
+    } else if (read_flag(args, "preallocate")) {
+      ctx.arg.preallocate = true;
+    } else if (read_flag(args, "no-preallocate")) {
+      ctx.arg.preallocate = false;
     } else if (read_flag(args, "preload")) {
       ctx.arg.preload = true;
     } else if (read_flag(args, "no-preload")) {
@@ -714,7 +836,6 @@ void parse_nonpositional_args(Context<E> &ctx,
     } else if (read_arg(ctx, args, arg, "plugin")) {
     } else if (read_arg(ctx, args, arg, "plugin-opt")) {
     } else if (read_flag(args, "color-diagnostics")) {
-    } else if (read_flag(args, "gdb-index")) {
     } else if (read_flag(args, "eh-frame-hdr")) {
     } else if (read_flag(args, "start-group")) {
     } else if (read_flag(args, "end-group")) {
@@ -727,7 +848,6 @@ void parse_nonpositional_args(Context<E> &ctx,
     } else if (read_flag(args, "allow-shlib-undefined")) {
     } else if (read_flag(args, "no-allow-shlib-undefined")) {
     } else if (read_flag(args, "no-add-needed")) {
-    } else if (read_flag(args, "no-call-graph-profile-sort")) {
     } else if (read_flag(args, "no-copy-dt-needed-entries")) {
     } else if (read_flag(args, "no-undefined-version")) {
     } else if (read_arg(ctx, args, arg, "sort-section")) {
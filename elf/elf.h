@@ -68,6 +68,8 @@ static constexpr u32 SHT_FINI_ARRAY = 15;
 static constexpr u32 SHT_PREINIT_ARRAY = 16;
 static constexpr u32 SHT_GROUP = 17;
 static constexpr u32 SHT_SYMTAB_SHNDX = 18;
+static constexpr u32 SHT_RELR = 19;
+static constexpr u32 SHT_LLVM_CALL_GRAPH_PROFILE = 0x6fff4c09;
 static constexpr u32 SHT_GNU_HASH = 0x6ffffff6;
 static constexpr u32 SHT_GNU_VERDEF = 0x6ffffffd;
 static constexpr u32 SHT_GNU_VERNEED = 0x6ffffffe;
@@ -190,6 +192,9 @@ static constexpr u32 DT_INIT_ARRAYSZ = 27;
 static constexpr u32 DT_FINI_ARRAYSZ = 28;
 static constexpr u32 DT_RUNPATH = 29;
 static constexpr u32 DT_FLAGS = 30;
+static constexpr u32 DT_RELRSZ = 35;
+static constexpr u32 DT_RELR = 36;
+static constexpr u32 DT_RELRENT = 37;
 static constexpr u32 DT_GNU_HASH = 0x6ffffef5;
 static constexpr u32 DT_VERSYM = 0x6ffffff0;
 static constexpr u32 DT_RELACOUNT = 0x6ffffff9;
@@ -227,6 +232,7 @@ static constexpr u32 GNU_PROPERTY_AARCH64_FEATURE_1_AND = 0xc0000000;
 static constexpr u32 GNU_PROPERTY_X86_FEATURE_1_AND = 0xc0000002;
 
 static constexpr u32 ELFCOMPRESS_ZLIB = 1;
+static constexpr u32 ELFCOMPRESS_ZSTD = 2;
 
 static constexpr u32 R_X86_64_NONE = 0;
 static constexpr u32 R_X86_64_64 = 1;
@@ -0,0 +1,443 @@
+// This file implements --gdb-index.
+//
+// .gdb_index is an index of debug info that gdb can read instead of
+// scanning the entire .debug_info on startup. It consists of the
+// following tables:
+//
+//  - the compunit list, which is a list of the offsets and sizes of
+//    compilation units in .debug_info,
+//  - the address area, which maps address ranges to compunits,
+//  - the symbol table, which is an open-addressing hash table whose
+//    key is a symbol name and whose value is a list of compunits
+//    defining that name, and
+//  - the constant pool, which contains the compunit lists and the
+//    strings referred by the symbol table.
+//
+// We don't interpret DWARF DIEs. Compunits are found by reading unit
+// headers in .debug_info. Symbol names are read from .debug_gnu_pubnames
+// and .debug_gnu_pubtypes (or their non-GNU counterparts), which the
+// compiler emits if -ggnu-pubnames is given. The address area is
+// computed from the live code sections of each object file, which is
+// exact as long as an object file contains a single compunit.
+//
+// Everything but addresses is computed before the file layout is fixed,
+// so that we know the size of the section. Input files are read in
+// parallel, and symbol names are merged using ConcurrentMap.
+//
+// The format is described in
+// https://sourceware.org/gdb/onlinedocs/gdb/Index-Section-Format.html
+
+#include "mold.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
+
+namespace mold::elf {
+
+static constexpr i64 GDB_INDEX_VERSION = 7;
+static constexpr u8 DW_UT_type = 2;
+static constexpr u8 DW_UT_split_type = 6;
+
+// GDB_INDEX_SYMBOL_KIND_TYPE
+static constexpr u8 PUBTYPE_ATTR = 1 << 4;
+
+struct GdbIndexHeader {
+  u32 version;
+  u32 cu_list_offset;
+  u32 cu_types_offset;
+  u32 areas_offset;
+  u32 symtab_offset;
+  u32 const_pool_offset;
+};
+
+// This hash function is defined by gdb.
+static u32 gdb_hash(std::string_view name) {
+  u32 h = 0;
+  for (u8 c : name) {
+    if ('A' <= c && c <= 'Z')
+      c = 'a' + c - 'A';
+    h = h * 67 + c - 113;
+  }
+  return h;
+}
+
+// Reads a unit length field of DWARF. Returns the length and the size
+// of the field, which is 4 for 32-bit DWARF and 12 for 64-bit DWARF.
+static std::pair<u64, i64> read_unit_length(std::string_view data) {
+  if (data.size() < 4)
+    return {0, 0};
+  u32 len = *(u32 *)data.data();
+  if (len != 0xffffffff)
+    return {len, 4};
+  if (data.size() < 12)
+    return {0, 0};
+  return {*(u64 *)(data.data() + 4), 12};
+}
+
+struct PubnameEntry {
+  std::string_view name;
+  u32 entry;
+  GdbIndexName *ent = nullptr;
+};
+
+// Reads .debug_pubnames, .debug_pubtypes, .debug_gnu_pubnames or
+// .debug_gnu_pubtypes. Each set in the section refers a compunit by
+// its offset in the input .debug_info, so `find_cu` maps it to
+// a global compunit index.
+template <typename E, typename F>
+static void read_pubnames(Context<E> &ctx, InputSection<E> &isec,
+                          F find_cu, std::vector<PubnameEntry> &vec) {
+  std::string_view name = isec.name();
+  bool is_gnu = name.starts_with(".debug_gnu_");
+  u8 default_attr = name.ends_with("types") ? PUBTYPE_ATTR : 0;
+
+  isec.uncompress(ctx);
+  std::string_view data = isec.contents;
+  std::span<ElfRel<E>> rels = isec.get_rels(ctx);
+  i64 rel_idx = 0;
+
+  auto error = [&]() {
+    Fatal(ctx) << isec << ": corrupted " << name << " section";
+  };
+
+  while (!data.empty()) {
+    auto [len, hdrlen] = read_unit_length(data);
+    if (hdrlen == 0 || data.size() < hdrlen + len)
+      error();
+
+    i64 offsize = (hdrlen == 4) ? 4 : 8;
+    std::string_view set = data.substr(hdrlen, len);
+    i64 pos = 2 + offsize * 2;
+    if (set.size() < pos)
+      error();
+
+    auto read_offset = [&](i64 pos) -> u64 {
+      if (offsize == 4)
+        return *(u32 *)(set.data() + pos);
+      return *(u64 *)(set.data() + pos);
+    };
+
+    // Find a relocation for the debug_info_offset field.
+    u64 rel_offset = (set.data() + 2) - isec.contents.data();
+    while (rel_idx < rels.size() && rels[rel_idx].r_offset < rel_offset)
+      rel_idx++;
+
+    const ElfRel<E> *rel = nullptr;
+    if (rel_idx < rels.size() && rels[rel_idx].r_offset == rel_offset)
+      rel = &rels[rel_idx];
+
+    i64 cu_idx = find_cu(isec, rel, read_offset(2));
+    data = data.substr(hdrlen + len);
+    if (cu_idx == -1)
+      continue;
+
+    while (pos < set.size()) {
+      if (set.size() < pos + offsize)
+        error();
+      u64 die_offset = read_offset(pos);
+      pos += offsize;
+      if (die_offset == 0)
+        break;
+
+      u8 attr = default_attr;
+      if (is_gnu) {
+        if (set.size() <= pos)
+          error();
+        attr = set[pos++];
+      }
+
+      i64 end = set.find('\0', pos);
+      if (end == set.npos)
+        error();
+
+      std::string_view sym = set.substr(pos, end - pos);
+      pos = end + 1;
+      vec.push_back({sym, (u32)cu_idx | ((u32)attr << 24)});
+    }
+  }
+}
+
+template <typename E>
+void GdbIndexSection<E>::construct(Context<E> &ctx) {
+  Timer t(ctx, "gdb_index");
+
+  OutputSection<E> *debug_info = nullptr;
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections)
+    if (osec->name == ".debug_info" && !osec->members.empty())
+      debug_info = osec.get();
+
+  if (!debug_info)
+    return;
+
+  // Read unit headers of .debug_info. Compunits are numbered in the
+  // order of their addresses in the output .debug_info.
+  std::vector<std::vector<Compunit>> cus(debug_info->members.size());
+
+  tbb::parallel_for((i64)0, (i64)debug_info->members.size(), [&](i64 i) {
+    InputSection<E> &isec = *debug_info->members[i];
+    isec.uncompress(ctx);
+    std::string_view data = isec.contents;
+    u64 offset = 0;
+
+    while (offset < data.size()) {
+      auto [len, hdrlen] = read_unit_length(data.substr(offset));
+      if (hdrlen == 0 || data.size() < offset + hdrlen + len ||
+          len < 3)
+        Fatal(ctx) << isec << ": corrupted .debug_info section";
+
+      u16 version = *(u16 *)(data.data() + offset + hdrlen);
+      u8 unit_type = (version >= 5) ? data[offset + hdrlen + 2] : 0;
+
+      // gdb index version 7 does not support DWARF 5 type units.
+      if (unit_type != DW_UT_type && unit_type != DW_UT_split_type)
+        cus[i].push_back({&isec, offset, (u64)hdrlen + len});
+      offset += hdrlen + len;
+    }
+  });
+
+  std::unordered_map<InputSection<E> *, i64> first_cu;
+  for (std::vector<Compunit> &vec : cus) {
+    if (!vec.empty())
+      first_cu[vec[0].isec] = compunits.size();
+    append(compunits, vec);
+  }
+
+  // Maps a compunit offset in an input file to a compunit index.
+  // `val` is the contents of the debug_info_offset field, and `rel` is
+  // the relocation for the field if exists.
+  auto find_cu = [&](ObjectFile<E> &file, i64 num_cus,
+                     InputSection<E> &isec, const ElfRel<E> *rel,
+                     u64 val) -> i64 {
+    InputSection<E> *target = nullptr;
+
+    if (rel) {
+      const ElfSym<E> &esym = file.elf_syms[rel->r_sym];
+      target = file.get_section(esym);
+      val = esym.st_value + isec.get_addend(*rel);
+    }
+
+    for (i64 i = 0; i < file.sections.size(); i++) {
+      InputSection<E> *sec = file.sections[i].get();
+      if (!sec || (target && sec != target))
+        continue;
+
+      auto it = first_cu.find(sec);
+      if (it == first_cu.end())
+        continue;
+
+      for (i64 j = it->second;
+           j < compunits.size() && compunits[j].isec == sec; j++)
+        if (compunits[j].offset == val)
+          return j;
+    }
+
+    // A file usually contains only one compunit.
+    if (num_cus == 1) {
+      for (std::unique_ptr<InputSection<E>> &sec : file.sections)
+        if (auto it = first_cu.find(sec.get()); it != first_cu.end())
+          return it->second;
+    }
+    return -1;
+  };
+
+  // Read symbol names.
+  std::vector<std::vector<PubnameEntry>> pubnames(ctx.objs.size());
+  std::vector<i64> area_cu(ctx.objs.size(), -1);
+  std::atomic_bool has_pubnames = false;
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    ObjectFile<E> &file = *ctx.objs[i];
+    i64 num_cus = 0;
+    i64 cu_idx = -1;
+
+    for (std::unique_ptr<InputSection<E>> &isec : file.sections) {
+      if (auto it = first_cu.find(isec.get()); it != first_cu.end()) {
+        cu_idx = it->second;
+        for (i64 j = cu_idx; j < compunits.size() &&
+                             compunits[j].isec == isec.get(); j++)
+          num_cus++;
+      }
+    }
+
+    if (num_cus == 0)
+      return;
+
+    for (std::unique_ptr<InputSection<E>> &isec : file.sections) {
+      if (!isec || !isec->is_alive)
+        continue;
+
+      std::string_view name = isec->name();
+      if (name == ".debug_pubnames" || name == ".debug_pubtypes" ||
+          name == ".debug_gnu_pubnames" || name == ".debug_gnu_pubtypes") {
+        has_pubnames = true;
+        read_pubnames(ctx, *isec, [&](InputSection<E> &isec,
+                                      const ElfRel<E> *rel, u64 val) {
+          return find_cu(file, num_cus, isec, rel, val);
+        }, pubnames[i]);
+      }
+    }
+
+    // Code sections of a file with a single compunit belong to
+    // that compunit.
+    if (num_cus == 1)
+      area_cu[i] = cu_idx;
+
+    // Remove duplicate entries.
+    sort(pubnames[i], [](const PubnameEntry &a, const PubnameEntry &b) {
+      return std::tuple(a.name, a.entry) < std::tuple(b.name, b.entry);
+    });
+
+    pubnames[i].erase(std::unique(pubnames[i].begin(), pubnames[i].end(),
+                                  [](const PubnameEntry &a,
+                                     const PubnameEntry &b) {
+      return a.name == b.name && a.entry == b.entry;
+    }), pubnames[i].end());
+  });
+
+  // gdb trusts the index, so if no file has names, an index would make
+  // gdb fail to find any symbol. Files without names are tolerated as
+  // lld does.
+  if (!has_pubnames) {
+    Warn(ctx) << "--gdb-index: no .debug_gnu_pubnames found;"
+              << " recompile with -ggnu-pubnames";
+    return;
+  }
+
+  // Collect address areas.
+  for (i64 i = 0; i < ctx.objs.size(); i++)
+    if (area_cu[i] != -1)
+      for (std::unique_ptr<InputSection<E>> &isec : ctx.objs[i]->sections)
+        if (isec && isec->is_alive && (isec->shdr.sh_flags & SHF_ALLOC) &&
+            (isec->shdr.sh_flags & SHF_EXECINSTR) && isec->shdr.sh_size)
+          areas.push_back({isec.get(), (u32)area_cu[i]});
+
+  // Uniquify symbol names.
+  i64 num_entries = 0;
+  for (std::vector<PubnameEntry> &vec : pubnames)
+    num_entries += vec.size();
+  map.resize(num_entries * 2);
+
+  tbb::parallel_for_each(pubnames, [&](std::vector<PubnameEntry> &vec) {
+    for (PubnameEntry &ent : vec) {
+      GdbIndexName val;
+      val.hash = gdb_hash(ent.name);
+      ent.ent = map.insert(ent.name, hash_string(ent.name), val).first;
+      ent.ent->num_entries++;
+    }
+  });
+
+  for (i64 i = 0; i < map.nbuckets; i++)
+    if (map.has_key(i))
+      names.push_back({{map.keys[i], map.sizes[i]}, map.values + i});
+
+  // Sort names to make the output deterministic.
+  tbb::parallel_sort(names.begin(), names.end(),
+                     [](const std::pair<std::string_view, GdbIndexName *> &a,
+                        const std::pair<std::string_view, GdbIndexName *> &b) {
+    return a.first < b.first;
+  });
+
+  // Assign offsets in the constant pool. The compunit lists come first,
+  // and the strings follow.
+  u32 entry_idx = 0;
+  u32 offset = 0;
+
+  for (auto [name, ent] : names) {
+    ent->entry_idx = entry_idx;
+    ent->cuvec_offset = offset;
+    entry_idx += ent->num_entries;
+    offset += (ent->num_entries + 1) * 4;
+  }
+
+  for (auto [name, ent] : names) {
+    ent->name_offset = offset;
+    offset += name.size() + 1;
+  }
+
+  // Fill compunit lists.
+  entries.resize(entry_idx);
+
+  tbb::parallel_for_each(pubnames, [&](std::vector<PubnameEntry> &vec) {
+    for (PubnameEntry &ent : vec)
+      entries[ent.ent->entry_idx + ent.ent->num_filled++] = ent.entry;
+  });
+
+  tbb::parallel_for_each(names, [&](std::pair<std::string_view,
+                                              GdbIndexName *> &p) {
+    auto begin = entries.begin() + p.second->entry_idx;
+    std::sort(begin, begin + p.second->num_entries);
+  });
+
+  // gdb uses a hash table whose load factor is at most 3/4.
+  symtab_size = next_power_of_two(std::max<i64>(names.size() * 4 / 3, 1));
+
+  this->shdr.sh_size = sizeof(GdbIndexHeader) + compunits.size() * 16 +
+                       areas.size() * 20 + symtab_size * 8 + offset;
+}
+
+template <typename E>
+void GdbIndexSection<E>::copy_buf(Context<E> &ctx) {
+  u8 *base = ctx.buf + this->shdr.sh_offset;
+
+  GdbIndexHeader &hdr = *(GdbIndexHeader *)base;
+  hdr.version = GDB_INDEX_VERSION;
+  hdr.cu_list_offset = sizeof(hdr);
+  hdr.cu_types_offset = hdr.cu_list_offset + compunits.size() * 16;
+  hdr.areas_offset = hdr.cu_types_offset;
+  hdr.symtab_offset = hdr.areas_offset + areas.size() * 20;
+  hdr.const_pool_offset = hdr.symtab_offset + symtab_size * 8;
+
+  // Write the compunit list.
+  u64 *cu_list = (u64 *)(base + hdr.cu_list_offset);
+  for (Compunit &cu : compunits) {
+    *cu_list++ = cu.isec->offset + cu.offset;
+    *cu_list++ = cu.size;
+  }
+
+  // Write the address area.
+  u8 *area = base + hdr.areas_offset;
+  for (AddressArea &x : areas) {
+    *(u64 *)area = x.isec->get_addr();
+    *(u64 *)(area + 8) = x.isec->get_addr() + x.isec->shdr.sh_size;
+    *(u32 *)(area + 16) = x.cu_idx;
+    area += 20;
+  }
+
+  // Write the symbol table.
+  u32 *symtab = (u32 *)(base + hdr.symtab_offset);
+  memset(symtab, 0, symtab_size * 8);
+
+  for (auto [name, ent] : names) {
+    u32 mask = symtab_size - 1;
+    u32 idx = ent->hash & mask;
+    u32 step = ((ent->hash * 17) & mask) | 1;
+
+    while (symtab[idx * 2] || symtab[idx * 2 + 1])
+      idx = (idx + step) & mask;
+
+    symtab[idx * 2] = ent->name_offset;
+    symtab[idx * 2 + 1] = ent->cuvec_offset;
+  }
+
+  // Write the constant pool.
+  u8 *pool = base + hdr.const_pool_offset;
+
+  tbb::parallel_for_each(names, [&](std::pair<std::string_view,
+                                              GdbIndexName *> &p) {
+    auto [name, ent] = p;
+    u32 *vec = (u32 *)(pool + ent->cuvec_offset);
+    *vec++ = ent->num_entries;
+    memcpy(vec, entries.data() + ent->entry_idx, ent->num_entries * 4);
+    write_string(pool + ent->name_offset, name);
+  });
+}
+
+#define INSTANTIATE(E)                                                  \
+  template class GdbIndexSection<E>;
+
+INSTANTIATE(X86_64);
+INSTANTIATE(I386);
+INSTANTIATE(ARM64);
+
+} // namespace mold::elf
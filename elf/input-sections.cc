@@ -1,6 +1,11 @@
 #include "mold.h"
 
 #include <limits>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
 
 namespace mold::elf {
 
@@ -55,19 +60,75 @@ InputSection<E>::InputSection(Context<E> &ctx, ObjectFile<E> &file,
     OutputSection<E>::get_instance(ctx, name, shdr.sh_type, shdr.sh_flags);
 }
 
+template <typename E>
+void InputSection<E>::uncompress_to(Context<E> &ctx, u8 *buf) {
+#ifdef HAVE_ZSTD
+  if (compress_type == ELFCOMPRESS_ZSTD) {
+    // ZSTD_decompress handles data consisting of multiple frames.
+    size_t size = ZSTD_decompress(buf, shdr.sh_size, contents.data(),
+                                  contents.size());
+    if (ZSTD_isError(size))
+      Fatal(ctx) << *this << ": ZSTD_decompress failed";
+    if (size != shdr.sh_size)
+      Fatal(ctx) << *this << ": ZSTD_decompress: invalid size";
+    return;
+  }
+#endif
+
+  unsigned long size = shdr.sh_size;
+  if (::uncompress(buf, &size, (u8 *)contents.data(), contents.size()) != Z_OK)
+    Fatal(ctx) << *this << ": uncompress failed";
+  if (size != shdr.sh_size)
+    Fatal(ctx) << *this << ": uncompress: invalid size";
+}
+
+// Inflates a compressed section in memory. Most compressed sections
+// don't need this because write_to() inflates them directly into the
+// output buffer.
+template <typename E>
+void InputSection<E>::uncompress(Context<E> &ctx) {
+  if (!compress_type)
+    return;
+
+  u8 *buf = new u8[shdr.sh_size];
+  ctx.string_pool.push_back(std::unique_ptr<u8[]>(buf));
+  uncompress_to(ctx, buf);
+  contents = {(char *)buf, (size_t)shdr.sh_size};
+  compress_type = 0;
+}
+
+void PreResolvedRelocs::apply(u8 *base) const {
+  for (const Word32 &rel : word32)
+    *(u32 *)(base + rel.offset) = rel.val;
+
+  for (const Word64 &rel : word64)
+    *(u64 *)(base + rel.offset) = rel.val;
+
+  for (const Insn32 &rel : insn32) {
+    u32 *loc = (u32 *)(base + rel.offset);
+    *loc = (*loc & rel.mask) | rel.val;
+  }
+}
+
 template <typename E>
 void InputSection<E>::write_to(Context<E> &ctx, u8 *buf) {
   if (shdr.sh_type == SHT_NOBITS || shdr.sh_size == 0)
     return;
 
   // Copy data
-  memcpy(buf, contents.data(), contents.size());
+  if (compress_type)
+    uncompress_to(ctx, buf);
+  else
+    memcpy(buf, contents.data(), contents.size());
 
   // Apply relocations
-  if (shdr.sh_flags & SHF_ALLOC)
+  if (shdr.sh_flags & SHF_ALLOC) {
+    if (pre_resolved)
+      pre_resolved->apply(buf);
     apply_reloc_alloc(ctx, buf);
-  else
+  } else {
     apply_reloc_nonalloc(ctx, buf);
+  }
 
   // As a special case, .ctors and .dtors section contents are
   // reversed. These sections are now obsolete and mapped to
@@ -157,7 +218,8 @@ void InputSection<E>::dispatch(Context<E> &ctx, Action table[3][4], i64 i,
       ctx.has_textrel = true;
     }
     needs_baserel[i] = true;
-    file.num_dynrel++;
+    if (!is_relr_reloc(ctx, rel))
+      file.num_dynrel++;
     return;
   default:
     unreachable();
@@ -0,0 +1,980 @@
+// This file implements --skip-if-unchanged and --incremental.
+//
+// In --skip-if-unchanged mode, we save a small state file next to the
+// output file after each successful link. The state file records a hash
+// of the command line and the identity (size and mtime) of every file
+// the linker looked at, including the library search paths that did not
+// exist at that moment. Such negative entries are needed because
+// creating a new file in an earlier library search path changes the
+// link result even if no existing file is updated.
+//
+// On the next link, if nothing has changed, the existing output file is
+// still valid and we can skip the entire link. Otherwise, we do a full
+// link and rewrite the state file.
+//
+// In --incremental mode, we reserve slack space at the end of each
+// output section that can grow and save the file layout, i.e. the
+// offsets of input sections, the addresses of global symbols and the
+// hashes of mergeable sections, next to the output file.
+//
+// On the next link, input sections of unchanged files are put at the
+// same offsets as before. Sections of changed files are put back to
+// their previous places if they still fit, or to the slack space
+// otherwise. If the resulting file layout is the same as before, we
+// patch the existing output file in place: we rewrite only sections of
+// changed files, sections that refer to symbols or mergeable strings
+// whose addresses have changed, and linker-synthesized sections. If a
+// section doesn't fit in the slack space, we do a full link.
+//
+// Note that we still read and resolve all input files. What we save is
+// the cost of copying and relocating unchanged sections and writing
+// them to the output file, which dominates the link time of a large
+// program.
+
+#include "mold.h"
+
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <unistd.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace mold::elf {
+
+static constexpr std::string_view STATE_MAGIC = "mold-link-state-v1";
+
+struct FileIdentity {
+  bool operator==(const FileIdentity &) const = default;
+
+  i64 size = 0;
+  i64 mtime = 0;
+};
+
+template <typename E>
+static std::string get_state_path(Context<E> &ctx) {
+  return ctx.arg.output + ".mold-state";
+}
+
+// Returns the size and mtime of a given file. A nonexistent file
+// is represented as {0, 0}.
+template <typename E>
+static FileIdentity get_identity(Context<E> &ctx, std::string path) {
+  if (path.starts_with('/') && !ctx.arg.chroot.empty())
+    path = ctx.arg.chroot + "/" + path_clean(path);
+
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1)
+    return {};
+  return {st.st_size,
+          (i64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec};
+}
+
+// -plugin and -plugin-opt are ignored by mold. We exclude them from
+// the hash because the compiler driver passes a randomly-named
+// temporary file to the LTO plugin on each invocation.
+static bool is_plugin_arg(std::string_view arg) {
+  if (arg.starts_with("--"))
+    arg = arg.substr(1);
+  return arg == "-plugin" || arg == "-plugin-opt" ||
+         arg.starts_with("-plugin=") || arg.starts_with("-plugin-opt=");
+}
+
+template <typename E>
+static u64 hash_cmdline(Context<E> &ctx) {
+  std::span<std::string_view> args = ctx.cmdline_args;
+  std::string buf;
+
+  while (!args.empty()) {
+    if (is_plugin_arg(args[0])) {
+      args = args.subspan(args[0].find('=') == args[0].npos ? 2 : 1);
+      continue;
+    }
+
+    buf += args[0];
+    buf += '\0';
+    args = args.subspan(1);
+  }
+
+  char *cwd = getcwd(nullptr, 0);
+  if (cwd) {
+    buf += cwd;
+    free(cwd);
+  }
+  return hash_string(buf);
+}
+
+template <typename E>
+static bool can_skip_link(Context<E> &ctx) {
+  return ctx.arg.skip_if_unchanged && !ctx.arg.preload && ctx.arg.output != "-";
+}
+
+// Returns true if the output file is known to be identical to what
+// we would produce for the current command line.
+template <typename E>
+bool is_output_up_to_date(Context<E> &ctx) {
+  if (!can_skip_link(ctx))
+    return false;
+
+  Timer t(ctx, "is_output_up_to_date");
+
+  std::ifstream in(get_state_path(ctx));
+  if (!in)
+    return false;
+
+  std::string magic;
+  u64 hash;
+  FileIdentity out;
+
+  if (!(in >> magic >> hash >> out.size >> out.mtime) || magic != STATE_MAGIC)
+    return false;
+  if (hash != hash_cmdline(ctx))
+    return false;
+  if (get_identity(ctx, ctx.arg.output) != out)
+    return false;
+
+  FileIdentity id;
+  std::string path;
+  while (in >> id.size >> id.mtime) {
+    in.get();
+    if (!std::getline(in, path))
+      return false;
+    if (get_identity(ctx, path) != id)
+      return false;
+  }
+  return in.eof();
+}
+
+// Writes the state file for the next link. This needs to be
+// called after the output file is closed so that we can record its mtime.
+template <typename E>
+void write_link_state(Context<E> &ctx) {
+  if (!can_skip_link(ctx))
+    return;
+
+  Timer t(ctx, "write_link_state");
+
+  std::string path = get_state_path(ctx);
+  std::string tmp = path + ".tmp";
+
+  std::ofstream out(tmp);
+  if (!out)
+    Fatal(ctx) << "cannot open " << tmp << ": " << errno_string();
+
+  FileIdentity id = get_identity(ctx, ctx.arg.output);
+  out << STATE_MAGIC << "\n" << hash_cmdline(ctx) << "\n"
+      << id.size << " " << id.mtime << "\n";
+
+  std::unordered_set<std::string_view> seen;
+
+  for (std::unique_ptr<MappedFile<Context<E>>> &mf : ctx.mf_pool) {
+    if (mf->parent || !seen.insert(mf->name).second)
+      continue;
+    if (mf->name.find('\n') != mf->name.npos) {
+      out.close();
+      unlink(tmp.c_str());
+      unlink(path.c_str());
+      return;
+    }
+
+    // MappedFile::open leaves mtime 0 if it fails to open a file.
+    if (mf->mtime == 0)
+      out << "0 0 " << mf->name << "\n";
+    else
+      out << mf->size << " " << mf->mtime << " " << mf->name << "\n";
+  }
+
+  out.close();
+  if (!out || rename(tmp.c_str(), path.c_str()) == -1)
+    Fatal(ctx) << "cannot write " << path << ": " << errno_string();
+}
+
+static constexpr std::string_view INCREMENTAL_MAGIC = "mold-incremental-v1";
+
+template <typename E>
+static std::string get_incremental_state_path(Context<E> &ctx) {
+  return ctx.arg.output + ".mold-incremental";
+}
+
+template <typename E>
+static bool is_incremental(Context<E> &ctx) {
+  return ctx.arg.incremental && !ctx.arg.preload && ctx.arg.output != "-";
+}
+
+// .init and .fini are concatenations of code fragments, and the
+// contents of a section whose name is a C identifier are accessed as
+// an array via __start_ and __stop_ symbols. We can't append a gap to
+// such sections.
+template <typename E>
+static bool can_have_slack(OutputSection<E> &osec) {
+  ElfShdr<E> &shdr = osec.shdr;
+  if (!(shdr.sh_flags & SHF_ALLOC) || (shdr.sh_flags & SHF_TLS))
+    return false;
+  if (shdr.sh_type != SHT_PROGBITS && shdr.sh_type != SHT_NOBITS)
+    return false;
+  return osec.name != ".init" && osec.name != ".fini" &&
+         osec.name != ".ctors" && osec.name != ".dtors" &&
+         osec.name != ".eh_frame" && !is_c_identifier(osec.name);
+}
+
+template <typename E>
+static void reserve_slack(Context<E> &ctx) {
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections)
+    if (!osec->members.empty() && can_have_slack(*osec))
+      osec->shdr.sh_size += std::max<u64>(osec->shdr.sh_size / 8, 4096);
+}
+
+// Returns input sections of a given file that belong to output
+// sections with slack, in the section index order.
+template <typename E>
+static std::vector<InputSection<E> *>
+get_pinnable_sections(ObjectFile<E> &file) {
+  std::vector<InputSection<E> *> vec;
+  for (std::unique_ptr<InputSection<E>> &isec : file.sections)
+    if (isec && isec->is_alive && isec->output_section &&
+        can_have_slack(*isec->output_section))
+      vec.push_back(isec.get());
+  return vec;
+}
+
+// Returns names that identify input files across links.
+template <typename E>
+static std::vector<std::string> get_file_keys(Context<E> &ctx) {
+  std::vector<std::string> vec;
+  std::unordered_map<std::string, i64> count;
+
+  for (ObjectFile<E> *file : ctx.objs) {
+    std::string key;
+    if (file->archive_name.empty())
+      key = path_clean(file->filename);
+    else
+      key = path_clean(file->archive_name) + "(" + file->filename + ")";
+
+    if (i64 n = count[key]++; n)
+      key += "#" + std::to_string(n);
+    vec.push_back(key);
+  }
+  return vec;
+}
+
+template <typename E>
+static FileIdentity get_file_identity(ObjectFile<E> &file) {
+  MappedFile<Context<E>> *mf = file.mf;
+  if (!mf)
+    return {};
+  if (mf->parent)
+    return {mf->size, mf->parent->mtime};
+  return {mf->size, mf->mtime};
+}
+
+// Relocated values depend on these values in addition to the file
+// layout and symbol addresses.
+template <typename E>
+static u64 get_global_hash(Context<E> &ctx) {
+  u64 vals[] = {ctx.tls_begin, ctx.tls_end, ctx.got->tlsld_idx};
+  return XXH3_64bits(vals, sizeof(vals));
+}
+
+// Returns a hash of everything that a relocation referring a given
+// symbol may depend on.
+template <typename E>
+static u64 get_fingerprint(Context<E> &ctx, Symbol<E> &sym) {
+  if (!sym.file)
+    return 0;
+
+  u64 vals[] = {
+    sym.get_addr(ctx),
+    sym.get_addr(ctx, false),
+    sym.esym().st_size,
+    sym.get_type(),
+    sym.is_imported,
+    sym.is_exported,
+    sym.has_copyrel,
+    (u64)sym.get_got_idx(ctx),
+    (u64)sym.get_gottp_idx(ctx),
+    (u64)sym.get_tlsgd_idx(ctx),
+    (u64)sym.get_tlsdesc_idx(ctx),
+    (u64)sym.get_plt_idx(ctx),
+    (u64)sym.get_pltgot_idx(ctx),
+    (u64)sym.get_dynsym_idx(ctx),
+  };
+  return XXH3_64bits(vals, sizeof(vals));
+}
+
+template <typename E>
+static std::vector<Symbol<E> *> get_global_symbols(Context<E> &ctx) {
+  std::vector<Symbol<E> *> vec;
+  std::unordered_set<Symbol<E> *> seen;
+
+  for (ObjectFile<E> *file : ctx.objs)
+    for (Symbol<E> *sym : file->get_global_syms())
+      if (!sym->name().empty() && seen.insert(sym).second)
+        vec.push_back(sym);
+  return vec;
+}
+
+// Returns the layout of allocated chunks. For mergeable sections, we
+// also compute hashes of their contents because the offsets of
+// fragments may change even if the section size doesn't.
+template <typename E>
+static std::vector<typename IncrementalState<E>::ChunkSlot>
+get_layout(Context<E> &ctx, bool compute_hash) {
+  std::unordered_set<Chunk<E> *> merged;
+  if (compute_hash)
+    for (std::unique_ptr<MergedSection<E>> &sec : ctx.merged_sections)
+      merged.insert(sec.get());
+
+  std::vector<typename IncrementalState<E>::ChunkSlot> vec;
+
+  for (Chunk<E> *chunk : ctx.chunks) {
+    ElfShdr<E> &shdr = chunk->shdr;
+    if (!(shdr.sh_flags & SHF_ALLOC))
+      continue;
+
+    u64 hash = 0;
+    if (merged.contains(chunk) && shdr.sh_type != SHT_NOBITS) {
+      std::vector<u8> buf(shdr.sh_size);
+      chunk->write_to(ctx, buf.data());
+      hash = XXH3_64bits(buf.data(), buf.size());
+    }
+
+    vec.push_back({shdr.sh_type, shdr.sh_flags, shdr.sh_addr,
+                   shdr.sh_offset, shdr.sh_size, hash});
+  }
+  return vec;
+}
+
+template <typename E>
+static std::unique_ptr<IncrementalState<E>>
+read_incremental_state(Context<E> &ctx) {
+  typedef IncrementalState<E> S;
+
+  std::ifstream in(get_incremental_state_path(ctx));
+  if (!in)
+    return nullptr;
+
+  std::unique_ptr<S> state = std::make_unique<S>();
+  std::string magic;
+  u64 hash;
+  FileIdentity out;
+
+  if (!(in >> magic >> hash >> state->global_hash >> out.size >> out.mtime >>
+        state->eh_frame_size >> state->eh_frame_hdr_size) ||
+      magic != INCREMENTAL_MAGIC)
+    return nullptr;
+  if (hash != hash_cmdline(ctx))
+    return nullptr;
+  if (get_identity(ctx, ctx.arg.output) != out)
+    return nullptr;
+
+  i64 num_osecs;
+  if (!(in >> num_osecs) || num_osecs < 0)
+    return nullptr;
+
+  for (i64 i = 0; i < num_osecs; i++) {
+    typename S::OutputSlot slot;
+    if (!(in >> slot.type >> slot.flags >> slot.size >> slot.used))
+      return nullptr;
+    in.get();
+    if (!std::getline(in, slot.name))
+      return nullptr;
+    state->osecs.push_back(slot);
+  }
+
+  i64 num_chunks;
+  if (!(in >> num_chunks) || num_chunks < 0)
+    return nullptr;
+
+  for (i64 i = 0; i < num_chunks; i++) {
+    typename S::ChunkSlot slot;
+    if (!(in >> slot.type >> slot.flags >> slot.addr >> slot.offset >>
+          slot.size >> slot.hash))
+      return nullptr;
+    state->chunks.push_back(slot);
+  }
+
+  i64 num_files;
+  if (!(in >> num_files) || num_files < 0)
+    return nullptr;
+
+  for (i64 i = 0; i < num_files; i++) {
+    typename S::FileSlots file;
+    i64 num_slots;
+    std::string key;
+
+    if (!(in >> file.size >> file.mtime >> num_slots) || num_slots < 0)
+      return nullptr;
+    in.get();
+    if (!std::getline(in, key))
+      return nullptr;
+
+    for (i64 j = 0; j < num_slots; j++) {
+      typename S::SectionSlot slot;
+      if (!(in >> slot.section_idx >> slot.osec_idx >> slot.offset >>
+            slot.size) || slot.osec_idx >= num_osecs)
+        return nullptr;
+      file.slots.push_back(slot);
+    }
+    state->files[key] = std::move(file);
+  }
+
+  u64 fingerprint;
+  std::string name;
+  while (in >> fingerprint) {
+    in.get();
+    if (!std::getline(in, name))
+      return nullptr;
+    state->symbols[name] = fingerprint;
+  }
+
+  if (!in.eof())
+    return nullptr;
+  return state;
+}
+
+// Assigns input sections the same offsets as in the previous link.
+// Returns false if we can't do that.
+template <typename E>
+static bool pin_sections(Context<E> &ctx, IncrementalState<E> &state) {
+  typedef IncrementalState<E> S;
+
+  // Map output sections to the ones in the previous link.
+  std::vector<i64> osec_map(ctx.output_sections.size(), -1);
+  std::vector<OutputSection<E> *> prev_osecs(state.osecs.size());
+
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections) {
+    if (osec->members.empty() || !can_have_slack(*osec))
+      continue;
+
+    for (i64 i = 0; i < state.osecs.size(); i++) {
+      typename S::OutputSlot &slot = state.osecs[i];
+      if (slot.name == osec->name && slot.type == osec->shdr.sh_type &&
+          slot.flags == osec->shdr.sh_flags) {
+        osec_map[osec->idx] = i;
+        prev_osecs[i] = osec.get();
+        break;
+      }
+    }
+
+    if (osec_map[osec->idx] == -1)
+      return false;
+  }
+
+  // Find files that have changed since the last link. If a file is
+  // unchanged but the set of its live sections has changed (e.g. due
+  // to comdat elimination), we treat it as a changed file too.
+  std::vector<std::string> keys = get_file_keys(ctx);
+  std::vector<typename S::FileSlots *> prev(ctx.objs.size());
+  std::vector<u8> is_changed(ctx.objs.size());
+
+  for (i64 i = 0; i < ctx.objs.size(); i++)
+    if (auto it = state.files.find(keys[i]); it != state.files.end())
+      prev[i] = &it->second;
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    typename S::FileSlots *file = prev[i];
+    if (!file || get_file_identity(*ctx.objs[i]) !=
+                 FileIdentity{file->size, file->mtime}) {
+      is_changed[i] = true;
+      return;
+    }
+
+    std::vector<InputSection<E> *> vec = get_pinnable_sections(*ctx.objs[i]);
+    if (vec.size() != file->slots.size()) {
+      is_changed[i] = true;
+      return;
+    }
+
+    for (i64 j = 0; j < vec.size(); j++) {
+      typename S::SectionSlot &slot = file->slots[j];
+      if (slot.section_idx != vec[j]->section_idx ||
+          slot.osec_idx != osec_map[vec[j]->output_section->idx] ||
+          slot.size != vec[j]->shdr.sh_size) {
+        is_changed[i] = true;
+        return;
+      }
+    }
+  });
+
+  // Sections of changed files are put back to their previous slots if
+  // they still fit, or appended to the used part of their output
+  // sections otherwise.
+  std::vector<u64> used(state.osecs.size());
+  for (i64 i = 0; i < state.osecs.size(); i++)
+    used[i] = state.osecs[i].used;
+
+  std::vector<std::pair<InputSection<E> *, u64>> placed;
+
+  for (i64 i = 0; i < ctx.objs.size(); i++) {
+    if (!is_changed[i])
+      continue;
+
+    for (InputSection<E> *isec : get_pinnable_sections(*ctx.objs[i])) {
+      i64 idx = osec_map[isec->output_section->idx];
+      u64 align = std::max<u64>(isec->shdr.sh_addralign, 1);
+
+      typename S::SectionSlot *slot = nullptr;
+      if (prev[i])
+        for (typename S::SectionSlot &s : prev[i]->slots)
+          if (s.section_idx == isec->section_idx && s.osec_idx == idx)
+            slot = &s;
+
+      if (slot && isec->shdr.sh_size <= slot->size &&
+          slot->offset % align == 0) {
+        placed.push_back({isec, slot->offset});
+      } else {
+        u64 offset = align_to(used[idx], align);
+        placed.push_back({isec, offset});
+        used[idx] = offset + isec->shdr.sh_size;
+      }
+    }
+  }
+
+  for (i64 i = 0; i < state.osecs.size(); i++)
+    if (used[i] > state.osecs[i].size)
+      return false;
+
+  // Now we know that all sections fit. Assign offsets.
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    if (!is_changed[i]) {
+      std::vector<InputSection<E> *> vec = get_pinnable_sections(*ctx.objs[i]);
+      for (i64 j = 0; j < vec.size(); j++)
+        vec[j]->offset = prev[i]->slots[j].offset;
+    }
+  });
+
+  for (std::pair<InputSection<E> *, u64> &p : placed)
+    p.first->offset = p.second;
+
+  state.is_pinned.resize(ctx.output_sections.size());
+
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections) {
+    if (i64 idx = osec_map[osec->idx]; idx != -1) {
+      osec->shdr.sh_size = state.osecs[idx].size;
+      // Empty sections may share an offset with the following section,
+      // so they have to come first.
+      sort(osec->members, [](InputSection<E> *a, InputSection<E> *b) {
+        return std::tuple(a->offset, a->shdr.sh_size) <
+               std::tuple(b->offset, b->shdr.sh_size);
+      });
+      state.is_pinned[osec->idx] = true;
+    }
+  }
+
+  // Previous contents of changed or removed files have to be cleared
+  // if we patch the output file.
+  auto add_stale = [&](typename S::FileSlots &file) {
+    for (typename S::SectionSlot &slot : file.slots)
+      if (OutputSection<E> *osec = prev_osecs[slot.osec_idx])
+        if (osec->shdr.sh_type != SHT_NOBITS)
+          state.stale_slots.push_back({osec, slot.offset, slot.size});
+  };
+
+  for (i64 i = 0; i < ctx.objs.size(); i++) {
+    if (is_changed[i]) {
+      state.changed_files.insert(ctx.objs[i]);
+      if (prev[i])
+        add_stale(*prev[i]);
+    }
+  }
+
+  std::unordered_set<std::string_view> seen(keys.begin(), keys.end());
+  for (auto &[key, file] : state.files)
+    if (!seen.contains(key))
+      add_stale(file);
+  return true;
+}
+
+// Returns true if we will be able to update the existing output file
+// in place. We can't if it has other hard links or if it is running
+// (ETXTBSY), for example.
+template <typename E>
+static bool is_patchable(Context<E> &ctx) {
+  if (ctx.arg.filler != -1)
+    return false;
+
+  struct stat st;
+  if (stat(ctx.arg.output.c_str(), &st) == -1 ||
+      (st.st_mode & S_IFMT) != S_IFREG || st.st_uid != geteuid() ||
+      st.st_nlink != 1)
+    return false;
+
+  i64 fd = ::open(ctx.arg.output.c_str(), O_RDWR);
+  if (fd == -1)
+    return false;
+  close(fd);
+  return true;
+}
+
+// Called after compute_section_sizes(). If we have the layout of the
+// previous link, we keep input sections at the same offsets. Otherwise,
+// we reserve slack space for the next link.
+template <typename E>
+void assign_incremental_offsets(Context<E> &ctx) {
+  if (!is_incremental(ctx))
+    return;
+
+  Timer t(ctx, "assign_incremental_offsets");
+
+  if (is_patchable(ctx)) {
+    std::unique_ptr<IncrementalState<E>> state = read_incremental_state(ctx);
+    if (state && pin_sections(ctx, *state)) {
+      ctx.incremental = std::move(state);
+      return;
+    }
+  }
+  reserve_slack(ctx);
+}
+
+// Returns true if allocated chunks have the same sizes as in the
+// previous link. If not, the file layout will change.
+template <typename E>
+static bool has_same_sizes(Context<E> &ctx, IncrementalState<E> &state) {
+  i64 i = 0;
+  for (Chunk<E> *chunk : ctx.chunks) {
+    ElfShdr<E> &shdr = chunk->shdr;
+    if (!(shdr.sh_flags & SHF_ALLOC))
+      continue;
+    if (i == state.chunks.size())
+      return false;
+
+    typename IncrementalState<E>::ChunkSlot &slot = state.chunks[i++];
+    if (slot.type != shdr.sh_type || slot.flags != shdr.sh_flags ||
+        slot.size != shdr.sh_size)
+      return false;
+  }
+  return i == state.chunks.size();
+}
+
+// Discards the previous layout. Since we are going to write the entire
+// output file anyway, we pack input sections again and reserve fresh
+// slack space, so that holes left by changed files are reclaimed.
+template <typename E>
+static void unpin_sections(Context<E> &ctx) {
+  IncrementalState<E> &state = *ctx.incremental;
+
+  tbb::parallel_for_each(ctx.output_sections,
+                         [&](std::unique_ptr<OutputSection<E>> &osec) {
+    if (!state.is_pinned[osec->idx])
+      return;
+
+    u64 offset = 0;
+    for (InputSection<E> *isec : osec->members) {
+      offset = align_to(offset, isec->shdr.sh_addralign);
+      isec->offset = offset;
+      offset += isec->shdr.sh_size;
+    }
+    osec->shdr.sh_size = offset;
+  });
+
+  ctx.incremental.reset();
+  reserve_slack(ctx);
+
+  // .relr.dyn contents depend on input section offsets.
+  if (ctx.relrdyn) {
+    construct_relr(ctx);
+    ctx.relrdyn->update_shdr(ctx);
+  }
+}
+
+// Called after section sizes are fixed.
+//
+// .eh_frame and .eh_frame_hdr are synthesized by the linker, and their
+// sizes change as FDEs are added or removed. They can have slack too;
+// .eh_frame is terminated by the first null word, and .eh_frame_hdr
+// has the number of entries in its header.
+//
+// If some allocated chunk has changed its size, we know that we can't
+// patch the previous output file, so we drop the previous layout here.
+template <typename E>
+void assign_incremental_sizes(Context<E> &ctx) {
+  if (!is_incremental(ctx))
+    return;
+
+  Chunk<E> *eh_frame = ctx.eh_frame.get();
+  Chunk<E> *eh_frame_hdr = ctx.eh_frame_hdr.get();
+  u64 eh_frame_size = eh_frame ? (u64)eh_frame->shdr.sh_size : 0;
+  u64 eh_frame_hdr_size = eh_frame_hdr ? (u64)eh_frame_hdr->shdr.sh_size : 0;
+
+  if (IncrementalState<E> *state = ctx.incremental.get()) {
+    if (eh_frame_size <= state->eh_frame_size &&
+        eh_frame_hdr_size <= state->eh_frame_hdr_size) {
+      if (eh_frame)
+        eh_frame->shdr.sh_size = state->eh_frame_size;
+      if (eh_frame_hdr)
+        eh_frame_hdr->shdr.sh_size = state->eh_frame_hdr_size;
+      if (has_same_sizes(ctx, *state))
+        return;
+    }
+    unpin_sections(ctx);
+  }
+
+  auto reserve = [](Chunk<E> *chunk, u64 size) {
+    if (chunk)
+      chunk->shdr.sh_size = size + std::max<u64>(size / 8, 4096);
+  };
+
+  reserve(eh_frame, eh_frame_size);
+  reserve(eh_frame_hdr, eh_frame_hdr_size);
+}
+
+// We can patch the existing output file only if all allocated chunks
+// are at the same locations as before.
+template <typename E>
+void check_incremental_layout(Context<E> &ctx) {
+  IncrementalState<E> *state = ctx.incremental.get();
+  if (!state)
+    return;
+
+  Timer t(ctx, "check_incremental_layout");
+
+  std::vector<typename IncrementalState<E>::ChunkSlot> vec =
+    get_layout(ctx, false);
+
+  auto is_same = [](auto &a, auto &b) {
+    return a.type == b.type && a.flags == b.flags && a.addr == b.addr &&
+           a.offset == b.offset && a.size == b.size;
+  };
+
+  state->can_patch =
+    ctx.arg.filler == -1 && state->global_hash == get_global_hash(ctx) &&
+    std::equal(vec.begin(), vec.end(), state->chunks.begin(),
+               state->chunks.end(), is_same);
+}
+
+// Returns true if a given section of an unchanged file has to be
+// rewritten. That is the case if the section refers to a symbol or a
+// mergeable string whose address may have changed since the last link,
+// or if it has dynamic relocations, as .rela.dyn is rebuilt from
+// scratch.
+template <typename E>
+static bool
+needs_rewrite(Context<E> &ctx, InputSection<E> &isec,
+              IncrementalState<E> &state,
+              std::unordered_set<Symbol<E> *> &changed_syms,
+              std::unordered_set<Chunk<E> *> &changed_merged) {
+  ObjectFile<E> &file = isec.file;
+  std::span<ElfRel<E>> rels = isec.get_rels(ctx);
+
+  for (i64 i = 0; i < rels.size(); i++) {
+    const ElfRel<E> &rel = rels[i];
+    if (rel.r_type == E::R_NONE)
+      continue;
+
+    if (isec.needs_dynrel[i] ||
+        (isec.needs_baserel[i] && !isec.is_relr_reloc(ctx, rel)))
+      return true;
+
+    Symbol<E> &sym = *file.symbols[rel.r_sym];
+
+    if (rel.r_sym >= file.first_global) {
+      if (changed_syms.contains(&sym))
+        return true;
+      continue;
+    }
+
+    if (SectionFragment<E> *frag = sym.get_frag()) {
+      if (changed_merged.contains(&frag->output_section))
+        return true;
+      continue;
+    }
+
+    // A local symbol in the same file moves only if it's in an output
+    // section without slack.
+    if (InputSection<E> *sec = sym.input_section)
+      if (!sec->is_ehframe &&
+          (!sec->output_section || !state.is_pinned[sec->output_section->idx]))
+        return true;
+  }
+
+  if (isec.rel_fragments)
+    for (i64 i = 0; isec.rel_fragments[i].idx != -1; i++)
+      if (changed_merged.contains(&isec.rel_fragments[i].frag->output_section))
+        return true;
+  return false;
+}
+
+// Updates the existing output file in place.
+template <typename E>
+void patch_chunks(Context<E> &ctx) {
+  Timer t(ctx, "patch_chunks");
+  IncrementalState<E> &state = *ctx.incremental;
+
+  auto is_pinned = [&](Chunk<E> *chunk) {
+    return chunk->kind == Chunk<E>::REGULAR &&
+           state.is_pinned[((OutputSection<E> *)chunk)->idx];
+  };
+
+  // Clear the previous contents of changed or removed files.
+  tbb::parallel_for_each(state.stale_slots,
+                         [&](typename IncrementalState<E>::StaleSlot &slot) {
+    memset(ctx.buf + slot.osec->shdr.sh_offset + slot.offset, 0, slot.size);
+  });
+
+  // Linker-synthesized sections, output sections without slack and
+  // non-allocated sections are always rewritten. Synthesized sections
+  // assume that the buffer is zero-initialized, so clear them first.
+  tbb::parallel_for_each(ctx.chunks, [&](Chunk<E> *chunk) {
+    if (is_pinned(chunk))
+      return;
+    if (chunk->kind != Chunk<E>::REGULAR && chunk->shdr.sh_type != SHT_NOBITS)
+      memset(ctx.buf + chunk->shdr.sh_offset, 0, chunk->shdr.sh_size);
+    chunk->copy_buf(ctx);
+  });
+
+  ctx.checkpoint();
+
+  // Find symbols and mergeable sections that have changed.
+  std::unordered_set<Symbol<E> *> changed_syms;
+  for (Symbol<E> *sym : get_global_symbols(ctx)) {
+    auto it = state.symbols.find(std::string(sym->name()));
+    if (it == state.symbols.end() || it->second != get_fingerprint(ctx, *sym))
+      changed_syms.insert(sym);
+  }
+
+  std::unordered_set<Chunk<E> *> changed_merged;
+  {
+    std::vector<typename IncrementalState<E>::ChunkSlot> vec =
+      get_layout(ctx, true);
+    std::vector<Chunk<E> *> chunks;
+    for (Chunk<E> *chunk : ctx.chunks)
+      if (chunk->shdr.sh_flags & SHF_ALLOC)
+        chunks.push_back(chunk);
+
+    for (i64 i = 0; i < chunks.size(); i++)
+      if (vec[i].hash != state.chunks[i].hash)
+        changed_merged.insert(chunks[i]);
+  }
+
+  // Rewrite sections of changed files and sections that need to be
+  // updated.
+  static Counter patched("patched_input_sections");
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    bool is_changed = state.changed_files.contains(file);
+
+    for (std::unique_ptr<InputSection<E>> &isec : file->sections) {
+      if (!isec || !isec->is_alive || !isec->output_section)
+        continue;
+
+      OutputSection<E> &osec = *isec->output_section;
+      if (!state.is_pinned[osec.idx] || osec.shdr.sh_type == SHT_NOBITS)
+        continue;
+
+      if (is_changed ||
+          needs_rewrite(ctx, *isec, state, changed_syms, changed_merged)) {
+        isec->write_to(ctx, ctx.buf + osec.shdr.sh_offset + isec->offset);
+        patched++;
+      }
+    }
+  });
+
+  ctx.checkpoint();
+  ctx.reldyn->sort(ctx);
+}
+
+// Writes the layout of the output file for the next --incremental link.
+// This needs to be called after the output file is closed so that we
+// can record its mtime.
+template <typename E>
+void write_incremental_state(Context<E> &ctx) {
+  if (!is_incremental(ctx))
+    return;
+
+  Timer t(ctx, "write_incremental_state");
+
+  std::string path = get_incremental_state_path(ctx);
+  std::string tmp = path + ".tmp";
+
+  auto fail = [&] {
+    unlink(tmp.c_str());
+    unlink(path.c_str());
+  };
+
+  std::ofstream out(tmp);
+  if (!out)
+    Fatal(ctx) << "cannot open " << tmp << ": " << errno_string();
+
+  FileIdentity id = get_identity(ctx, ctx.arg.output);
+  out << INCREMENTAL_MAGIC << "\n" << hash_cmdline(ctx) << " "
+      << get_global_hash(ctx) << "\n" << id.size << " " << id.mtime << "\n"
+      << (ctx.eh_frame ? ctx.eh_frame->shdr.sh_size : 0) << " "
+      << (ctx.eh_frame_hdr ? ctx.eh_frame_hdr->shdr.sh_size : 0) << "\n";
+
+  // Output sections with slack
+  std::vector<i64> osec_idx(ctx.output_sections.size(), -1);
+  std::vector<OutputSection<E> *> osecs;
+
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections) {
+    if (!osec->members.empty() && can_have_slack(*osec)) {
+      if (osec->name.find('\n') != osec->name.npos)
+        return fail();
+      osec_idx[osec->idx] = osecs.size();
+      osecs.push_back(osec.get());
+    }
+  }
+
+  out << osecs.size() << "\n";
+  for (OutputSection<E> *osec : osecs) {
+    u64 used = 0;
+    for (InputSection<E> *isec : osec->members)
+      used = std::max<u64>(used, isec->offset + isec->shdr.sh_size);
+    out << osec->shdr.sh_type << " " << osec->shdr.sh_flags << " "
+        << osec->shdr.sh_size << " " << used << " " << osec->name << "\n";
+  }
+
+  // Allocated chunks
+  std::vector<typename IncrementalState<E>::ChunkSlot> chunks =
+    get_layout(ctx, true);
+
+  out << chunks.size() << "\n";
+  for (typename IncrementalState<E>::ChunkSlot &c : chunks)
+    out << c.type << " " << c.flags << " " << c.addr << " " << c.offset
+        << " " << c.size << " " << c.hash << "\n";
+
+  // Input files and their sections
+  std::vector<std::string> keys = get_file_keys(ctx);
+  out << ctx.objs.size() << "\n";
+
+  for (i64 i = 0; i < ctx.objs.size(); i++) {
+    if (keys[i].find('\n') != keys[i].npos)
+      return fail();
+
+    FileIdentity id = get_file_identity(*ctx.objs[i]);
+    std::vector<InputSection<E> *> vec = get_pinnable_sections(*ctx.objs[i]);
+
+    out << id.size << " " << id.mtime << " " << vec.size() << " "
+        << keys[i] << "\n";
+    for (InputSection<E> *isec : vec)
+      out << isec->section_idx << " "
+          << osec_idx[isec->output_section->idx] << " "
+          << isec->offset << " " << isec->shdr.sh_size << "\n";
+  }
+
+  // Global symbols
+  for (Symbol<E> *sym : get_global_symbols(ctx))
+    if (sym->name().find('\n') == sym->name().npos)
+      out << get_fingerprint(ctx, *sym) << " " << sym->name() << "\n";
+
+  out.close();
+  if (!out || rename(tmp.c_str(), path.c_str()) == -1)
+    Fatal(ctx) << "cannot write " << path << ": " << errno_string();
+}
+
+#define INSTANTIATE(E)                                                  \
+  template bool is_output_up_to_date(Context<E> &);                     \
+  template void write_link_state(Context<E> &);                         \
+  template void assign_incremental_offsets(Context<E> &);               \
+  template void assign_incremental_sizes(Context<E> &);                 \
+  template void check_incremental_layout(Context<E> &);                 \
+  template void patch_chunks(Context<E> &);                             \
+  template void write_incremental_state(Context<E> &);
+
+INSTANTIATE(X86_64);
+INSTANTIATE(I386);
+INSTANTIATE(ARM64);
+
+} // namespace mold::elf
@@ -29,14 +29,35 @@ std::string glob_to_regex(std::string_view pattern) {
 
 template <typename E>
 static ObjectFile<E> *new_object_file(Context<E> &ctx, MappedFile<Context<E>> *mf,
-                                      std::string archive_name) {
-  static Counter count("parsed_objs");
-  count++;
-
+                                      std::string archive_name,
+                                      std::vector<std::string_view> *lazy_syms = nullptr) {
   bool in_lib = ctx.in_lib || (!archive_name.empty() && !ctx.whole_archive);
+
+  // Reuse a file parsed by `mold --server` if available.
+  if (ObjectFile<E> *file = ctx.obj_cache.get_one(mf);
+      file && file->is_in_lib == in_lib) {
+    file->priority = ctx.file_priority++;
+    if (ctx.arg.trace)
+      SyncOut(ctx) << "trace: " << *file;
+    return file;
+  }
+
   ObjectFile<E> *file = ObjectFile<E>::create(ctx, mf, archive_name, in_lib);
   file->priority = ctx.file_priority++;
-  ctx.tg.run([file, &ctx]() { file->parse(ctx); });
+
+  // Archive members are not fully parsed until they are pulled into
+  // the output. If we have an archive index, we don't even need to
+  // read their symbol tables.
+  if (in_lib && lazy_syms) {
+    ctx.tg.run([file, &ctx, syms = std::move(*lazy_syms)]() {
+      file->init_lazy_symbols(ctx, syms);
+    });
+  } else if (in_lib) {
+    ctx.tg.run([file, &ctx]() { file->parse_lazy(ctx); });
+  } else {
+    ctx.tg.run([file, &ctx]() { file->parse(ctx); });
+  }
+
   if (ctx.arg.trace)
     SyncOut(ctx) << "trace: " << *file;
   return file;
@@ -44,6 +65,14 @@ static ObjectFile<E> *new_object_file(Context<E> &ctx, MappedFile<Context<E>> *m
 
 template <typename E>
 static SharedFile<E> *new_shared_file(Context<E> &ctx, MappedFile<Context<E>> *mf) {
+  if (SharedFile<E> *file = ctx.dso_cache.get_one(mf)) {
+    file->priority = ctx.file_priority++;
+    file->is_alive = !ctx.as_needed;
+    if (ctx.arg.trace)
+      SyncOut(ctx) << "trace: " << *file;
+    return file;
+  }
+
   SharedFile<E> *file = SharedFile<E>::create(ctx, mf);
   file->priority = ctx.file_priority++;
   ctx.tg.run([file, &ctx]() { file->parse(ctx); });
@@ -66,12 +95,31 @@ void read_file(Context<E> &ctx, MappedFile<Context<E>> *mf) {
     ctx.visited.insert(mf->name);
     return;
   case FileType::AR:
-  case FileType::THIN_AR:
-    for (MappedFile<Context<E>> *child : read_archive_members(ctx, mf))
-      if (get_file_type(child) == FileType::ELF_OBJ)
-        ctx.objs.push_back(new_object_file(ctx, child, mf->name));
+  case FileType::THIN_AR: {
+    std::vector<MappedFile<Context<E>> *> members =
+      read_archive_members(ctx, mf);
+
+    std::optional<ArchiveIndex> index;
+    if (!ctx.whole_archive)
+      index = get_archive_index(ctx, mf, members);
+
+    for (i64 i = 0; i < members.size(); i++) {
+      if (get_file_type(members[i]) != FileType::ELF_OBJ)
+        continue;
+
+      if (!index) {
+        ctx.objs.push_back(new_object_file(ctx, members[i], mf->name));
+        continue;
+      }
+
+      // A member that defines no symbol is never pulled into the output.
+      if (!(*index)[i].empty())
+        ctx.objs.push_back(new_object_file(ctx, members[i], mf->name,
+                                           &(*index)[i]));
+    }
     ctx.visited.insert(mf->name);
     return;
+  }
   case FileType::TEXT:
     parse_linker_script(ctx, mf);
     return;
@@ -196,6 +244,22 @@ static void read_input_files(Context<E> &ctx, std::span<std::string_view> args)
     Fatal(ctx) << "no input files";
 
   ctx.tg.wait();
+
+  // Files don't intern their symbols while they are being parsed for
+  // the first time. Instead, they compute symbol hashes so that we can
+  // allocate the global symbol table at once here.
+  if (!ctx.symbol_map.nbuckets) {
+    Timer t(ctx, "intern_symbols");
+    ctx.symbol_map.resize(ctx.symbol_estimator.get_cardinality() * 3 / 2);
+
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+      file->intern_symbols(ctx);
+    });
+
+    tbb::parallel_for_each(ctx.dsos, [&](SharedFile<E> *file) {
+      file->intern_symbols(ctx);
+    });
+  }
 }
 
 template <typename E>
@@ -268,6 +332,12 @@ static void show_stats(Context<E> &ctx) {
         alloc += sec->get_rels(ctx).size();
       else
         nonalloc += sec->get_rels(ctx).size();
+
+      static Counter pre_resolved("reloc_pre_resolved");
+      if (sec->pre_resolved)
+        pre_resolved += sec->pre_resolved->word32.size() +
+                        sec->pre_resolved->word64.size() +
+                        sec->pre_resolved->insn32.size();
     }
 
     static Counter comdats("comdats");
@@ -301,10 +371,75 @@ static void show_stats(Context<E> &ctx) {
   static Counter num_output_chunks("output_chunks", ctx.chunks.size());
   static Counter num_objs("num_objs", ctx.objs.size());
   static Counter num_dsos("num_dsos", ctx.dsos.size());
+  static Counter symbol_bytes("bytes_per_symbol", sizeof(Symbol<E>));
 
   Counter::print();
 }
 
+// Returns a string representation of command line options that affect
+// the result of ObjectFile::parse(). Files parsed by `mold --server`
+// can be reused only if the client's options yield the same string.
+template <typename E>
+static std::string get_parse_options(Context<E> &ctx) {
+  std::vector<std::string_view> wrap(ctx.arg.wrap.begin(), ctx.arg.wrap.end());
+  sort(wrap);
+
+  std::ostringstream out;
+  out << ctx.arg.strip_all << ctx.arg.strip_debug << ctx.arg.discard_all
+      << ctx.arg.discard_locals << !!ctx.arg.retain_symbols_file
+      << ctx.arg.default_version;
+  for (std::string_view name : wrap)
+    out << '\0' << name;
+  return out.str();
+}
+
+// `mold --server [files...]` parses given files only once and then
+// serves link requests from other mold processes. Each request is
+// handled by a forked child process which reuses the parsed files as
+// long as their size and mtime are not changed.
+//
+// This function returns only in a child process. When it returns,
+// ctx is reset to the state for the client's command line.
+template <typename E>
+static void run_server(Context<E> &ctx, std::vector<std::string_view> &file_args,
+                       std::function<void()> *on_complete) {
+  // Parse input files with the calling thread only because forking a
+  // process with running worker threads is not safe.
+  {
+    tbb::global_control tbb_cont(tbb::global_control::max_allowed_parallelism,
+                                 1);
+    read_input_files(ctx, file_args);
+  }
+
+  for (ObjectFile<E> *file : ctx.objs)
+    ctx.obj_cache.store(file->mf, file);
+  for (SharedFile<E> *file : ctx.dsos)
+    ctx.dso_cache.store(file->mf, file);
+
+  std::string parse_opts = get_parse_options(ctx);
+
+  std::function<void()> on_accept;
+  start_server(ctx, &on_accept, on_complete);
+
+  // We are now in a child process. Forget the server's command line.
+  ctx.arg = {};
+  ctx.objs.clear();
+  ctx.dsos.clear();
+  ctx.visited.clear();
+  ctx.file_priority = 2;
+  ctx.timer_records.clear();
+
+  on_accept();
+
+  file_args.clear();
+  parse_nonpositional_args(ctx, file_args);
+
+  if (get_parse_options(ctx) != parse_opts) {
+    ctx.obj_cache = {};
+    ctx.dso_cache = {};
+  }
+}
+
 static i64 get_default_thread_count() {
   // mold doesn't scale above 32 threads.
   int n = tbb::global_control::active_value(
@@ -337,6 +472,14 @@ static int elf_main(int argc, char **argv) {
     unreachable();
   }
 
+  std::function<void()> on_complete;
+
+  // Handle --server. run_server() returns only in a child process
+  // that handles a link request from a client.
+  bool in_server = ctx.arg.server;
+  if (in_server)
+    run_server(ctx, file_args, &on_complete);
+
   Timer t_all(ctx, "all");
 
   if (ctx.arg.relocatable) {
@@ -344,8 +487,11 @@ static int elf_main(int argc, char **argv) {
     return 0;
   }
 
-  if (!ctx.arg.preload)
+  if (!ctx.arg.preload && !in_server) {
+    if (ctx.arg.use_server)
+      try_connect_server(ctx);
     try_resume_daemon(ctx);
+  }
 
   i64 thread_count = ctx.arg.thread_count;
   if (thread_count == 0)
@@ -360,27 +506,19 @@ static int elf_main(int argc, char **argv) {
       Fatal(ctx) << "chdir failed: " << ctx.arg.directory
                  << ": " << errno_string();
 
-  // Handle --wrap options if any.
-  for (std::string_view name : ctx.arg.wrap)
-    intern(ctx, name)->wrap = true;
-
-  // Handle --retain-symbols-file options if any.
-  if (ctx.arg.retain_symbols_file)
-    for (std::string_view name : *ctx.arg.retain_symbols_file)
-      intern(ctx, name)->write_to_symtab = true;
+  // With --skip-if-unchanged, we don't have to do anything if neither the
+  // command line nor any input file has changed since the last link.
+  if (is_output_up_to_date(ctx))
+    return 0;
 
   // Preload input files
-  std::function<void()> on_complete;
   std::function<void()> wait_for_client;
 
   if (ctx.arg.preload)
     daemonize(ctx, &wait_for_client, &on_complete);
-  else if (ctx.arg.fork)
+  else if (ctx.arg.fork && !in_server)
     on_complete = fork_child();
 
-  for (std::string_view arg : ctx.arg.trace_symbol)
-    intern(ctx, arg)->traced = true;
-
   // Parse input files
   read_input_files(ctx, file_args);
 
@@ -394,12 +532,13 @@ static int elf_main(int argc, char **argv) {
     }
   }
 
-  {
-    Timer t(ctx, "register_section_pieces");
-    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
-      file->register_section_pieces(ctx);
-    });
-  }
+  // Handle --retain-symbols-file options if any.
+  if (ctx.arg.retain_symbols_file)
+    for (std::string_view name : *ctx.arg.retain_symbols_file)
+      intern(ctx, name)->write_to_symtab = true;
+
+  for (std::string_view arg : ctx.arg.trace_symbol)
+    intern(ctx, arg)->traced = true;
 
   // Uniquify shared object files by soname
   {
@@ -423,6 +562,16 @@ static int elf_main(int argc, char **argv) {
   // included to the final output.
   resolve_symbols(ctx);
 
+  // Register mergeable string pieces. This has to be done after
+  // resolve_symbols() because archive members are not parsed until
+  // they are pulled into the output.
+  {
+    Timer t(ctx, "register_section_pieces");
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+      file->register_section_pieces(ctx);
+    });
+  }
+
   // Remove redundant comdat sections (e.g. duplicate inline functions).
   eliminate_comdats(ctx);
 
@@ -474,6 +623,7 @@ static int elf_main(int argc, char **argv) {
   claim_unresolved_symbols(ctx);
 
   // Beyond this point, no new symbols will be added to the result.
+  ctx.symbol_locks.reset();
 
   // Make sure that all symbols have been resolved.
   if (!ctx.arg.allow_multiple_definition)
@@ -487,10 +637,18 @@ static int elf_main(int argc, char **argv) {
   // a special rule. Sort them.
   sort_init_fini(ctx);
 
+  // Reorder input sections according to --symbol-ordering-file or
+  // .llvm.call-graph-profile sections.
+  sort_sections_by_order(ctx);
+
   // Compute sizes of output sections while assigning offsets
   // within an output section to input sections.
   compute_section_sizes(ctx);
 
+  // With --incremental, keep input sections at the same offsets as in
+  // the previous link, or reserve slack space for the next link.
+  assign_incremental_offsets(ctx);
+
   // Sort sections by section attributes so that we'll have to
   // create as few segments as possible.
   sort(ctx.chunks, [&](Chunk<E> *a, Chunk<E> *b) {
@@ -513,6 +671,10 @@ static int elf_main(int argc, char **argv) {
   // .got.plt, .dynsym, .dynstr, etc.
   scan_rels(ctx);
 
+  // If -z pack-relative-relocs is given, compute .relr.dyn contents.
+  if (ctx.relrdyn)
+    construct_relr(ctx);
+
   // Reserve a space for dynamic symbol strings in .dynstr and sort
   // .dynsym contents if necessary. Beyond this point, no symbol will
   // be added to .dynsym.
@@ -546,6 +708,11 @@ static int elf_main(int argc, char **argv) {
     ctx.eh_frame->construct(ctx);
   }
 
+  // If --gdb-index is given, read debug info to compute .gdb_index
+  // contents except addresses.
+  if (ctx.gdb_index)
+    ctx.gdb_index->construct(ctx);
+
   // Update shdr.sh_size for each chunk and remove empty ones.
   for (Chunk<E> *chunk : ctx.chunks)
     chunk->update_shdr(ctx);
@@ -565,6 +732,11 @@ static int elf_main(int argc, char **argv) {
   for (Chunk<E> *chunk : ctx.chunks)
     chunk->update_shdr(ctx);
 
+  // With --incremental, reserve slack space for .eh_frame and
+  // .eh_frame_hdr as well, and drop the previous layout if we can
+  // no longer reuse it.
+  assign_incremental_sizes(ctx);
+
   // Assign offsets to output sections
   i64 filesize = set_osec_offsets(ctx);
 
@@ -592,37 +764,37 @@ static int elf_main(int argc, char **argv) {
     }
   }
 
-  t_before_copy.stop();
-
-  // Create an output file
-  ctx.output_file = OutputFile<E>::open(ctx, ctx.arg.output, filesize, 0777);
-  ctx.buf = ctx.output_file->buf;
+  // With --incremental, check if we can update the existing output
+  // file in place.
+  check_incremental_layout(ctx);
 
-  Timer t_copy(ctx, "copy");
+  t_before_copy.stop();
 
-  // Copy input sections to the output file
+  // Create an output file. If --pre-resolve-relocs is given, we
+  // compute relocated values while the kernel is allocating the file.
   {
-    Timer t(ctx, "copy_buf");
-
-    tbb::parallel_for_each(ctx.chunks, [&](Chunk<E> *chunk) {
-      std::string name(chunk->name);
-      if (name.empty())
-        name = "(header)";
-      Timer t2(ctx, name, &t);
-
-      chunk->copy_buf(ctx);
-    });
-
-    ctx.checkpoint();
+    tbb::task_group tg;
+    if (ctx.arg.pre_resolve_relocs)
+      tg.run([&] { pre_resolve_relocs(ctx); });
+    ctx.output_file = OutputFile<E>::open(ctx, ctx.arg.output, filesize, 0777);
+    tg.wait();
   }
+  ctx.buf = ctx.output_file->buf;
 
-  // Dynamic linker works better with sorted .rela.dyn section,
-  // so we sort them.
-  ctx.reldyn->sort(ctx);
+  Timer t_copy(ctx, "copy");
 
-  // Zero-clear paddings between sections
+  // Zero-clear paddings between sections. We do this before copying
+  // chunks so that a streaming output file can write out a region as
+  // soon as the chunks in it are copied.
   clear_padding(ctx);
 
+  // Copy input sections to the output file
+  if (ctx.incremental && ctx.incremental->can_patch)
+    patch_chunks(ctx);
+  else
+    copy_chunks(ctx);
+  ctx.output_file->finish_copy(ctx);
+
   if (ctx.buildid) {
     Timer t(ctx, "build_id");
     ctx.buildid->write_buildid(ctx);
@@ -633,6 +805,10 @@ static int elf_main(int argc, char **argv) {
   // Close the output file. This is the end of the linker's main job.
   ctx.output_file->close(ctx);
 
+  // Save the state for the next --skip-if-unchanged or --incremental link.
+  write_link_state(ctx);
+  write_incremental_state(ctx);
+
   t_total.stop();
   t_all.stop();
 
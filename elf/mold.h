@@ -12,6 +12,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <regex>
 #include <span>
 #include <sstream>
@@ -227,6 +228,31 @@ struct FdeRecord {
   std::atomic_bool is_alive = true;
 };
 
+// With --pre-resolve-relocs, common types of relocations against
+// SHF_ALLOC input sections are resolved to final values before the
+// output file is created. They are stored as flat streams grouped by
+// how they are written, so that they can be applied in tight loops
+// without looking up symbols. apply_reloc_alloc() skips them.
+struct PreResolvedRelocs {
+  // *(u32 *)loc = val
+  struct Word32 { u32 offset; u32 val; };
+
+  // *(u64 *)loc = val
+  struct Word64 { u32 offset; u64 val; };
+
+  // *(u32 *)loc = (*(u32 *)loc & mask) | val
+  struct Insn32 { u32 offset; u32 mask; u32 val; };
+
+  void apply(u8 *base) const;
+
+  std::vector<Word32> word32;
+  std::vector<Word64> word64;
+  std::vector<Insn32> insn32;
+
+  // is_resolved[i] is true if the i-th relocation is in the streams.
+  BitVector is_resolved;
+};
+
 // InputSection represents a section in an input object file.
 template <typename E>
 class InputSection {
@@ -236,7 +262,9 @@ public:
                i64 section_idx);
 
   void scan_relocations(Context<E> &ctx);
+  void uncompress(Context<E> &ctx);
   void write_to(Context<E> &ctx, u8 *buf);
+  void pre_resolve_relocs(Context<E> &ctx);
   void apply_reloc_alloc(Context<E> &ctx, u8 *base);
   void apply_reloc_nonalloc(Context<E> &ctx, u8 *base);
   inline void kill();
@@ -249,6 +277,7 @@ public:
   inline u64 get_addr() const;
   inline i64 get_addend(const ElfRel<E> &rel) const;
   inline std::span<ElfRel<E>> get_rels(Context<E> &ctx) const;
+  inline bool is_relr_reloc(Context<E> &ctx, const ElfRel<E> &rel) const;
   inline std::span<FdeRecord<E>> get_fdes() const;
 
   ObjectFile<E> &file;
@@ -260,6 +289,7 @@ public:
   std::unique_ptr<SectionFragmentRef<E>[]> rel_fragments;
   BitVector needs_dynrel;
   BitVector needs_baserel;
+  std::unique_ptr<PreResolvedRelocs> pre_resolved;
   i32 fde_begin = -1;
   i32 fde_end = -1;
 
@@ -285,12 +315,14 @@ public:
 
   bool is_ehframe = false;
 
+  // ELFCOMPRESS_ZLIB or ELFCOMPRESS_ZSTD if `contents` is compressed
+  // data that is inflated to shdr.sh_size bytes. 0 otherwise.
+  u32 compress_type = 0;
+
 private:
   typedef enum : u8 { NONE, ERROR, COPYREL, PLT, DYNREL, BASEREL } Action;
 
-  void uncompress_old_style(Context<E> &ctx);
-  void uncompress_new_style(Context<E> &ctx);
-  void do_uncompress(Context<E> &ctx, std::string_view data, u64 size);
+  void uncompress_to(Context<E> &ctx, u8 *buf);
 
   void dispatch(Context<E> &ctx, Action table[3][4], i64 i,
                 const ElfRel<E> &rel, Symbol<E> &sym);
@@ -391,8 +423,10 @@ public:
 
   void copy_buf(Context<E> &ctx) override;
   void write_to(Context<E> &ctx, u8 *buf) override;
+  void construct_relr(Context<E> &ctx);
 
   std::vector<InputSection<E> *> members;
+  std::vector<u64> relr;
   u32 idx;
 
 private:
@@ -409,17 +443,13 @@ public:
     this->shdr.sh_addralign = E::word_size;
   }
 
-  void add_got_symbol(Context<E> &ctx, Symbol<E> *sym);
-  void add_gottp_symbol(Context<E> &ctx, Symbol<E> *sym);
-  void add_tlsgd_symbol(Context<E> &ctx, Symbol<E> *sym);
-  void add_tlsdesc_symbol(Context<E> &ctx, Symbol<E> *sym);
-  void add_tlsld(Context<E> &ctx);
-
   u64 get_tlsld_addr(Context<E> &ctx) const;
   i64 get_reldyn_size(Context<E> &ctx) const;
+  void construct_relr(Context<E> &ctx);
   void copy_buf(Context<E> &ctx) override;
 
   std::vector<Symbol<E> *> got_syms;
+  std::vector<u64> relr;
   std::vector<Symbol<E> *> gottp_syms;
   std::vector<Symbol<E> *> tlsgd_syms;
   std::vector<Symbol<E> *> tlsdesc_syms;
@@ -449,7 +479,6 @@ public:
     this->shdr.sh_addralign = E::plt_hdr_size;
   }
 
-  void add_symbol(Context<E> &ctx, Symbol<E> *sym);
   void copy_buf(Context<E> &ctx) override;
 
   std::vector<Symbol<E> *> symbols;
@@ -465,7 +494,6 @@ public:
     this->shdr.sh_addralign = E::pltgot_size;
   }
 
-  void add_symbol(Context<E> &ctx, Symbol<E> *sym);
   void copy_buf(Context<E> &ctx) override;
 
   std::vector<Symbol<E> *> symbols;
@@ -504,6 +532,24 @@ public:
   i64 relcount = 0;
 };
 
+// .relr.dyn contains relative relocations in a compact bitmap format.
+// Its contents are computed for each output section by
+// OutputSection::construct_relr() and GotSection::construct_relr().
+template <typename E>
+class RelrDynSection : public Chunk<E> {
+public:
+  RelrDynSection() : Chunk<E>(this->SYNTHETIC) {
+    this->name = ".relr.dyn";
+    this->shdr.sh_type = SHT_RELR;
+    this->shdr.sh_flags = SHF_ALLOC;
+    this->shdr.sh_entsize = E::word_size;
+    this->shdr.sh_addralign = E::word_size;
+  }
+
+  void update_shdr(Context<E> &ctx) override;
+  void copy_buf(Context<E> &ctx) override;
+};
+
 template <typename E>
 class StrtabSection : public Chunk<E> {
 public:
@@ -588,12 +634,18 @@ public:
     this->shdr.sh_addralign = E::word_size;
   }
 
-  void add_symbol(Context<E> &ctx, Symbol<E> *sym);
   void finalize(Context<E> &ctx);
   void update_shdr(Context<E> &ctx) override;
   void copy_buf(Context<E> &ctx) override;
 
   std::vector<Symbol<E> *> symbols{1};
+
+  // .dynstr offsets of symbol names, indexed by dynsym index
+  std::vector<i64> name_offsets;
+
+  // djb hashes of global symbols for .gnu.hash. hashes[i] is the hash
+  // of symbols[sh_info + i].
+  std::vector<u32> hashes;
 };
 
 template <typename E>
@@ -796,7 +848,7 @@ public:
 
 private:
   ElfChdr<E> chdr = {};
-  std::unique_ptr<ZlibCompressor> contents;
+  std::unique_ptr<Compressor> contents;
 };
 
 template <typename E>
@@ -808,7 +860,7 @@ public:
 private:
   static constexpr i64 HEADER_SIZE = 12;
   i64 original_size = 0;
-  std::unique_ptr<ZlibCompressor> contents;
+  std::unique_ptr<Compressor> contents;
 };
 
 template <typename E>
@@ -828,6 +880,54 @@ private:
 
 bool is_c_identifier(std::string_view name);
 
+//
+// gdb-index.cc
+//
+
+struct GdbIndexName {
+  GdbIndexName() = default;
+  GdbIndexName(const GdbIndexName &other) : hash(other.hash) {}
+
+  u32 hash = 0;
+  std::atomic_uint32_t num_entries = 0;
+  std::atomic_uint32_t num_filled = 0;
+  u32 entry_idx = 0;
+  u32 name_offset = 0;
+  u32 cuvec_offset = 0;
+};
+
+template <typename E>
+class GdbIndexSection : public Chunk<E> {
+public:
+  GdbIndexSection() : Chunk<E>(this->SYNTHETIC) {
+    this->name = ".gdb_index";
+    this->shdr.sh_type = SHT_PROGBITS;
+    this->shdr.sh_addralign = 4;
+  }
+
+  void construct(Context<E> &ctx);
+  void copy_buf(Context<E> &ctx) override;
+
+private:
+  struct Compunit {
+    InputSection<E> *isec;
+    u64 offset;
+    u64 size;
+  };
+
+  struct AddressArea {
+    InputSection<E> *isec;
+    u32 cu_idx;
+  };
+
+  std::vector<Compunit> compunits;
+  std::vector<AddressArea> areas;
+  ConcurrentMap<GdbIndexName> map;
+  std::vector<std::pair<std::string_view, GdbIndexName *>> names;
+  std::vector<u32> entries;
+  i64 symtab_size = 0;
+};
+
 template <typename E>
 std::vector<ElfPhdr<E>> create_phdr(Context<E> &ctx);
 
@@ -895,6 +995,10 @@ public:
 
 protected:
   std::unique_ptr<Symbol<E>[]> local_syms;
+
+  // Hashes of global symbol names computed at parse time. They are
+  // consumed by intern_symbols().
+  std::vector<u64> symbol_hashes;
 };
 
 // ObjectFile represents an input .o file.
@@ -907,6 +1011,9 @@ public:
                                std::string archive_name, bool is_in_lib);
 
   void parse(Context<E> &ctx);
+  void parse_lazy(Context<E> &ctx);
+  void init_lazy_symbols(Context<E> &ctx, std::vector<std::string_view> names);
+  void intern_symbols(Context<E> &ctx);
   void register_section_pieces(Context<E> &ctx);
   void resolve_lazy_symbols(Context<E> &ctx);
   void resolve_regular_symbols(Context<E> &ctx);
@@ -938,7 +1045,9 @@ public:
   std::vector<SectionFragmentRef<E>> sym_fragments;
   std::vector<std::pair<ComdatGroup *, std::span<u32>>> comdat_groups;
   bool exclude_libs = false;
+  bool is_parsed = false;
   u32 features = 0;
+  i64 cgprofile_sec_idx = -1;
 
   u64 num_dynrel = 0;
   u64 reldyn_offset = 0;
@@ -967,12 +1076,16 @@ private:
                        const ElfSym<E> &esym, i64 symidx);
   void merge_visibility(Context<E> &ctx, Symbol<E> &sym, u8 visibility);
 
-  std::pair<std::string_view, const ElfShdr<E> *>
-  uncompress_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
-                      std::string_view name);
+  std::tuple<std::string_view, const ElfShdr<E> *, u32>
+  read_section_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
+                        std::string_view name);
 
   bool has_common_symbol;
 
+  // Names of global symbols defined by an archive member that is not
+  // parsed yet. They are consumed by intern_symbols().
+  std::vector<std::string_view> lazy_names;
+
   std::string_view symbol_strtab;
   const ElfShdr<E> *symtab_sec;
   std::span<u32> symtab_shndx_sec;
@@ -986,6 +1099,7 @@ public:
   static SharedFile<E> *create(Context<E> &ctx, MappedFile<Context<E>> *mf);
 
   void parse(Context<E> &ctx);
+  void intern_symbols(Context<E> &ctx);
   void resolve_dso_symbols(Context<E> &ctx);
   std::vector<Symbol<E> *> find_aliases(Symbol<E> *sym);
   bool is_readonly(Context<E> &ctx, Symbol<E> *sym);
@@ -1037,6 +1151,13 @@ void gc_sections(Context<E> &ctx);
 template <typename E>
 void icf_sections(Context<E> &ctx);
 
+//
+// section-order.cc
+//
+
+template <typename E>
+void sort_sections_by_order(Context<E> &ctx);
+
 //
 // relocatable.cc
 //
@@ -1051,6 +1172,96 @@ void combine_objects(Context<E> &ctx, std::span<std::string_view> file_args);
 template <typename E>
 void print_map(Context<E> &ctx);
 
+//
+// archive-index.cc
+//
+
+typedef std::vector<std::vector<std::string_view>> ArchiveIndex;
+
+template <typename E>
+std::optional<ArchiveIndex>
+get_archive_index(Context<E> &ctx, MappedFile<Context<E>> *mf,
+                  const std::vector<MappedFile<Context<E>> *> &members);
+
+//
+// link-state.cc
+//
+
+template <typename E>
+bool is_output_up_to_date(Context<E> &ctx);
+
+template <typename E>
+void write_link_state(Context<E> &ctx);
+
+// The layout of the previous output file for --incremental, and what
+// has changed since then.
+template <typename E>
+struct IncrementalState {
+  struct OutputSlot {
+    std::string name;
+    u64 type = 0;
+    u64 flags = 0;
+    u64 size = 0;
+    u64 used = 0;
+  };
+
+  struct ChunkSlot {
+    u64 type = 0;
+    u64 flags = 0;
+    u64 addr = 0;
+    u64 offset = 0;
+    u64 size = 0;
+    u64 hash = 0;
+  };
+
+  struct SectionSlot {
+    u32 section_idx = 0;
+    u32 osec_idx = 0;
+    u64 offset = 0;
+    u64 size = 0;
+  };
+
+  struct FileSlots {
+    i64 size = 0;
+    i64 mtime = 0;
+    std::vector<SectionSlot> slots;
+  };
+
+  struct StaleSlot {
+    OutputSection<E> *osec = nullptr;
+    u64 offset = 0;
+    u64 size = 0;
+  };
+
+  u64 global_hash = 0;
+  u64 eh_frame_size = 0;
+  u64 eh_frame_hdr_size = 0;
+  std::vector<OutputSlot> osecs;
+  std::vector<ChunkSlot> chunks;
+  std::unordered_map<std::string, FileSlots> files;
+  std::unordered_map<std::string, u64> symbols;
+
+  std::vector<bool> is_pinned;
+  std::unordered_set<ObjectFile<E> *> changed_files;
+  std::vector<StaleSlot> stale_slots;
+  bool can_patch = false;
+};
+
+template <typename E>
+void assign_incremental_offsets(Context<E> &ctx);
+
+template <typename E>
+void assign_incremental_sizes(Context<E> &ctx);
+
+template <typename E>
+void check_incremental_layout(Context<E> &ctx);
+
+template <typename E>
+void patch_chunks(Context<E> &ctx);
+
+template <typename E>
+void write_incremental_state(Context<E> &ctx);
+
 //
 // subprocess.cc
 //
@@ -1064,6 +1275,13 @@ template <typename E>
 void daemonize(Context<E> &ctx, std::function<void()> *wait_for_client,
                std::function<void()> *on_complete);
 
+template <typename E>
+void try_connect_server(Context<E> &ctx);
+
+template <typename E>
+void start_server(Context<E> &ctx, std::function<void()> *on_accept,
+                  std::function<void()> *on_complete);
+
 template <typename E>
 [[noreturn]]
 void process_run_subcommand(Context<E> &ctx, int argc, char **argv);
@@ -1106,13 +1324,16 @@ collect_output_sections(Context<E> &);
 template <typename E> void compute_section_sizes(Context<E> &);
 template <typename E> void claim_unresolved_symbols(Context<E> &);
 template <typename E> void scan_rels(Context<E> &);
+template <typename E> void construct_relr(Context<E> &);
 template <typename E> void apply_version_script(Context<E> &);
 template <typename E> void parse_symbol_version(Context<E> &);
 template <typename E> void compute_import_export(Context<E> &);
 template <typename E> void clear_padding(Context<E> &);
+template <typename E> void copy_chunks(Context<E> &);
 template <typename E> i64 get_section_rank(Context<E> &, Chunk<E> *chunk);
 template <typename E> i64 set_osec_offsets(Context<E> &);
 template <typename E> void fix_synthetic_symbols(Context<E> &);
+template <typename E> void pre_resolve_relocs(Context<E> &);
 template <typename E> void compress_debug_sections(Context<E> &);
 
 //
@@ -1128,10 +1349,19 @@ public:
   virtual void close(Context<E> &ctx) = 0;
   virtual ~OutputFile() {}
 
+  // A streaming output file (a non-regular file or a file written with
+  // --async-write) writes out a chunk as soon as its contents become
+  // final. Other types of output files ignore this call.
+  virtual void finalize_chunk(Context<E> &ctx, Chunk<E> *chunk) {}
+
+  // Called after all chunks are copied to the output buffer.
+  virtual void finish_copy(Context<E> &ctx) {}
+
   u8 *buf = nullptr;
   std::string path;
   i64 filesize;
   bool is_mmapped;
+  bool is_streaming = false;
   bool is_unmapped = false;
 
 protected:
@@ -1152,7 +1382,9 @@ struct BuildId {
   i64 hash_size = 0;
 };
 
-typedef enum { COMPRESS_NONE, COMPRESS_GABI, COMPRESS_GNU } CompressKind;
+typedef enum {
+  COMPRESS_NONE, COMPRESS_GABI, COMPRESS_GNU, COMPRESS_ZSTD,
+} CompressKind;
 typedef enum { ERROR, WARN, IGNORE } UnresolvedKind;
 
 struct VersionPattern {
@@ -1165,14 +1397,13 @@ template <typename E, typename T>
 class FileCache {
 public:
   void store(MappedFile<Context<E>> *mf, T *obj) {
-    Key k(mf->name, mf->size, mf->mtime);
-    cache[k].push_back(obj);
+    cache[get_key(mf)].push_back(obj);
   }
 
   std::vector<T *> get(MappedFile<Context<E>> *mf) {
-    Key k(mf->name, mf->size, mf->mtime);
-    std::vector<T *> objs = cache[k];
-    cache[k].clear();
+    std::vector<T *> objs;
+    if (auto it = cache.find(get_key(mf)); it != cache.end())
+      objs.swap(it->second);
     return objs;
   }
 
@@ -1182,10 +1413,51 @@ public:
   }
 
 private:
-  typedef std::tuple<std::string, i64, i64> Key;
+  typedef std::tuple<std::string, std::string, i64, i64> Key;
+
+  // Archive members don't have their own mtime, so they are
+  // identified by their archive file's mtime.
+  //
+  // A server may be asked to link files in a directory other than its
+  // own, so relative paths are made absolute.
+  static Key get_key(MappedFile<Context<E>> *mf) {
+    if (mf->parent)
+      return {path_clean(path_to_absolute(mf->parent->name)), mf->name,
+              mf->size, mf->parent->mtime};
+    return {"", path_clean(path_to_absolute(mf->name)), mf->size, mf->mtime};
+  }
+
   std::map<Key, std::vector<T *>> cache;
 };
 
+// Symbols are allocated from per-thread arenas, so that they have stable
+// addresses and symbols interned by the same file are close in memory.
+template <typename E>
+class SymbolArena {
+public:
+  Symbol<E> *alloc(std::string_view name) {
+    if (cur == end) {
+      chunks.emplace_back(new u8[CHUNK_SIZE * sizeof(Symbol<E>)]);
+      cur = (Symbol<E> *)chunks.back().get();
+      end = cur + CHUNK_SIZE;
+    }
+    return new (cur++) Symbol<E>(name);
+  }
+
+  // Gives back the symbol returned by the last alloc() call.
+  void free_last() {
+    cur--;
+  }
+
+private:
+  static constexpr i64 CHUNK_SIZE = 4096;
+
+  std::vector<std::unique_ptr<u8[]>> chunks;
+  Symbol<E> *cur = nullptr;
+  Symbol<E> *end = nullptr;
+};
+
+
 // Context represents a context object for each invocation of the linker.
 // It contains command line flags, pointers to singleton objects
 // (such as linker-synthesized output sections), unique_ptrs for
@@ -1210,7 +1482,10 @@ struct Context {
     bool Bsymbolic = false;
     bool Bsymbolic_functions = false;
     bool allow_multiple_definition = false;
+    bool async_write = false;
+    bool call_graph_profile_sort = true;
     bool demangle = true;
+    bool direct_io = false;
     bool discard_all = false;
     bool discard_locals = false;
     bool eh_frame_hdr = true;
@@ -1218,27 +1493,35 @@ struct Context {
     bool fatal_warnings = false;
     bool fork = true;
     bool gc_sections = false;
+    bool gdb_index = false;
     bool hash_style_gnu = false;
     bool hash_style_sysv = true;
     bool icf = false;
+    bool incremental = false;
     bool is_static = false;
     bool omagic = false;
     bool perf = false;
     bool pic = false;
     bool pie = false;
+    bool pre_resolve_relocs = false;
+    bool preallocate = false;
     bool preload = false;
     bool print_gc_sections = false;
     bool print_icf_sections = false;
     bool print_map = false;
     bool quick_exit = true;
     bool relax = true;
+    bool reuse_output = false;
     bool relocatable = false;
     bool repro = false;
+    bool server = false;
     bool shared = false;
+    bool skip_if_unchanged = false;
     bool stats = false;
     bool strip_all = false;
     bool strip_debug = false;
     bool trace = false;
+    bool use_server = false;
     bool warn_common = false;
     bool z_copyreloc = true;
     bool z_defs = false;
@@ -1251,14 +1534,17 @@ struct Context {
     bool z_keep_text_section_prefix = false;
     bool z_now = false;
     bool z_origin = false;
+    bool z_pack_relative_relocs = false;
     bool z_relro = true;
     bool z_text = false;
     u16 default_version = VER_NDX_GLOBAL;
+    i64 compress_level = 3;
     i64 emulation = EM_X86_64;
     i64 filler = -1;
     i64 spare_dynamic_tags = 5;
     i64 thread_count = 0;
     std::string Map;
+    std::string archive_cache_dir;
     std::string chroot;
     std::string directory;
     std::string dynamic_linker;
@@ -1267,6 +1553,7 @@ struct Context {
     std::string init = "_init";
     std::string output;
     std::string rpaths;
+    std::string server_dir;
     std::string soname;
     std::string sysroot;
     std::unique_ptr<std::regex> unique;
@@ -1278,6 +1565,7 @@ struct Context {
     std::vector<std::string_view> exclude_libs;
     std::vector<std::string_view> filter;
     std::vector<std::string_view> require_defined;
+    std::vector<std::string_view> symbol_ordering_file;
     std::vector<std::string_view> trace_symbol;
     std::vector<std::string_view> undefined;
     std::vector<std::string_view> version_definitions;
@@ -1295,8 +1583,20 @@ struct Context {
 
   bool has_error = false;
 
-  // Symbol table
-  tbb::concurrent_hash_map<std::string_view, Symbol<E>> symbol_map;
+  // Symbol table. symbol_map is allocated only once after input files
+  // are read, with its size estimated by symbol_estimator. Symbols that
+  // don't fit in it are stored to symbol_map_overflow.
+  ConcurrentMap<Symbol<E> *> symbol_map;
+  tbb::concurrent_hash_map<std::string_view, Symbol<E>> symbol_map_overflow;
+  tbb::enumerable_thread_specific<SymbolArena<E>> symbol_arena;
+  HyperLogLog symbol_estimator;
+
+  // Mutexes to update symbols during symbol resolution. They are freed
+  // once all symbols are resolved. See Symbol::get_mutex().
+  static constexpr i64 NUM_SYMBOL_LOCKS = 1 << 16;
+  std::unique_ptr<tbb::spin_mutex[]> symbol_locks{
+    new tbb::spin_mutex[NUM_SYMBOL_LOCKS]};
+
   tbb::concurrent_hash_map<std::string_view, ComdatGroup> comdat_groups;
   tbb::concurrent_vector<std::unique_ptr<MergedSection<E>>> merged_sections;
   tbb::concurrent_vector<std::unique_ptr<Chunk<E>>> output_chunks;
@@ -1328,6 +1628,9 @@ struct Context {
   std::unique_ptr<OutputFile<E>> output_file;
   u8 *buf = nullptr;
 
+  // For --incremental
+  std::unique_ptr<IncrementalState<E>> incremental;
+
   std::vector<Chunk<E> *> chunks;
   std::atomic_bool has_gottp_rel = false;
   std::atomic_bool has_textrel = false;
@@ -1341,6 +1644,7 @@ struct Context {
   std::unique_ptr<GotPltSection<E>> gotplt;
   std::unique_ptr<RelPltSection<E>> relplt;
   std::unique_ptr<RelDynSection<E>> reldyn;
+  std::unique_ptr<RelrDynSection<E>> relrdyn;
   std::unique_ptr<DynamicSection<E>> dynamic;
   std::unique_ptr<StrtabSection<E>> strtab;
   std::unique_ptr<DynstrSection<E>> dynstr;
@@ -1361,6 +1665,7 @@ struct Context {
   std::unique_ptr<BuildIdSection<E>> buildid;
   std::unique_ptr<NotePropertySection<E>> note_property;
   std::unique_ptr<ReproSection<E>> repro;
+  std::unique_ptr<GdbIndexSection<E>> gdb_index;
 
   // For --relocatable
   std::vector<RChunk<E> *> r_chunks;
@@ -1673,35 +1978,44 @@ public:
     return {nameptr, (size_t)namelen};
   }
 
+  // Symbols don't have their own mutexes. Instead, each symbol is mapped
+  // to one of the mutexes in ctx.symbol_locks by its address, so that
+  // they can be freed once symbol resolution is done.
+  tbb::spin_mutex &get_mutex(Context<E> &ctx) const {
+    return ctx.symbol_locks[((uintptr_t)this >> 4) % ctx.NUM_SYMBOL_LOCKS];
+  }
+
   // A symbol is owned by a file. If two or more files define the
   // same symbol, the one with the strongest definition owns the symbol.
   // If `file` is null, the symbol is equivalent to nonexistent.
   InputFile<E> *file = nullptr;
 
   InputSection<E> *input_section = nullptr;
-  const char *nameptr = nullptr;
-
   u64 value = -1;
+  const char *nameptr = nullptr;
 
   // Index into the symbol table of the owner file.
   i32 sym_idx = -1;
 
-  i32 namelen = 0;
   i32 aux_idx = -1;
-  u16 shndx = 0;
+
+  // There can be millions of symbols in a large program, so we pack
+  // a few bits into the upper bits of the name length. A symbol name
+  // can't be longer than 1 GiB.
+  u32 namelen : 30 = 0;
+  u32 traced : 1 = false;
+  u32 is_weak : 1 = false;
+
   u16 ver_idx = 0;
 
   // `flags` has NEEDS_ flags.
   std::atomic_uint8_t flags = 0;
 
-  tbb::spin_mutex mu;
-  std::atomic_uint8_t visibility = STV_DEFAULT;
-
+  // The following bits are updated with the symbol's lock held during
+  // symbol resolution. See get_mutex().
+  u8 visibility : 2 = STV_DEFAULT;
   u8 is_lazy : 1 = false;
-  u8 is_weak : 1 = false;
   u8 write_to_symtab : 1 = false;
-  u8 traced : 1 = false;
-  u8 wrap : 1 = false;
   u8 has_copyrel : 1 = false;
   u8 copyrel_readonly : 1 = false;
 
@@ -1735,12 +2049,32 @@ public:
 // instantiated object. `key` is usually the same as `name`.
 template <typename E>
 inline Symbol<E> *intern(Context<E> &ctx, std::string_view key,
-                         std::string_view name) {
-  typename decltype(ctx.symbol_map)::const_accessor acc;
-  ctx.symbol_map.insert(acc, {key, Symbol<E>(name)});
+                         std::string_view name, u64 hash) {
+  // We allocate a symbol first and give it back if the key turns out
+  // to be already in the table.
+  SymbolArena<E> &arena = ctx.symbol_arena.local();
+  Symbol<E> *sym = arena.alloc(name);
+
+  auto [ent, inserted] = ctx.symbol_map.try_insert(key, hash, sym);
+  if (!inserted)
+    arena.free_last();
+  if (ent)
+    return *ent;
+
+  static Counter counter("symbol_map_overflow");
+  counter++;
+
+  typename decltype(ctx.symbol_map_overflow)::const_accessor acc;
+  ctx.symbol_map_overflow.insert(acc, {key, Symbol<E>(name)});
   return const_cast<Symbol<E> *>(&acc->second);
 }
 
+template <typename E>
+inline Symbol<E> *intern(Context<E> &ctx, std::string_view key,
+                         std::string_view name) {
+  return intern(ctx, key, name, hash_string(key));
+}
+
 template <typename E>
 inline Symbol<E> *intern(Context<E> &ctx, std::string_view name) {
   return intern(ctx, name, name);
@@ -1841,6 +2175,16 @@ inline std::span<ElfRel<E>> InputSection<E>::get_rels(Context<E> &ctx) const {
   return file.template get_data<ElfRel<E>>(ctx, file.elf_sections[relsec_idx]);
 }
 
+// Returns true if a base relocation is stored to .relr.dyn instead of
+// .rel.dyn. RELR can only represent relocations at word-aligned places.
+template <typename E>
+inline bool
+InputSection<E>::is_relr_reloc(Context<E> &ctx, const ElfRel<E> &rel) const {
+  return ctx.relrdyn &&
+         output_section->shdr.sh_addralign % E::word_size == 0 &&
+         (offset + rel.r_offset) % E::word_size == 0;
+}
+
 template <typename E>
 inline std::span<FdeRecord<E>> InputSection<E>::get_fdes() const {
   if (fde_begin == -1)
@@ -1863,7 +2207,7 @@ template <typename T>
 inline std::span<T> InputFile<E>::get_data(Context<E> &ctx, i64 idx) {
   if (elf_sections.size() <= idx)
     Fatal(ctx) << *this << ": invalid section index";
-  return this->template get_data<T>(elf_sections[idx]);
+  return this->template get_data<T>(ctx, elf_sections[idx]);
 }
 
 template <typename E>
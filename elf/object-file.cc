@@ -3,7 +3,6 @@
 #include <cstring>
 #include <regex>
 #include <unistd.h>
-#include <zlib.h>
 
 namespace mold::elf {
 
@@ -103,24 +102,16 @@ u32 ObjectFile<E>::read_note_gnu_property(Context<E> &ctx,
   return ret;
 }
 
+// Returns the contents of a given section. Compressed sections are not
+// inflated here because most of them are debug sections which we just
+// copy to the output file. They are inflated directly into the output
+// buffer by InputSection::write_to() instead.
 template <typename E>
-std::pair<std::string_view, const ElfShdr<E> *>
-ObjectFile<E>::uncompress_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
-                                   std::string_view name) {
+std::tuple<std::string_view, const ElfShdr<E> *, u32>
+ObjectFile<E>::read_section_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
+                                     std::string_view name) {
   if (shdr.sh_type == SHT_NOBITS)
-    return {{}, &shdr};
-
-  auto do_uncompress = [&](std::string_view data, u64 size) {
-    u8 *buf = new u8[size];
-    ctx.string_pool.push_back(std::unique_ptr<u8[]>(buf));
-
-    unsigned long size2 = size;
-    if (uncompress(buf, &size2, (u8 *)&data[0], data.size()) != Z_OK)
-      Fatal(ctx) << *this << ": " << name << ": uncompress failed";
-    if (size != size2)
-      Fatal(ctx) << *this << ": " << name << ": uncompress: invalid size";
-    return std::string_view((char *)buf, size);
-  };
+    return {{}, &shdr, 0};
 
   auto copy_shdr = [&](const ElfShdr<E> &shdr) {
     ElfShdr<E> *ret = new ElfShdr<E>;
@@ -134,12 +125,10 @@ ObjectFile<E>::uncompress_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
     std::string_view data = this->get_string(ctx, shdr);
     if (!data.starts_with("ZLIB") || data.size() <= 12)
       Fatal(ctx) << *this << ": " << name << ": corrupted compressed section";
-    u64 size = *(ubig64 *)&data[4];
-    std::string_view contents = do_uncompress(data.substr(12), size);
 
     ElfShdr<E> *shdr2 = copy_shdr(shdr);
-    shdr2->sh_size = size;
-    return {contents, shdr2};
+    shdr2->sh_size = *(ubig64 *)&data[4];
+    return {data.substr(12), shdr2, ELFCOMPRESS_ZLIB};
   }
 
   if (shdr.sh_flags & SHF_COMPRESSED) {
@@ -148,21 +137,22 @@ ObjectFile<E>::uncompress_contents(Context<E> &ctx, const ElfShdr<E> &shdr,
     if (data.size() < sizeof(ElfChdr<E>))
       Fatal(ctx) << *this << ": " << name << ": corrupted compressed section";
     ElfChdr<E> &hdr = *(ElfChdr<E> *)&data[0];
-    data = data.substr(sizeof(ElfChdr<E>));
 
+#ifdef HAVE_ZSTD
+    if (hdr.ch_type != ELFCOMPRESS_ZLIB && hdr.ch_type != ELFCOMPRESS_ZSTD)
+#else
     if (hdr.ch_type != ELFCOMPRESS_ZLIB)
+#endif
       Fatal(ctx) << *this << ": " << name << ": unsupported compression type";
 
     ElfShdr<E> *shdr2 = copy_shdr(shdr);
     shdr2->sh_flags &= ~(u64)(SHF_COMPRESSED);
     shdr2->sh_size = hdr.ch_size;
     shdr2->sh_addralign = hdr.ch_addralign;
-
-    std::string_view contents = do_uncompress(data, hdr.ch_size);
-    return {contents, shdr2};
+    return {data.substr(sizeof(ElfChdr<E>)), shdr2, hdr.ch_type};
   }
 
-  return {this->get_string(ctx, shdr), &shdr};
+  return {this->get_string(ctx, shdr), &shdr, 0};
 }
 
 template <typename E>
@@ -171,6 +161,13 @@ void ObjectFile<E>::initialize_sections(Context<E> &ctx) {
   for (i64 i = 0; i < this->elf_sections.size(); i++) {
     const ElfShdr<E> &shdr = this->elf_sections[i];
 
+    // .llvm.call-graph-profile is an SHF_EXCLUDE section, so it is not
+    // copied to the output, but we use it to sort sections.
+    if (shdr.sh_type == SHT_LLVM_CALL_GRAPH_PROFILE) {
+      cgprofile_sec_idx = i;
+      continue;
+    }
+
     if ((shdr.sh_flags & SHF_EXCLUDE) && !(shdr.sh_flags & SHF_ALLOC))
       continue;
 
@@ -223,11 +220,14 @@ void ObjectFile<E>::initialize_sections(Context<E> &ctx) {
 
       std::string_view contents;
       const ElfShdr<E> *shdr2;
-      std::tie(contents, shdr2) = uncompress_contents(ctx, shdr, name);
+      u32 compress_type;
+      std::tie(contents, shdr2, compress_type) =
+        read_section_contents(ctx, shdr, name);
 
       this->sections[i] =
         std::make_unique<InputSection<E>>(ctx, *this, *shdr2, name,
                                           contents, i);
+      this->sections[i]->compress_type = compress_type;
 
       static Counter counter("regular_sections");
       counter++;
@@ -250,6 +250,10 @@ void ObjectFile<E>::initialize_sections(Context<E> &ctx) {
       assert(target->relsec_idx == -1);
       target->relsec_idx = i;
 
+      // REL-type relocations store addends in section contents.
+      if (E::is_rel)
+        target->uncompress(ctx);
+
       if (target->shdr.sh_flags & SHF_ALLOC) {
         i64 size = shdr.sh_size / sizeof(ElfRel<E>);
         target->needs_dynrel.resize(size);
@@ -417,24 +421,38 @@ static bool should_write_to_local_symtab(Context<E> &ctx, Symbol<E> &sym) {
   return true;
 }
 
+// "foo@@VERSION" is the default version of "foo", so it is registered
+// as "foo". This function returns a symbol table key and a symbol name
+// for a given symbol string.
+static std::pair<std::string_view, std::string_view>
+get_symbol_key(std::string_view key) {
+  std::string_view name = key;
+  if (i64 pos = name.find('@'); pos != name.npos) {
+    std::string_view ver = name.substr(pos + 1);
+    name = name.substr(0, pos);
+    if (!ver.empty() && ver != "@" && ver.starts_with('@'))
+      key = name;
+  }
+  return {key, name};
+}
+
 // Returns a symbol object for a given key. This function handles
 // the -wrap option.
 template <typename E>
 static Symbol<E> *insert_symbol(Context<E> &ctx, const ElfSym<E> &esym,
-                                std::string_view key, std::string_view name) {
+                                std::string_view key, std::string_view name,
+                                u64 hash) {
   if (esym.is_undef() && name.starts_with("__real_") &&
       ctx.arg.wrap.count(name.substr(7))) {
     return intern(ctx, key.substr(7), name.substr(7));
   }
 
-  Symbol<E> *sym = intern(ctx, key, name);
-
-  if (esym.is_undef() && sym->wrap) {
+  if (esym.is_undef() && !ctx.arg.wrap.empty() && ctx.arg.wrap.count(key)) {
     key = save_string(ctx, "__wrap_" + std::string(key));
     name = save_string(ctx, "__wrap_" + std::string(name));
     return intern(ctx, key, name);
   }
-  return sym;
+  return intern(ctx, key, name, hash);
 }
 
 template <typename E>
@@ -476,11 +494,13 @@ void ObjectFile<E>::initialize_symbols(Context<E> &ctx) {
     }
   }
 
+  this->symbols.clear();
   this->symbols.resize(elf_syms.size());
 
   i64 num_globals = elf_syms.size() - first_global;
   sym_fragments.resize(elf_syms.size());
   symvers.resize(num_globals);
+  this->symbol_hashes.resize(num_globals);
 
   for (i64 i = 0; i < first_global; i++)
     this->symbols[i] = &this->local_syms[i];
@@ -490,28 +510,49 @@ void ObjectFile<E>::initialize_symbols(Context<E> &ctx) {
     const ElfSym<E> &esym = elf_syms[i];
 
     // Get a symbol name
-    std::string_view key = symbol_strtab.data() + esym.st_name;
-    std::string_view name = key;
+    std::string_view str = symbol_strtab.data() + esym.st_name;
+    auto [key, name] = get_symbol_key(str);
 
     // Parse symbol version after atsign
-    if (i64 pos = name.find('@'); pos != name.npos) {
-      std::string_view ver = name.substr(pos + 1);
-      name = name.substr(0, pos);
-
-      if (!ver.empty() && ver != "@") {
-        if (ver.starts_with('@'))
-          key = name;
-        if (esym.is_defined())
-          symvers[i - first_global] = ver.data();
-      }
+    if (esym.is_defined() && name.size() < str.size()) {
+      std::string_view ver = str.substr(name.size() + 1);
+      if (!ver.empty() && ver != "@")
+        symvers[i - first_global] = ver.data();
     }
 
-    this->symbols[i] = insert_symbol(ctx, esym, key, name);
+    // Symbols are interned by intern_symbols() later, but we compute
+    // their hashes here to estimate the size of the symbol table.
+    u64 hash = hash_string(key);
+    this->symbol_hashes[i - first_global] = hash;
+    ctx.symbol_estimator.insert(hash);
+
     if (esym.is_common())
       has_common_symbol = true;
   }
 }
 
+// Interns global symbols to the global symbol table. Until this
+// function is called, this->symbols contains only local symbols.
+template <typename E>
+void ObjectFile<E>::intern_symbols(Context<E> &ctx) {
+  if (is_parsed) {
+    for (i64 i = first_global; i < elf_syms.size(); i++) {
+      const ElfSym<E> &esym = elf_syms[i];
+      auto [key, name] = get_symbol_key(symbol_strtab.data() + esym.st_name);
+      this->symbols[i] = insert_symbol(ctx, esym, key, name,
+                                       this->symbol_hashes[i - first_global]);
+    }
+  } else {
+    this->symbols.resize(lazy_names.size());
+    for (i64 i = 0; i < lazy_names.size(); i++) {
+      auto [key, name] = get_symbol_key(lazy_names[i]);
+      this->symbols[i] = intern(ctx, key, name, this->symbol_hashes[i]);
+    }
+    lazy_names = {};
+  }
+  this->symbol_hashes = {};
+}
+
 static size_t find_null(std::string_view data, u64 entsize) {
   if (entsize == 1)
     return data.find('\0');
@@ -648,6 +689,7 @@ void ObjectFile<E>::initialize_mergeable_sections(Context<E> &ctx) {
     if (isec && isec->is_alive && (isec->shdr.sh_flags & SHF_MERGE) &&
         isec->shdr.sh_size && isec->shdr.sh_entsize &&
         isec->relsec_idx == -1) {
+      isec->uncompress(ctx);
       mergeable_sections[i] = split_section(ctx, *isec);
       isec->is_alive = false;
     }
@@ -731,8 +773,11 @@ void ObjectFile<E>::register_section_pieces(Context<E> &ctx) {
       Fatal(ctx) << *this << ": bad symbol value: " << esym.st_value;
     i64 idx = it - 1 - offsets.begin();
 
-    if (i < first_global)
-      this->symbols[i]->value = esym.st_value - offsets[idx];
+    // Global symbols are resolved before section pieces are registered,
+    // so we need to fix up the values of the symbols we own.
+    Symbol<E> &sym = *this->symbols[i];
+    if (i < first_global || (sym.file == this && sym.sym_idx == i))
+      sym.value = esym.st_value - offsets[idx];
 
     sym_fragments[i].frag = m->fragments[idx];
     sym_fragments[i].addend = esym.st_value - offsets[idx];
@@ -743,8 +788,25 @@ void ObjectFile<E>::register_section_pieces(Context<E> &ctx) {
       fragments.insert(fragments.end(), m->fragments.begin(), m->fragments.end());
 }
 
+// Symbol names are read as NUL-terminated strings from the string
+// table, so make sure that they don't point past its end.
+template <typename E>
+static void check_symbol_names(Context<E> &ctx, ObjectFile<E> &file,
+                               std::span<ElfSym<E>> syms,
+                               std::string_view strtab) {
+  if (!strtab.empty() && strtab.back() != '\0')
+    Fatal(ctx) << file << ": symbol string table is not NUL-terminated";
+
+  for (ElfSym<E> &sym : syms)
+    if (sym.st_name >= strtab.size())
+      Fatal(ctx) << file << ": invalid symbol name offset: " << sym.st_name;
+}
+
 template <typename E>
 void ObjectFile<E>::parse(Context<E> &ctx) {
+  static Counter count("parsed_objs");
+  count++;
+
   sections.resize(this->elf_sections.size());
   symtab_sec = this->find_section(SHT_SYMTAB);
 
@@ -752,12 +814,60 @@ void ObjectFile<E>::parse(Context<E> &ctx) {
     first_global = symtab_sec->sh_info;
     elf_syms = this->template get_data<ElfSym<E>>(ctx, *symtab_sec);
     symbol_strtab = this->get_string(ctx, symtab_sec->sh_link);
+    check_symbol_names(ctx, *this, elf_syms, symbol_strtab);
   }
 
   initialize_sections(ctx);
   initialize_symbols(ctx);
   initialize_mergeable_sections(ctx);
   initialize_ehframe_sections(ctx);
+  is_parsed = true;
+
+  // If the symbol table hasn't been allocated yet, read_input_files()
+  // will intern symbols later.
+  if (ctx.symbol_map.nbuckets)
+    intern_symbols(ctx);
+}
+
+// Most archive members are not pulled into the output, so we parse
+// only their symbol tables first. The rest of the file is parsed by
+// parse() if the file becomes alive in resolve_symbols().
+template <typename E>
+void ObjectFile<E>::parse_lazy(Context<E> &ctx) {
+  assert(is_in_lib);
+
+  const ElfShdr<E> *sec = this->find_section(SHT_SYMTAB);
+  if (!sec)
+    return;
+
+  std::span<ElfSym<E>> syms = this->template get_data<ElfSym<E>>(ctx, *sec);
+  std::string_view strtab = this->get_string(ctx, sec->sh_link);
+  check_symbol_names(ctx, *this, syms, strtab);
+
+  std::vector<std::string_view> names;
+  for (i64 i = sec->sh_info; i < syms.size(); i++)
+    if (!syms[i].is_undef() && !syms[i].is_common())
+      names.push_back(strtab.data() + syms[i].st_name);
+  init_lazy_symbols(ctx, std::move(names));
+}
+
+// Until an archive member is parsed, this->symbols contains only the
+// global symbols defined by the file.
+template <typename E>
+void ObjectFile<E>::init_lazy_symbols(Context<E> &ctx,
+                                      std::vector<std::string_view> names) {
+  assert(is_in_lib);
+  this->symbol_hashes.resize(names.size());
+
+  for (i64 i = 0; i < names.size(); i++) {
+    u64 hash = hash_string(get_symbol_key(names[i]).first);
+    this->symbol_hashes[i] = hash;
+    ctx.symbol_estimator.insert(hash);
+  }
+
+  lazy_names = std::move(names);
+  if (ctx.symbol_map.nbuckets)
+    intern_symbols(ctx);
 }
 
 // Symbols with higher priorities overwrites symbols with lower priorities.
@@ -792,6 +902,11 @@ template <typename E>
 static u64 get_rank(const Symbol<E> &sym) {
   if (!sym.file)
     return 7 << 24;
+
+  // A lazy symbol is never common. We need to handle it here because
+  // it may not have a corresponding ElfSym if the file is not parsed yet.
+  if (sym.is_lazy)
+    return (5 << 24) + sym.file->priority;
   return get_rank(sym.file, sym.esym(), sym.is_lazy);
 }
 
@@ -833,24 +948,37 @@ void ObjectFile<E>::merge_visibility(Context<E> &ctx, Symbol<E> &sym,
     Fatal(ctx) << *this << ": unknown symbol visibility: " << sym;
   };
 
-  u8 val = sym.visibility;
-
-  while (priority(visibility) < priority(val))
-    if (sym.visibility.compare_exchange_weak(val, visibility))
-      break;
+  if (priority(visibility) < priority(sym.visibility))
+    sym.visibility = visibility;
 }
 
 template <typename E>
 void ObjectFile<E>::resolve_lazy_symbols(Context<E> &ctx) {
   assert(is_in_lib);
 
+  if (!is_parsed) {
+    for (Symbol<E> *sym : this->symbols) {
+      std::lock_guard lock(sym->get_mutex(ctx));
+      if ((5 << 24) + this->priority < get_rank(*sym)) {
+        sym->file = this;
+        sym->sym_idx = -1;
+        sym->is_lazy = true;
+        sym->is_weak = false;
+        if (sym->traced)
+          SyncOut(ctx) << "trace-symbol: " << *this
+                       << ": lazy definition of " << *sym;
+      }
+    }
+    return;
+  }
+
   for (i64 i = first_global; i < this->symbols.size(); i++) {
     Symbol<E> &sym = *this->symbols[i];
     const ElfSym<E> &esym = elf_syms[i];
     if (esym.is_undef() || esym.is_common())
       continue;
 
-    std::lock_guard lock(sym.mu);
+    std::lock_guard lock(sym.get_mutex(ctx));
     if (get_rank(this, esym, true) < get_rank(sym)) {
       sym.file = this;
       sym.sym_idx = i;
@@ -873,7 +1001,7 @@ void ObjectFile<E>::resolve_regular_symbols(Context<E> &ctx) {
     if (esym.is_undef() || esym.is_common())
       continue;
 
-    std::lock_guard lock(sym.mu);
+    std::lock_guard lock(sym.get_mutex(ctx));
     if (get_rank(this, esym, false) < get_rank(sym))
       override_symbol(ctx, sym, esym, i);
   }
@@ -889,6 +1017,8 @@ ObjectFile<E>::mark_live_objects(Context<E> &ctx,
     const ElfSym<E> &esym = elf_syms[i];
     Symbol<E> &sym = *this->symbols[i];
 
+    std::lock_guard lock(sym.get_mutex(ctx));
+
     u8 visibility = esym.st_visibility;
     if (esym.is_defined() && exclude_libs)
       visibility = STV_HIDDEN;
@@ -903,11 +1033,10 @@ ObjectFile<E>::mark_live_objects(Context<E> &ctx,
         SyncOut(ctx) << "trace-symbol: " << *this << ": reference to " << sym;
     }
 
-    std::lock_guard lock(sym.mu);
-
     if (esym.is_undef() || esym.is_common()) {
       if (!esym.is_weak() && sym.file && !sym.file->is_alive.exchange(true)) {
-        feeder((ObjectFile<E> *)sym.file);
+        if (!sym.file->is_dso)
+          feeder((ObjectFile<E> *)sym.file);
         if (sym.traced)
           SyncOut(ctx) << "trace-symbol: " << *this << " keeps " << *sym.file
                        << " for " << sym;
@@ -931,7 +1060,7 @@ void ObjectFile<E>::resolve_common_symbols(Context<E> &ctx) {
       continue;
 
     Symbol<E> &sym = *this->symbols[i];
-    std::lock_guard lock(sym.mu);
+    std::lock_guard lock(sym.get_mutex(ctx));
 
     if (get_rank(this, esym, false) < get_rank(sym)) {
       sym.file = this;
@@ -987,7 +1116,7 @@ void ObjectFile<E>::claim_unresolved_symbols(Context<E> &ctx) {
     if (!esym.is_undef())
       continue;
 
-    std::lock_guard lock(sym.mu);
+    std::lock_guard lock(sym.get_mutex(ctx));
 
     auto claim = [&]() {
       sym.file = this;
@@ -1175,11 +1304,9 @@ void ObjectFile<E>::write_symtab(Context<E> &ctx) {
 
     if (sym.input_section)
       esym.st_shndx = sym.input_section->output_section->shndx;
-    else if (sym.shndx)
-      esym.st_shndx = sym.shndx;
     else if (esym.is_undef())
       esym.st_shndx = SHN_UNDEF;
-    else
+    else if (sym.file != ctx.internal_obj)
       esym.st_shndx = SHN_ABS;
 
     write_string(strtab_base + strtab_off, sym.name());
@@ -1266,17 +1393,20 @@ void SharedFile<E>::parse(Context<E> &ctx) {
   if (ElfShdr<E> *sec = this->find_section(SHT_GNU_VERSYM))
     vers = this->template get_data<u16>(ctx, *sec);
 
+  this->symbol_hashes.resize(esyms.size() - first_global);
+
   for (i64 i = first_global; i < esyms.size(); i++) {
     std::string_view name = symbol_strtab.data() + esyms[i].st_name;
+    u64 hash = hash_string(name);
+    this->symbol_hashes[i - first_global] = hash;
+    ctx.symbol_estimator.insert(hash);
 
-    globals.push_back(intern(ctx, name));
     if (esyms[i].is_undef())
       continue;
 
     if (vers.empty()) {
       elf_syms.push_back(&esyms[i]);
       versyms.push_back(VER_NDX_GLOBAL);
-      this->symbols.push_back(intern(ctx, name));
     } else {
       u16 ver = vers[i] & ~VERSYM_HIDDEN;
       if (ver == VER_NDX_LOCAL)
@@ -1284,19 +1414,54 @@ void SharedFile<E>::parse(Context<E> &ctx) {
 
       elf_syms.push_back(&esyms[i]);
       versyms.push_back(ver);
-
-      if (vers[i] & VERSYM_HIDDEN) {
-        std::string_view mangled_name = save_string(
-          ctx, std::string(name) + "@" + std::string(version_strings[ver]));
-        this->symbols.push_back(intern(ctx, mangled_name, name));
-      } else {
-        this->symbols.push_back(intern(ctx, name));
-      }
     }
   }
 
   static Counter counter("dso_syms");
   counter += elf_syms.size();
+
+  // If the symbol table hasn't been allocated yet, read_input_files()
+  // will intern symbols later.
+  if (ctx.symbol_map.nbuckets)
+    intern_symbols(ctx);
+}
+
+template <typename E>
+void SharedFile<E>::intern_symbols(Context<E> &ctx) {
+  if (!symtab_sec)
+    return;
+
+  std::span<ElfSym<E>> esyms =
+    this->template get_data<ElfSym<E>>(ctx, *symtab_sec);
+  i64 first_global = symtab_sec->sh_info;
+
+  std::span<u16> vers;
+  if (ElfShdr<E> *sec = this->find_section(SHT_GNU_VERSYM))
+    vers = this->template get_data<u16>(ctx, *sec);
+
+  globals.resize(esyms.size() - first_global);
+  for (i64 i = first_global; i < esyms.size(); i++) {
+    std::string_view name = symbol_strtab.data() + esyms[i].st_name;
+    globals[i - first_global] =
+      intern(ctx, name, name, this->symbol_hashes[i - first_global]);
+  }
+
+  // A hidden versioned symbol is registered as "foo@VERSION" so that
+  // it doesn't conflict with the default version of "foo".
+  this->symbols.resize(elf_syms.size());
+  for (i64 i = 0; i < elf_syms.size(); i++) {
+    i64 idx = elf_syms[i] - esyms.data();
+    if (!vers.empty() && (vers[idx] & VERSYM_HIDDEN)) {
+      std::string_view name = symbol_strtab.data() + elf_syms[i]->st_name;
+      std::string_view mangled_name = save_string(
+        ctx, std::string(name) + "@" + std::string(version_strings[versyms[i]]));
+      this->symbols[i] = intern(ctx, mangled_name, name);
+    } else {
+      this->symbols[i] = globals[idx - first_global];
+    }
+  }
+
+  this->symbol_hashes = {};
 }
 
 template <typename E>
@@ -1332,7 +1497,7 @@ void SharedFile<E>::resolve_dso_symbols(Context<E> &ctx) {
     Symbol<E> &sym = *this->symbols[i];
     const ElfSym<E> &esym = *elf_syms[i];
 
-    std::lock_guard lock(sym.mu);
+    std::lock_guard lock(sym.get_mutex(ctx));
 
     if (!sym.file || this->priority < sym.file->priority) {
       sym.file = this;
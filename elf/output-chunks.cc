@@ -3,7 +3,9 @@
 #include <shared_mutex>
 #include <sys/mman.h>
 #include <tbb/parallel_for_each.h>
+#include <tbb/parallel_scan.h>
 #include <tbb/parallel_sort.h>
+#include <tbb/task_arena.h>
 
 #ifdef __APPLE__
 #  define COMMON_DIGEST_FOR_OPENSSL
@@ -330,6 +332,29 @@ void RelDynSection<E>::sort(Context<E> &ctx) {
   }
 }
 
+template <typename E>
+void RelrDynSection<E>::update_shdr(Context<E> &ctx) {
+  i64 n = ctx.got->relr.size();
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections)
+    n += osec->relr.size();
+  this->shdr.sh_size = n * E::word_size;
+}
+
+template <typename E>
+void RelrDynSection<E>::copy_buf(Context<E> &ctx) {
+  typename E::WordTy *buf =
+    (typename E::WordTy *)(ctx.buf + this->shdr.sh_offset);
+
+  auto write = [&](Chunk<E> &chunk, std::span<u64> relr) {
+    for (u64 val : relr)
+      *buf++ = (val & 1) ? val : (chunk.shdr.sh_addr + val);
+  };
+
+  write(*ctx.got, ctx.got->relr);
+  for (std::unique_ptr<OutputSection<E>> &osec : ctx.output_sections)
+    write(*osec, osec->relr);
+}
+
 template <typename E>
 void StrtabSection<E>::update_shdr(Context<E> &ctx) {
   this->shdr.sh_size = 1;
@@ -388,14 +413,12 @@ void DynstrSection<E>::copy_buf(Context<E> &ctx) {
   for (std::pair<std::string_view, i64> pair : strings)
     write_string(base + pair.second, pair.first);
 
-  if (!ctx.dynsym->symbols.empty()) {
-    i64 offset = dynsym_offset;
-    for (Symbol<E> *sym :
-           std::span<Symbol<E> *>(ctx.dynsym->symbols).subspan(1)) {
-      write_string(base + offset, sym->name());
-      offset += sym->name().size() + 1;
-    }
-  }
+  std::vector<Symbol<E> *> &symbols = ctx.dynsym->symbols;
+  std::vector<i64> &offsets = ctx.dynsym->name_offsets;
+
+  tbb::parallel_for((i64)1, (i64)symbols.size(), [&](i64 i) {
+    write_string(base + offsets[i], symbols[i]->name());
+  });
 }
 
 template <typename E>
@@ -478,6 +501,12 @@ static std::vector<typename E::WordTy> create_dynamic_section(Context<E> &ctx) {
     define(E::is_rel ? DT_RELENT : DT_RELAENT, sizeof(ElfRel<E>));
   }
 
+  if (ctx.relrdyn && ctx.relrdyn->shdr.sh_size) {
+    define(DT_RELR, ctx.relrdyn->shdr.sh_addr);
+    define(DT_RELRSZ, ctx.relrdyn->shdr.sh_size);
+    define(DT_RELRENT, E::word_size);
+  }
+
   if (ctx.relplt->shdr.sh_size) {
     define(DT_JMPREL, ctx.relplt->shdr.sh_addr);
     define(DT_PLTRELSZ, ctx.relplt->shdr.sh_size);
@@ -740,48 +769,61 @@ void OutputSection<E>::write_to(Context<E> &ctx, u8 *buf) {
   });
 }
 
-template <typename E>
-void GotSection<E>::add_got_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  sym->set_got_idx(ctx, this->shdr.sh_size / E::word_size);
-  this->shdr.sh_size += E::word_size;
-  got_syms.push_back(sym);
-
-  if (sym->is_imported)
-    ctx.dynsym->add_symbol(ctx, sym);
+// Encodes a list of word-aligned addresses in the RELR format.
+// An address entry (whose LSB is 0) is followed by zero or more bitmap
+// entries (whose LSB is 1). The N'th bit of a bitmap indicates whether
+// or not the N'th word after the last covered address needs to be
+// relocated. Each bitmap covers 63 words on 64-bit targets (31 words on
+// 32-bit targets).
+//
+// The same offset may appear more than once if an input section has
+// duplicate relocations, so we sort and uniquify the input first.
+template <typename E>
+static std::vector<u64> encode_relr(std::vector<u64> &pos) {
+  sort(pos);
+  pos.erase(std::unique(pos.begin(), pos.end()), pos.end());
+
+  std::vector<u64> vec;
+  i64 num_bits = E::word_size * 8 - 1;
+  i64 max_delta = E::word_size * num_bits;
+
+  for (i64 i = 0; i < pos.size();) {
+    assert(pos[i] % E::word_size == 0);
+    vec.push_back(pos[i]);
+    u64 base = pos[i++] + E::word_size;
+
+    for (;;) {
+      u64 bits = 0;
+      for (; i < pos.size() && pos[i] - base < max_delta; i++)
+        bits |= (u64)1 << ((pos[i] - base) / E::word_size);
+
+      if (!bits)
+        break;
+      vec.push_back((bits << 1) | 1);
+      base += max_delta;
+    }
+  }
+  return vec;
 }
 
+// Collects relative relocations that can be represented in .relr.dyn.
+// Address entries are relative to the beginning of this section until
+// they are written to the output file.
 template <typename E>
-void GotSection<E>::add_gottp_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  sym->set_gottp_idx(ctx, this->shdr.sh_size / E::word_size);
-  this->shdr.sh_size += E::word_size;
-  gottp_syms.push_back(sym);
-
-  if (sym->is_imported)
-    ctx.dynsym->add_symbol(ctx, sym);
-}
+void OutputSection<E>::construct_relr(Context<E> &ctx) {
+  if (!(this->shdr.sh_flags & SHF_ALLOC))
+    return;
 
-template <typename E>
-void GotSection<E>::add_tlsgd_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  sym->set_tlsgd_idx(ctx, this->shdr.sh_size / E::word_size);
-  this->shdr.sh_size += E::word_size * 2;
-  tlsgd_syms.push_back(sym);
-  ctx.dynsym->add_symbol(ctx, sym);
-}
+  std::vector<u64> pos;
 
-template <typename E>
-void GotSection<E>::add_tlsdesc_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  sym->set_tlsdesc_idx(ctx, this->shdr.sh_size / E::word_size);
-  this->shdr.sh_size += E::word_size * 2;
-  tlsdesc_syms.push_back(sym);
-  ctx.dynsym->add_symbol(ctx, sym);
-}
+  for (InputSection<E> *isec : members) {
+    std::span<ElfRel<E>> rels = isec->get_rels(ctx);
+    for (i64 i = 0; i < rels.size(); i++)
+      if (isec->needs_baserel[i] && isec->is_relr_reloc(ctx, rels[i]))
+        pos.push_back(isec->offset + rels[i].r_offset);
+  }
 
-template <typename E>
-void GotSection<E>::add_tlsld(Context<E> &ctx) {
-  if (tlsld_idx != -1)
-    return;
-  tlsld_idx = this->shdr.sh_size / E::word_size;
-  this->shdr.sh_size += E::word_size * 2;
+  relr = encode_relr<E>(pos);
 }
 
 template <typename E>
@@ -794,8 +836,8 @@ template <typename E>
 i64 GotSection<E>::get_reldyn_size(Context<E> &ctx) const {
   i64 n = 0;
   for (Symbol<E> *sym : got_syms)
-    if (sym->is_imported || (ctx.arg.pic && sym->is_relative(ctx)) ||
-        sym->get_type() == STT_GNU_IFUNC)
+    if (sym->is_imported || sym->get_type() == STT_GNU_IFUNC ||
+        (ctx.arg.pic && sym->is_relative(ctx) && !ctx.relrdyn))
       n++;
 
   n += tlsgd_syms.size() * 2;
@@ -811,6 +853,17 @@ i64 GotSection<E>::get_reldyn_size(Context<E> &ctx) const {
   return n * sizeof(ElfRel<E>);
 }
 
+template <typename E>
+void GotSection<E>::construct_relr(Context<E> &ctx) {
+  std::vector<u64> pos;
+  for (Symbol<E> *sym : got_syms)
+    if (!sym->is_imported && sym->get_type() != STT_GNU_IFUNC &&
+        ctx.arg.pic && sym->is_relative(ctx))
+      pos.push_back(sym->get_got_idx(ctx) * E::word_size);
+
+  relr = encode_relr<E>(pos);
+}
+
 // Fill .got and .rel.dyn.
 template <typename E>
 void GotSection<E>::copy_buf(Context<E> &ctx) {
@@ -832,7 +885,7 @@ void GotSection<E>::copy_buf(Context<E> &ctx) {
         buf[sym->get_got_idx(ctx)] = resolver_addr;
     } else {
       buf[sym->get_got_idx(ctx)] = sym->get_addr(ctx);
-      if (ctx.arg.pic && sym->is_relative(ctx))
+      if (ctx.arg.pic && sym->is_relative(ctx) && !ctx.relrdyn)
         *rel++ = reloc<E>(addr, E::R_RELATIVE, 0, (i64)sym->get_addr(ctx));
     }
   }
@@ -864,35 +917,6 @@ void GotSection<E>::copy_buf(Context<E> &ctx) {
     *rel++ = reloc<E>(get_tlsld_addr(ctx), E::R_DTPMOD, 0);
 }
 
-template <typename E>
-void PltSection<E>::add_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  assert(!sym->has_plt(ctx));
-
-  if (this->shdr.sh_size == 0) {
-    this->shdr.sh_size = E::plt_hdr_size;
-    ctx.gotplt->shdr.sh_size = E::word_size * 3;
-  }
-
-  sym->set_plt_idx(ctx, this->shdr.sh_size / E::plt_size);
-  this->shdr.sh_size += E::plt_size;
-  symbols.push_back(sym);
-
-  sym->set_gotplt_idx(ctx, ctx.gotplt->shdr.sh_size / E::word_size);
-  ctx.gotplt->shdr.sh_size += E::word_size;
-  ctx.relplt->shdr.sh_size += sizeof(ElfRel<E>);
-  ctx.dynsym->add_symbol(ctx, sym);
-}
-
-template <typename E>
-void PltGotSection<E>::add_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  assert(!sym->has_plt(ctx));
-  assert(sym->has_got(ctx));
-
-  sym->set_pltgot_idx(ctx, this->shdr.sh_size / E::pltgot_size);
-  this->shdr.sh_size += E::pltgot_size;
-  symbols.push_back(sym);
-}
-
 template <typename E>
 void RelPltSection<E>::update_shdr(Context<E> &ctx) {
   this->shdr.sh_link = ctx.dynsym->shndx;
@@ -909,14 +933,6 @@ void RelPltSection<E>::copy_buf(Context<E> &ctx) {
                                  sym->get_dynsym_idx(ctx));
 }
 
-template <typename E>
-void DynsymSection<E>::add_symbol(Context<E> &ctx, Symbol<E> *sym) {
-  if (sym->get_dynsym_idx(ctx) != -1)
-    return;
-  sym->set_dynsym_idx(ctx, -2);
-  symbols.push_back(sym);
-}
-
 template <typename E>
 void DynsymSection<E>::finalize(Context<E> &ctx) {
   Timer t(ctx, "DynsymSection::finalize");
@@ -938,6 +954,7 @@ void DynsymSection<E>::finalize(Context<E> &ctx) {
     struct T {
       Symbol<E> *sym;
       u32 hash;
+      u32 bucket;
       i32 idx;
     };
 
@@ -947,24 +964,47 @@ void DynsymSection<E>::finalize(Context<E> &ctx) {
     tbb::parallel_for((i64)0, num_globals, [&](i64 i) {
       Symbol<E> *sym = symbols[global_offset + i];
       vec[i].sym = sym;
-      vec[i].hash = djb_hash(sym->name()) % ctx.gnu_hash->num_buckets;
+      vec[i].hash = djb_hash(sym->name());
+      vec[i].bucket = vec[i].hash % ctx.gnu_hash->num_buckets;
       vec[i].idx = i;
     });
 
     tbb::parallel_sort(vec.begin(), vec.end(), [&](const T &a, const T &b) {
-      return std::tuple(a.hash, a.idx) < std::tuple(b.hash, b.idx);
+      return std::tuple(a.bucket, a.idx) < std::tuple(b.bucket, b.idx);
     });
 
-    for (i64 i = 0; i < num_globals; i++)
+    // Keep the hashes so that we don't have to compute them again
+    // when writing .gnu.hash.
+    hashes.resize(num_globals);
+
+    tbb::parallel_for((i64)0, num_globals, [&](i64 i) {
       symbols[global_offset + i] = vec[i].sym;
+      hashes[i] = vec[i].hash;
+    });
   }
 
+  // Assign .dynstr offsets to symbol names. Names are written after
+  // the other strings in .dynstr in the .dynsym order.
   ctx.dynstr->dynsym_offset = ctx.dynstr->shdr.sh_size;
+  name_offsets.resize(symbols.size());
+
+  i64 size = tbb::parallel_scan(
+    tbb::blocked_range<i64>(1, symbols.size(), 10000),
+    (i64)0,
+    [&](const tbb::blocked_range<i64> &r, i64 sum, bool is_final) {
+      for (i64 i = r.begin(); i < r.end(); i++) {
+        if (is_final) {
+          symbols[i]->set_dynsym_idx(ctx, i);
+          name_offsets[i] = ctx.dynstr->dynsym_offset + sum;
+        }
+        sum += symbols[i]->name().size() + 1;
+      }
+      return sum;
+    },
+    std::plus<i64>(),
+    tbb::simple_partitioner());
 
-  for (i64 i = 1; i < symbols.size(); i++) {
-    symbols[i]->set_dynsym_idx(ctx, i);
-    ctx.dynstr->shdr.sh_size += symbols[i]->name().size() + 1;
-  }
+  ctx.dynstr->shdr.sh_size += size;
 
   // ELF's symbol table sh_info holds the offset of the first global symbol.
   this->shdr.sh_info = global_offset;
@@ -980,12 +1020,10 @@ template <typename E>
 void DynsymSection<E>::copy_buf(Context<E> &ctx) {
   u8 *base = ctx.buf + this->shdr.sh_offset;
   memset(base, 0, sizeof(ElfSym<E>));
-  i64 name_offset = ctx.dynstr->dynsym_offset;
 
-  for (i64 i = 1; i < symbols.size(); i++) {
+  tbb::parallel_for((i64)1, (i64)symbols.size(), [&](i64 i) {
     Symbol<E> &sym = *symbols[i];
-    ElfSym<E> &esym =
-      *(ElfSym<E> *)(base + sym.get_dynsym_idx(ctx) * sizeof(ElfSym<E>));
+    ElfSym<E> &esym = *(ElfSym<E> *)(base + i * sizeof(ElfSym<E>));
 
     memset(&esym, 0, sizeof(esym));
     esym.st_type = sym.esym().st_type;
@@ -1000,8 +1038,7 @@ void DynsymSection<E>::copy_buf(Context<E> &ctx) {
     else
       esym.st_bind = sym.esym().st_bind;
 
-    esym.st_name = name_offset;
-    name_offset += sym.name().size() + 1;
+    esym.st_name = name_offsets[i];
 
     if (sym.has_copyrel) {
       esym.st_shndx = sym.copyrel_readonly
@@ -1025,7 +1062,7 @@ void DynsymSection<E>::copy_buf(Context<E> &ctx) {
       esym.st_value = sym.get_addr(ctx, false);
       esym.st_visibility = sym.visibility;
     }
-  }
+  });
 }
 
 template <typename E>
@@ -1051,12 +1088,31 @@ void HashSection<E>::copy_buf(Context<E> &ctx) {
 
   hdr[0] = hdr[1] = num_slots;
 
-  for (i64 i = 1; i < ctx.dynsym->symbols.size(); i++) {
-    Symbol<E> *sym = ctx.dynsym->symbols[i];
-    i64 idx = elf_hash(sym->name()) % num_slots;
-    chains[sym->get_dynsym_idx(ctx)] = buckets[idx];
-    buckets[idx] = sym->get_dynsym_idx(ctx);
-  }
+  // Each bucket points to the symbol with the largest index in it, and
+  // each chain entry points to the next smaller index in the same bucket.
+  // We sort symbols by (bucket, index) to find the neighbors in parallel.
+  struct T {
+    u32 bucket;
+    u32 idx;
+  };
+
+  std::vector<Symbol<E> *> &symbols = ctx.dynsym->symbols;
+  std::vector<T> vec(symbols.size() - 1);
+
+  tbb::parallel_for((i64)1, (i64)symbols.size(), [&](i64 i) {
+    vec[i - 1] = {(u32)(elf_hash(symbols[i]->name()) % num_slots), (u32)i};
+  });
+
+  tbb::parallel_sort(vec.begin(), vec.end(), [](const T &a, const T &b) {
+    return std::tuple(a.bucket, a.idx) < std::tuple(b.bucket, b.idx);
+  });
+
+  tbb::parallel_for((i64)0, (i64)vec.size(), [&](i64 i) {
+    if (i > 0 && vec[i - 1].bucket == vec[i].bucket)
+      chains[vec[i].idx] = vec[i - 1].idx;
+    if (i == vec.size() - 1 || vec[i].bucket != vec[i + 1].bucket)
+      buckets[vec[i].bucket] = vec[i].idx;
+  });
 }
 
 template <typename E>
@@ -1090,42 +1146,49 @@ void GnuHashSection<E>::copy_buf(Context<E> &ctx) {
   *(u32 *)(base + 8) = num_bloom;
   *(u32 *)(base + 12) = BLOOM_SHIFT;
 
-  std::span<Symbol<E> *> symbols =
-    std::span<Symbol<E> *>(ctx.dynsym->symbols).subspan(symoffset);
-
-  std::vector<u32> hashes(symbols.size());
-  for (i64 i = 0; i < symbols.size(); i++)
-    hashes[i] = djb_hash(symbols[i]->name());
+  std::vector<u32> &hashes = ctx.dynsym->hashes;
+  i64 num_globals = hashes.size();
+
+  // Write a bloom filter. Each thread sets bits in its own copy of
+  // the filter, and the copies are OR'ed together at the end.
+  using Word = typename E::WordTy;
+  Word *bloom = (Word *)(base + HEADER_SIZE);
+  tbb::enumerable_thread_specific<std::vector<Word>> blooms(num_bloom);
+
+  tbb::parallel_for(tbb::blocked_range<i64>(0, num_globals, 10000),
+                    [&](const tbb::blocked_range<i64> &r) {
+    std::vector<Word> &vec = blooms.local();
+    for (i64 i = r.begin(); i < r.end(); i++) {
+      u32 hash = hashes[i];
+      i64 idx = (hash / ELFCLASS_BITS) % num_bloom;
+      vec[idx] |= (u64)1 << (hash % ELFCLASS_BITS);
+      vec[idx] |= (u64)1 << ((hash >> BLOOM_SHIFT) % ELFCLASS_BITS);
+    }
+  });
 
-  // Write a bloom filter
-  typename E::WordTy *bloom = (typename E::WordTy *)(base + HEADER_SIZE);
-  for (i64 hash : hashes) {
-    i64 idx = (hash / ELFCLASS_BITS) % num_bloom;
-    bloom[idx] |= (u64)1 << (hash % ELFCLASS_BITS);
-    bloom[idx] |= (u64)1 << ((hash >> BLOOM_SHIFT) % ELFCLASS_BITS);
-  }
+  tbb::parallel_for(tbb::blocked_range<i64>(0, num_bloom),
+                    [&](const tbb::blocked_range<i64> &r) {
+    for (std::vector<Word> &vec : blooms)
+      for (i64 i = r.begin(); i < r.end(); i++)
+        bloom[i] |= vec[i];
+  });
 
-  // Write hash bucket indices
+  // Symbols are sorted by bucket, so a bucket points to the first
+  // symbol whose bucket differs from its predecessor's.
   u32 *buckets = (u32 *)(bloom + num_bloom);
-  for (i64 i = 0; i < hashes.size(); i++) {
+  u32 *table = buckets + num_buckets;
+
+  tbb::parallel_for((i64)0, num_globals, [&](i64 i) {
     i64 idx = hashes[i] % num_buckets;
-    if (!buckets[idx])
+    if (i == 0 || (hashes[i - 1] % num_buckets) != idx)
       buckets[idx] = i + symoffset;
-  }
 
-  // Write a hash table
-  u32 *table = buckets + num_buckets;
-  for (i64 i = 0; i < symbols.size(); i++) {
-    bool is_last = false;
-    if (i == symbols.size() - 1 ||
-        (hashes[i] % num_buckets) != (hashes[i + 1] % num_buckets))
-      is_last = true;
-
-    if (is_last)
+    // Write a hash table
+    if (i == num_globals - 1 || (hashes[i + 1] % num_buckets) != idx)
       table[i] = hashes[i] | 1;
     else
       table[i] = hashes[i] & ~1;
-  }
+  });
 }
 
 template <typename E>
@@ -1442,7 +1505,6 @@ void DynbssSection<E>::add_symbol(Context<E> &ctx, Symbol<E> *sym) {
   sym->has_copyrel = true;
   this->shdr.sh_size += sym->esym().st_size;
   symbols.push_back(sym);
-  ctx.dynsym->add_symbol(ctx, sym);
 }
 
 template <typename E>
@@ -1471,7 +1533,16 @@ void VerneedSection<E>::construct(Context<E> &ctx) {
     return !sym->file->is_dso || sym->ver_idx <= VER_NDX_LAST_RESERVED;
   });
 
-  if (syms.empty())
+  // glibc refuses to load a file with DT_RELR unless it depends on
+  // GLIBC_ABI_DT_RELR, so that old loaders that don't understand
+  // DT_RELR reject the file instead of silently skipping relocations.
+  SharedFile<E> *libc = nullptr;
+  if (ctx.relrdyn)
+    for (SharedFile<E> *file : ctx.dsos)
+      if (file->soname == "libc.so.6")
+        libc = file;
+
+  if (syms.empty() && !libc)
     return;
 
   sort(syms, [](Symbol<E> *a, Symbol<E> *b) {
@@ -1485,7 +1556,7 @@ void VerneedSection<E>::construct(Context<E> &ctx) {
 
   // Allocate a large enough buffer for .gnu.version_r.
   contents.resize((sizeof(ElfVerneed<E>) + sizeof(ElfVernaux<E>)) *
-                  syms.size());
+                  (syms.size() + 2));
 
   // Fill .gnu.version_r.
   u8 *buf = (u8 *)&contents[0];
@@ -1508,7 +1579,7 @@ void VerneedSection<E>::construct(Context<E> &ctx) {
     aux = nullptr;
   };
 
-  auto add_entry = [&](Symbol<E> *sym) {
+  auto add_entry = [&](std::string_view verstr) {
     verneed->vn_cnt++;
 
     if (aux)
@@ -1516,23 +1587,43 @@ void VerneedSection<E>::construct(Context<E> &ctx) {
     aux = (ElfVernaux<E> *)ptr;
     ptr += sizeof(*aux);
 
-    std::string_view verstr = sym->get_version();
     aux->vna_hash = elf_hash(verstr);
     aux->vna_other = ++veridx;
     aux->vna_name = ctx.dynstr->add_string(verstr);
   };
 
+  bool has_relr_entry = false;
+
+  auto end_group = [&](InputFile<E> *file) {
+    if (libc && ((SharedFile<E> *)file)->soname == libc->soname) {
+      add_entry("GLIBC_ABI_DT_RELR");
+      has_relr_entry = true;
+    }
+  };
+
   for (i64 i = 0; i < syms.size(); i++) {
     if (i == 0 || syms[i - 1]->file != syms[i]->file) {
+      if (i != 0)
+        end_group(syms[i - 1]->file);
       start_group(syms[i]->file);
-      add_entry(syms[i]);
+      add_entry(syms[i]->get_version());
     } else if (syms[i - 1]->ver_idx != syms[i]->ver_idx) {
-      add_entry(syms[i]);
+      add_entry(syms[i]->get_version());
     }
 
     ctx.versym->contents[syms[i]->get_dynsym_idx(ctx)] = veridx;
   }
 
+  if (!syms.empty())
+    end_group(syms.back()->file);
+
+  // If no symbol is imported from libc with a version, we need to
+  // create a verneed entry for libc just for GLIBC_ABI_DT_RELR.
+  if (libc && !has_relr_entry) {
+    start_group(libc);
+    add_entry("GLIBC_ABI_DT_RELR");
+  }
+
   // Resize .gnu.version_r to fit to its contents.
   contents.resize(ptr - buf);
 }
@@ -1742,6 +1833,166 @@ void NotePropertySection<E>::copy_buf(Context<E> &ctx) {
   buf[6] = features;                       // Feature flags
 }
 
+// Compresses the contents of a given chunk.
+//
+// Debug sections can be very large, so we don't want to write an
+// entire section to memory before compressing it. For a regular output
+// section, we split the section at input section boundaries into
+// shards of at least 1 MiB, and split input sections larger than that
+// into 1 MiB pieces. Each shard is then written to a per-thread buffer
+// and compressed in parallel. Other chunks are written to memory first.
+template <typename E>
+static std::unique_ptr<Compressor>
+compress_chunk(Context<E> &ctx, Chunk<E> &chunk, bool use_zstd) {
+  auto create = [&](std::span<i64> sizes,
+                    ShardWriter write) -> std::unique_ptr<Compressor> {
+#ifdef HAVE_ZSTD
+    if (use_zstd) {
+      std::unique_ptr<ZstdCompressor> comp =
+        std::make_unique<ZstdCompressor>(sizes, write, ctx.arg.compress_level);
+      if (const char *err = comp->get_error())
+        Fatal(ctx) << chunk.name << ": ZSTD_compress failed: " << err;
+      return comp;
+    }
+#endif
+    return std::make_unique<ZlibCompressor>(sizes, write);
+  };
+
+  constexpr i64 SHARD_SIZE = 1024 * 1024;
+
+  if (chunk.kind != chunk.REGULAR) {
+    std::unique_ptr<u8[]> buf(new u8[chunk.shdr.sh_size]);
+    chunk.write_to(ctx, buf.get());
+
+    std::vector<i64> sizes;
+    for (i64 i = 0; i < chunk.shdr.sh_size; i += SHARD_SIZE)
+      sizes.push_back(std::min<i64>(chunk.shdr.sh_size - i, SHARD_SIZE));
+
+    return create(sizes, [&](i64 i, u8 *out) {
+      memcpy(out, buf.get() + i * SHARD_SIZE, sizes[i]);
+    });
+  }
+
+  OutputSection<E> &osec = (OutputSection<E> &)chunk;
+  std::span<InputSection<E> *> members = osec.members;
+
+  auto get_end = [&](i64 i) -> u64 {
+    if (i == members.size() - 1)
+      return osec.shdr.sh_size;
+    return members[i + 1]->offset;
+  };
+
+  // An input section larger than a shard is written to memory once
+  // and split into shard-size pieces, so that a single large section
+  // is still compressed in parallel. The buffer is freed when all
+  // pieces have been copied.
+  struct LargeMember {
+    i64 idx;
+    u64 begin;
+    u64 end;
+    std::once_flag once;
+    std::unique_ptr<u8[]> buf;
+    std::atomic<i64> num_pieces = 0;
+  };
+
+  // A shard consists of members[begin] to members[end - 1], or is a
+  // piece of a large member.
+  struct Shard {
+    i64 begin;
+    i64 end;
+    u64 offset;
+    LargeMember *large = nullptr;
+  };
+
+  std::vector<std::unique_ptr<LargeMember>> large_members;
+  std::vector<Shard> shards;
+  i64 first = 0;
+  u64 offset = 0;
+
+  for (i64 i = 0; i < members.size(); i++) {
+    if (members[i]->shdr.sh_size > SHARD_SIZE) {
+      if (first < i)
+        shards.push_back({first, i, offset});
+
+      LargeMember *m =
+        large_members.emplace_back(std::make_unique<LargeMember>()).get();
+      m->idx = i;
+      m->begin = (first < i) ? members[i]->offset : offset;
+      m->end = get_end(i);
+
+      for (u64 off = m->begin; off < m->end; off += SHARD_SIZE) {
+        shards.push_back({i, i + 1, off, m});
+        m->num_pieces++;
+      }
+
+      first = i + 1;
+      offset = m->end;
+      continue;
+    }
+
+    if (first < i && members[i]->offset - offset >= SHARD_SIZE) {
+      shards.push_back({first, i, offset});
+      first = i;
+      offset = members[i]->offset;
+    }
+  }
+
+  if (offset < osec.shdr.sh_size || shards.empty())
+    shards.push_back({first, (i64)members.size(), offset});
+
+  std::vector<i64> sizes;
+  for (i64 i = 0; i < shards.size(); i++) {
+    u64 end = (i == shards.size() - 1) ?
+      osec.shdr.sh_size : shards[i + 1].offset;
+    sizes.push_back(end - shards[i].offset);
+  }
+
+  // Writes members[begin] to members[end - 1] to a buffer for a given
+  // range of the output section, zero-filling gaps.
+  auto write_members = [&](i64 begin, i64 end, u64 start, u64 size,
+                           u8 *buf) {
+    if (begin == end) {
+      memset(buf, 0, size);
+      return;
+    }
+
+    memset(buf, 0, members[begin]->offset - start);
+
+    for (i64 j = begin; j < end; j++) {
+      InputSection<E> &isec = *members[j];
+      isec.write_to(ctx, buf + isec.offset - start);
+
+      // Zero-clear trailing padding
+      u64 this_end = isec.offset + isec.shdr.sh_size;
+      memset(buf + this_end - start, 0, get_end(j) - this_end);
+    }
+  };
+
+  return create(sizes, [&](i64 i, u8 *buf) {
+    Shard &shard = shards[i];
+    LargeMember *m = shard.large;
+
+    if (!m) {
+      write_members(shard.begin, shard.end, shard.offset, sizes[i], buf);
+      return;
+    }
+
+    // Isolate the write so that this thread doesn't pick up another
+    // piece of the same member while it holds the once_flag.
+    std::call_once(m->once, [&] {
+      m->buf.reset(new u8[m->end - m->begin]);
+      tbb::this_task_arena::isolate([&] {
+        write_members(m->idx, m->idx + 1, m->begin, m->end - m->begin,
+                      m->buf.get());
+      });
+    });
+
+    memcpy(buf, m->buf.get() + shard.offset - m->begin, sizes[i]);
+    if (--m->num_pieces == 0)
+      m->buf.reset();
+  });
+}
+
 template <typename E>
 GabiCompressedSection<E>::GabiCompressedSection(Context<E> &ctx,
                                                 Chunk<E> &chunk)
@@ -1749,14 +2000,11 @@ GabiCompressedSection<E>::GabiCompressedSection(Context<E> &ctx,
   assert(chunk.name.starts_with(".debug"));
   this->name = chunk.name;
 
-  std::unique_ptr<u8[]> buf(new u8[chunk.shdr.sh_size]);
-  chunk.write_to(ctx, buf.get());
-
-  chdr.ch_type = ELFCOMPRESS_ZLIB;
+  bool use_zstd = (ctx.arg.compress_debug_sections == COMPRESS_ZSTD);
+  chdr.ch_type = use_zstd ? ELFCOMPRESS_ZSTD : ELFCOMPRESS_ZLIB;
   chdr.ch_size = chunk.shdr.sh_size;
   chdr.ch_addralign = chunk.shdr.sh_addralign;
-
-  contents.reset(new ZlibCompressor({(char *)buf.get(), chunk.shdr.sh_size}));
+  contents = compress_chunk(ctx, chunk, use_zstd);
 
   this->shdr = chunk.shdr;
   this->shdr.sh_flags |= SHF_COMPRESSED;
@@ -1778,11 +2026,7 @@ GnuCompressedSection<E>::GnuCompressedSection(Context<E> &ctx,
   : Chunk<E>(this->SYNTHETIC) {
   assert(chunk.name.starts_with(".debug"));
   this->name = save_string(ctx, ".zdebug" + std::string(chunk.name.substr(6)));
-
-  std::unique_ptr<u8[]> buf(new u8[chunk.shdr.sh_size]);
-  chunk.write_to(ctx, buf.get());
-
-  contents.reset(new ZlibCompressor({(char *)buf.get(), chunk.shdr.sh_size}));
+  contents = compress_chunk(ctx, chunk, false);
 
   this->shdr = chunk.shdr;
   this->shdr.sh_size = HEADER_SIZE + contents->size();
@@ -1838,6 +2082,7 @@ void ReproSection<E>::copy_buf(Context<E> &ctx) {
   template class PltGotSection<E>;                              \
   template class RelPltSection<E>;                              \
   template class RelDynSection<E>;                              \
+  template class RelrDynSection<E>;                             \
   template class StrtabSection<E>;                              \
   template class ShstrtabSection<E>;                            \
   template class DynstrSection<E>;                              \
@@ -1,9 +1,17 @@
 #include "mold.h"
 
+#include <condition_variable>
+#include <deque>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <tbb/parallel_for.h>
+#include <thread>
+
+#if defined(__linux__) && !defined(MADV_POPULATE_WRITE)
+#  define MADV_POPULATE_WRITE 23
+#endif
 
 namespace mold::elf {
 
@@ -13,45 +21,96 @@ inline u32 get_umask() {
   return orig_umask;
 }
 
+// Creates a temporary file next to a given path and returns its file
+// descriptor. The temporary file is renamed to the given path when the
+// output file is closed.
 template <typename E>
-class MemoryMappedOutputFile : public OutputFile<E> {
-public:
-  MemoryMappedOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm)
-    : OutputFile<E>(path, filesize, true) {
-    std::string dir(path_dirname(path));
-    output_tmpfile = (char *)save_string(ctx, dir + "/.mold-XXXXXX").data();
-    i64 fd = mkstemp(output_tmpfile);
-    if (fd == -1)
-      Fatal(ctx) << "cannot open " << output_tmpfile <<  ": " << errno_string();
-
-    if (rename(path.c_str(), output_tmpfile) == 0) {
-      ::close(fd);
+static i64 open_output_file(Context<E> &ctx, std::string path, i64 filesize,
+                            i64 perm) {
+  std::string dir(path_dirname(path));
+  output_tmpfile = (char *)save_string(ctx, dir + "/.mold-XXXXXX").data();
+  i64 fd = mkstemp(output_tmpfile);
+  if (fd == -1)
+    Fatal(ctx) << "cannot open " << output_tmpfile <<  ": " << errno_string();
+
+  if (rename(path.c_str(), output_tmpfile) == 0) {
+    ::close(fd);
+    fd = ::open(output_tmpfile, O_RDWR | O_CREAT, perm);
+    if (fd == -1) {
+      if (errno != ETXTBSY)
+        Fatal(ctx) << "cannot open " << path << ": " << errno_string();
+      unlink(output_tmpfile);
       fd = ::open(output_tmpfile, O_RDWR | O_CREAT, perm);
-      if (fd == -1) {
-        if (errno != ETXTBSY)
-          Fatal(ctx) << "cannot open " << path << ": " << errno_string();
-        unlink(output_tmpfile);
-        fd = ::open(output_tmpfile, O_RDWR | O_CREAT, perm);
-        if (fd == -1)
-          Fatal(ctx) << "cannot open " << path << ": " << errno_string();
-      }
+      if (fd == -1)
+        Fatal(ctx) << "cannot open " << path << ": " << errno_string();
     }
+  }
 
-    if (ftruncate(fd, filesize))
-      Fatal(ctx) << "ftruncate failed";
+  if (ftruncate(fd, filesize))
+    Fatal(ctx) << "ftruncate failed";
 
-    if (fchmod(fd, (perm & ~get_umask())) == -1)
-      Fatal(ctx) << "fchmod failed";
+  if (fchmod(fd, (perm & ~get_umask())) == -1)
+    Fatal(ctx) << "fchmod failed";
+
+  // Allocating all blocks at once is much cheaper than allocating them
+  // one page at a time on page faults. This is just a hint, so errors
+  // are ignored.
+#ifdef __linux__
+  if (ctx.arg.preallocate)
+    fallocate(fd, 0, 0, filesize);
+#endif
+  return fd;
+}
+
+// Transparent huge pages reduce the number of page faults on a large
+// anonymous output buffer.
+template <typename E>
+static void use_huge_pages(Context<E> &ctx, u8 *buf, i64 size) {
+#ifdef MADV_HUGEPAGE
+  if (ctx.arg.preallocate)
+    madvise(buf, size, MADV_HUGEPAGE);
+#endif
+}
+
+template <typename E>
+class MemoryMappedOutputFile : public OutputFile<E> {
+public:
+  MemoryMappedOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm)
+    : OutputFile<E>(path, filesize, true) {
+    i64 fd = open_output_file(ctx, path, filesize, perm);
 
     this->buf = (u8 *)mmap(nullptr, filesize, PROT_READ | PROT_WRITE,
                            MAP_SHARED, fd, 0);
     if (this->buf == MAP_FAILED)
       Fatal(ctx) << path << ": mmap failed: " << errno_string();
     ::close(fd);
+
+    // Prefault the output buffer in background, so that copy_buf
+    // threads don't have to take page faults. This is no-op if the
+    // kernel doesn't support MADV_POPULATE_WRITE (Linux 5.14 or later).
+#ifdef __linux__
+    if (ctx.arg.preallocate)
+      prefault_thread = std::thread([this] {
+        madvise(this->buf, this->filesize, MADV_POPULATE_WRITE);
+      });
+#endif
+  }
+
+  ~MemoryMappedOutputFile() {
+    if (prefault_thread.joinable())
+      prefault_thread.join();
+  }
+
+  // The output buffer may be partially unmapped after this point,
+  // so we need to wait for the prefault thread.
+  void finish_copy(Context<E> &ctx) override {
+    if (prefault_thread.joinable())
+      prefault_thread.join();
   }
 
   void close(Context<E> &ctx) override {
     Timer t(ctx, "close_file");
+    finish_copy(ctx);
 
     if (!this->is_unmapped)
       munmap(this->buf, this->filesize);
@@ -60,41 +119,416 @@ public:
       Fatal(ctx) << this->path << ": rename failed: " << errno_string();
     output_tmpfile = nullptr;
   }
+
+private:
+  std::thread prefault_thread;
 };
 
+// StreamingOutputFile is used if the output is not a regular file
+// (e.g. `-o -` or a named pipe). Since we can't mmap such file, we
+// copy chunks to an anonymous memory region first and write them out
+// in file offset order as soon as they become final. Written pages are
+// returned to the kernel, so we don't keep the entire output in memory.
 template <typename E>
-class MallocOutputFile : public OutputFile<E> {
+class StreamingOutputFile : public OutputFile<E> {
 public:
-  MallocOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm)
-    : OutputFile<E>(path, filesize, false), perm(perm) {
+  StreamingOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm)
+    : OutputFile<E>(path, filesize, false) {
+    this->is_streaming = true;
+
     this->buf = (u8 *)mmap(NULL, filesize, PROT_READ | PROT_WRITE,
-                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (this->buf == MAP_FAILED)
       Fatal(ctx) << "mmap failed: " << errno_string();
+    use_huge_pages(ctx, this->buf, filesize);
+
+    if (path == "-") {
+      fd = STDOUT_FILENO;
+    } else {
+      fd = ::open(path.c_str(), O_WRONLY | O_CREAT, perm);
+      if (fd == -1)
+        Fatal(ctx) << "cannot open " << path << ": " << errno_string();
+    }
+
+    for (Chunk<E> *chunk : ctx.chunks)
+      chunks.push_back(chunk);
+
+    sort(chunks, [](Chunk<E> *a, Chunk<E> *b) {
+      return a->shdr.sh_offset < b->shdr.sh_offset;
+    });
+
+    for (i64 i = 0; i < chunks.size(); i++)
+      chunk_idx[chunks[i]] = i;
+    is_final.resize(chunks.size());
+  }
+
+  void finalize_chunk(Context<E> &ctx, Chunk<E> *chunk) override {
+    std::unique_lock lock(mu);
+    is_final[chunk_idx[chunk]] = true;
+
+    // Only one thread writes to the file at a time. Other threads
+    // just mark their chunks as final and go back to work.
+    if (is_writing)
+      return;
+    is_writing = true;
+
+    for (;;) {
+      while (num_final < chunks.size() && is_final[num_final])
+        num_final++;
+
+      i64 end = this->filesize;
+      if (num_final < chunks.size())
+        end = chunks[num_final]->shdr.sh_offset;
+      if (end <= written)
+        break;
+
+      i64 begin = written;
+      lock.unlock();
+      write_range(ctx, begin, end);
+      lock.lock();
+      written = end;
+    }
+
+    is_writing = false;
   }
 
   void close(Context<E> &ctx) override {
     Timer t(ctx, "close_file");
+    write_range(ctx, written, this->filesize);
+    ::close(fd);
+  }
 
-    if (this->path == "-") {
-      fwrite(this->buf, this->filesize, 1, stdout);
-      fclose(stdout);
-      return;
+private:
+  void write_range(Context<E> &ctx, i64 begin, i64 end) {
+    for (i64 pos = begin; pos < end;) {
+      i64 n = ::write(fd, this->buf + pos, end - pos);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        Fatal(ctx) << this->path << ": write failed: " << errno_string();
+      }
+      pos += n;
+    }
+
+    i64 page_size = sysconf(_SC_PAGESIZE);
+    i64 lo = align_to(begin, page_size);
+    i64 hi = align_down(end, page_size);
+    if (lo < hi)
+      madvise(this->buf + lo, hi - lo, MADV_DONTNEED);
+  }
+
+  i64 fd = -1;
+  std::mutex mu;
+  std::vector<Chunk<E> *> chunks;
+  std::unordered_map<Chunk<E> *, i64> chunk_idx;
+  std::vector<bool> is_final;
+  i64 num_final = 0;
+  i64 written = 0;
+  bool is_writing = false;
+};
+
+// AsyncOutputFile is used if --async-write is given. Chunks are copied
+// to an anonymous memory region, and a background thread writes each
+// chunk to the output file with pwrite(2) as soon as it becomes final.
+// That overlaps disk writes with the computation of other chunks and
+// avoids page faults on a shared file mapping, which are expensive on
+// some network or overlay filesystems.
+template <typename E>
+class AsyncOutputFile : public OutputFile<E> {
+public:
+  AsyncOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm)
+    : OutputFile<E>(path, filesize, false) {
+    this->is_streaming = true;
+    fd = open_output_file(ctx, path, filesize, perm);
+
+    // O_DIRECT is not supported by all filesystems. If we can't open
+    // the file with O_DIRECT, we simply use the page cache.
+#ifdef O_DIRECT
+    if (ctx.arg.direct_io)
+      direct_fd = ::open(output_tmpfile, O_WRONLY | O_DIRECT);
+#endif
+
+    this->buf = (u8 *)mmap(NULL, filesize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (this->buf == MAP_FAILED)
+      Fatal(ctx) << "mmap failed: " << errno_string();
+    use_huge_pages(ctx, this->buf, filesize);
+
+    thread = std::thread([this, &ctx] { run(ctx); });
+  }
+
+  ~AsyncOutputFile() {
+    if (thread.joinable())
+      stop();
+  }
+
+  void finalize_chunk(Context<E> &ctx, Chunk<E> *chunk) override {
+    {
+      std::scoped_lock lock(mu);
+      queue.push_back(chunk);
+    }
+    cond.notify_one();
+  }
+
+  void close(Context<E> &ctx) override {
+    Timer t(ctx, "close_file");
+    stop();
+
+    // Write regions that haven't been written in background, i.e.
+    // paddings between chunks and chunks that were never finalized.
+    sort(written);
+
+    i64 pos = 0;
+    for (std::pair<i64, i64> range : written) {
+      write_range(ctx, fd, pos, range.first);
+      pos = std::max(pos, range.second);
+    }
+    write_range(ctx, fd, pos, this->filesize);
+
+    if (direct_fd != -1)
+      ::close(direct_fd);
+    ::close(fd);
+    munmap(this->buf, this->filesize);
+
+    if (rename(output_tmpfile, this->path.c_str()) == -1)
+      Fatal(ctx) << this->path << ": rename failed: " << errno_string();
+    output_tmpfile = nullptr;
+  }
+
+private:
+  void stop() {
+    {
+      std::scoped_lock lock(mu);
+      is_done = true;
+    }
+    cond.notify_one();
+    thread.join();
+    if (timer)
+      timer->stop();
+  }
+
+  void run(Context<E> &ctx) {
+    for (;;) {
+      Chunk<E> *chunk;
+      {
+        std::unique_lock lock(mu);
+        cond.wait(lock, [&] { return !queue.empty() || is_done; });
+        if (queue.empty())
+          return;
+        chunk = queue.front();
+        queue.pop_front();
+      }
+
+      // This timer runs in parallel with the main thread's timers. The
+      // part that doesn't overlap with "close_file" is the write time
+      // hidden behind computation.
+      if (!timer)
+        timer.reset(new Timer<Context<E>>(ctx, "async_write"));
+
+      if (chunk->shdr.sh_type != SHT_NOBITS && chunk->shdr.sh_size)
+        write_chunk(ctx, *chunk);
+    }
+  }
+
+  void write_chunk(Context<E> &ctx, Chunk<E> &chunk) {
+    std::string name(chunk.name);
+    if (name.empty())
+      name = "(header)";
+    Timer t(ctx, name, timer.get());
+
+    i64 begin = chunk.shdr.sh_offset;
+    i64 end = begin + chunk.shdr.sh_size;
+    written.push_back({begin, end});
+
+    // Interior pages are not shared with other chunks, so we can
+    // release them once they are written.
+    i64 page_size = sysconf(_SC_PAGESIZE);
+    i64 lo = align_to(begin, page_size);
+    i64 hi = align_down(end, page_size);
+
+    // Large non-allocated sections such as debug info are unlikely to
+    // be read back soon, so we optionally bypass the page cache for them.
+    if (direct_fd != -1 && !(chunk.shdr.sh_flags & SHF_ALLOC) &&
+        hi - lo >= 1024 * 1024) {
+      write_range(ctx, fd, begin, lo);
+      if (!write_range(ctx, direct_fd, lo, hi))
+        write_range(ctx, fd, lo, hi);
+      write_range(ctx, fd, hi, end);
+    } else {
+      write_range(ctx, fd, begin, end);
     }
 
-    i64 fd = ::open(this->path.c_str(), O_RDWR | O_CREAT, perm);
-    if (fd == -1)
-      Fatal(ctx) << "cannot open " << this->path << ": " << errno_string();
+    if (lo < hi)
+      madvise(this->buf + lo, hi - lo, MADV_DONTNEED);
+  }
+
+  // Returns false if O_DIRECT write is rejected.
+  bool write_range(Context<E> &ctx, i64 fd, i64 begin, i64 end) {
+    for (i64 pos = begin; pos < end;) {
+      i64 n = pwrite(fd, this->buf + pos, end - pos, pos);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EINVAL && fd == direct_fd)
+          return false;
+        Fatal(ctx) << this->path << ": write failed: " << errno_string();
+      }
+      pos += n;
+    }
+    return true;
+  }
+
+  i64 fd = -1;
+  i64 direct_fd = -1;
+  std::unique_ptr<Timer<Context<E>>> timer;
+  std::thread thread;
+  std::mutex mu;
+  std::condition_variable cond;
+  std::deque<Chunk<E> *> queue;
+  std::vector<std::pair<i64, i64>> written;
+  bool is_done = false;
+};
+
+// Moves an existing output file to a temporary file next to it while
+// we are updating it, so that no one sees a partially-written file at
+// the output path. The temporary file is renamed back when closed.
+template <typename E>
+static void move_to_tmpfile(Context<E> &ctx, std::string path) {
+  std::string dir(path_dirname(path));
+  output_tmpfile = (char *)save_string(ctx, dir + "/.mold-XXXXXX").data();
+  i64 tmpfd = mkstemp(output_tmpfile);
+  if (tmpfd == -1)
+    Fatal(ctx) << "cannot open " << output_tmpfile <<  ": " << errno_string();
+  ::close(tmpfd);
+
+  if (rename(path.c_str(), output_tmpfile) == -1)
+    Fatal(ctx) << path << ": rename failed: " << errno_string();
+}
+
+// ReusedOutputFile is used if --reuse-output is given and the existing
+// output file can be overwritten in place. We copy chunks to an
+// anonymous buffer and then write only the blocks that differ from the
+// existing file. If a large output file is relinked with small changes,
+// most of the file is neither rewritten to disk nor evicted from the
+// page cache.
+template <typename E>
+class ReusedOutputFile : public OutputFile<E> {
+public:
+  ReusedOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm,
+                   i64 fd)
+    : OutputFile<E>(path, filesize, false), fd(fd) {
+    move_to_tmpfile(ctx, path);
+
+    if (ftruncate(fd, filesize))
+      Fatal(ctx) << "ftruncate failed";
+
+    if (fchmod(fd, (perm & ~get_umask())) == -1)
+      Fatal(ctx) << "fchmod failed";
+
+    old_buf = (u8 *)mmap(nullptr, filesize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    if (old_buf == MAP_FAILED)
+      Fatal(ctx) << path << ": mmap failed: " << errno_string();
 
-    FILE *fp = fdopen(fd, "w");
-    fwrite(this->buf, this->filesize, 1, fp);
-    fclose(fp);
+    this->buf = (u8 *)mmap(NULL, filesize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (this->buf == MAP_FAILED)
+      Fatal(ctx) << "mmap failed: " << errno_string();
+    use_huge_pages(ctx, this->buf, filesize);
+  }
+
+  void close(Context<E> &ctx) override {
+    Timer t(ctx, "close_file");
+    static Counter unchanged("reused_output_bytes");
+    static Counter rewritten("rewritten_output_bytes");
+
+    // Comparing is much cheaper than writing, as writing dirties pages.
+    i64 block_size = 64 * 1024;
+    i64 num_blocks = align_to(this->filesize, block_size) / block_size;
+
+    tbb::parallel_for((i64)0, num_blocks, [&](i64 i) {
+      i64 offset = i * block_size;
+      i64 size = std::min(block_size, this->filesize - offset);
+
+      if (memcmp(this->buf + offset, old_buf + offset, size)) {
+        memcpy(old_buf + offset, this->buf + offset, size);
+        rewritten += size;
+      } else {
+        unchanged += size;
+      }
+    });
+
+    munmap(this->buf, this->filesize);
+    munmap(old_buf, this->filesize);
+
+    // Build systems compare timestamps, so update it even if nothing
+    // has changed.
+    futimens(fd, nullptr);
+    ::close(fd);
+
+    if (rename(output_tmpfile, this->path.c_str()) == -1)
+      Fatal(ctx) << this->path << ": rename failed: " << errno_string();
+    output_tmpfile = nullptr;
   }
 
 private:
-  i64 perm;
+  i64 fd;
+  u8 *old_buf = nullptr;
 };
 
+// PatchedOutputFile is used if --incremental can update the previous
+// output file in place. Unlike ReusedOutputFile, the output buffer is
+// a shared mapping of the existing file, so the contents of input
+// sections that we don't rewrite are left as they are.
+template <typename E>
+class PatchedOutputFile : public OutputFile<E> {
+public:
+  PatchedOutputFile(Context<E> &ctx, std::string path, i64 filesize, i64 perm,
+                    i64 fd)
+    : OutputFile<E>(path, filesize, true), fd(fd) {
+    move_to_tmpfile(ctx, path);
+
+    if (ftruncate(fd, filesize))
+      Fatal(ctx) << "ftruncate failed";
+
+    if (fchmod(fd, (perm & ~get_umask())) == -1)
+      Fatal(ctx) << "fchmod failed";
+
+    this->buf = (u8 *)mmap(nullptr, filesize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+    if (this->buf == MAP_FAILED)
+      Fatal(ctx) << path << ": mmap failed: " << errno_string();
+  }
+
+  void close(Context<E> &ctx) override {
+    Timer t(ctx, "close_file");
+
+    if (!this->is_unmapped)
+      munmap(this->buf, this->filesize);
+
+    futimens(fd, nullptr);
+    ::close(fd);
+
+    if (rename(output_tmpfile, this->path.c_str()) == -1)
+      Fatal(ctx) << this->path << ": rename failed: " << errno_string();
+    output_tmpfile = nullptr;
+  }
+
+private:
+  i64 fd;
+};
+
+// Returns a file descriptor of an existing output file if we can
+// overwrite it in place, or -1 otherwise. An executable that is
+// running cannot be opened for writing (ETXTBSY).
+static i64 open_reusable_file(std::string path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1 || (st.st_mode & S_IFMT) != S_IFREG ||
+      st.st_uid != geteuid() || st.st_nlink != 1)
+    return -1;
+  return ::open(path.c_str(), O_RDWR);
+}
+
 template <typename E>
 std::unique_ptr<OutputFile<E>>
 OutputFile<E>::open(Context<E> &ctx, std::string path, i64 filesize, i64 perm) {
@@ -112,9 +546,26 @@ OutputFile<E>::open(Context<E> &ctx, std::string path, i64 filesize, i64 perm) {
       is_special = true;
   }
 
+  bool can_patch = ctx.incremental && ctx.incremental->can_patch;
+
+  i64 fd = -1;
+  if (!is_special && (ctx.arg.reuse_output || can_patch))
+    fd = open_reusable_file(path);
+
+  // If we can't open the existing file for writing, we fall back to
+  // writing a new file from scratch.
+  if (ctx.incremental && fd == -1)
+    ctx.incremental->can_patch = can_patch = false;
+
   std::unique_ptr<OutputFile<E>> file;
   if (is_special)
-    file = std::make_unique<MallocOutputFile<E>>(ctx, path, filesize, perm);
+    file = std::make_unique<StreamingOutputFile<E>>(ctx, path, filesize, perm);
+  else if (can_patch)
+    file = std::make_unique<PatchedOutputFile<E>>(ctx, path, filesize, perm, fd);
+  else if (fd != -1)
+    file = std::make_unique<ReusedOutputFile<E>>(ctx, path, filesize, perm, fd);
+  else if (ctx.arg.async_write)
+    file = std::make_unique<AsyncOutputFile<E>>(ctx, path, filesize, perm);
   else
     file = std::make_unique<MemoryMappedOutputFile<E>>(ctx, path, filesize, perm);
 
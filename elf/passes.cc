@@ -4,6 +4,7 @@
 #include <map>
 #include <regex>
 #include <tbb/parallel_for_each.h>
+#include <tbb/parallel_reduce.h>
 #include <tbb/parallel_scan.h>
 #include <tbb/partitioner.h>
 #include <unordered_set>
@@ -39,6 +40,8 @@ void create_synthetic_sections(Context<E> &ctx) {
   add(ctx.got = std::make_unique<GotSection<E>>());
   add(ctx.gotplt = std::make_unique<GotPltSection<E>>());
   add(ctx.reldyn = std::make_unique<RelDynSection<E>>());
+  if (ctx.arg.pic && ctx.arg.z_pack_relative_relocs)
+    add(ctx.relrdyn = std::make_unique<RelrDynSection<E>>());
   add(ctx.relplt = std::make_unique<RelPltSection<E>>());
   add(ctx.strtab = std::make_unique<StrtabSection<E>>());
   add(ctx.shstrtab = std::make_unique<ShstrtabSection<E>>());
@@ -71,6 +74,8 @@ void create_synthetic_sections(Context<E> &ctx) {
 
   if (ctx.arg.repro)
     add(ctx.repro = std::make_unique<ReproSection<E>>());
+  if (ctx.arg.gdb_index && !ctx.arg.strip_all && !ctx.arg.strip_debug)
+    add(ctx.gdb_index = std::make_unique<GdbIndexSection<E>>());
 }
 
 template <typename E>
@@ -109,6 +114,9 @@ void resolve_symbols(Context<E> &ctx) {
   tbb::parallel_for_each(live_objs,
                          [&](ObjectFile<E> *file,
                              tbb::feeder<ObjectFile<E> *> &feeder) {
+    // Archive members are parsed only when they become alive.
+    if (!file->is_parsed)
+      file->parse(ctx);
     file->mark_live_objects(ctx, [&](ObjectFile<E> *obj) { feeder.add(obj); });
   });
 
@@ -124,12 +132,12 @@ void resolve_symbols(Context<E> &ctx) {
   erase(ctx.objs, [](InputFile<E> *file) { return !file->is_alive; });
 
   // Mark live DSOs
-  tbb::parallel_for_each(ctx.objs, [](ObjectFile<E> *file) {
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
     for (i64 i = file->first_global; i < file->elf_syms.size(); i++) {
       const ElfSym<E> &esym = file->elf_syms[i];
       Symbol<E> &sym = *file->symbols[i];
       if (esym.is_undef_strong() && sym.file && sym.file->is_dso) {
-        std::lock_guard lock(sym.mu);
+        std::lock_guard lock(sym.get_mutex(ctx));
         sym.file->is_alive = true;
         sym.is_weak = false;
       }
@@ -521,71 +529,231 @@ void scan_rels(Context<E> &ctx) {
     for (Symbol<E> *sym : files[i]->symbols) {
       if (!files[i]->is_dso && (sym->is_imported || sym->is_exported))
         sym->flags |= NEEDS_DYNSYM;
-      if (sym->file == files[i] && sym->flags)
+
+      // A file's symbol list may contain the same symbol more than
+      // once. We use aux_idx to visit each symbol only once.
+      if (sym->file == files[i] && sym->flags && sym->aux_idx == -1) {
+        sym->aux_idx = 0;
         vec[i].push_back(sym);
+      }
     }
   });
 
   std::vector<Symbol<E> *> syms = flatten(vec);
 
   ctx.symbol_aux.resize(syms.size());
-  for (i64 i = 0; i < syms.size(); i++)
+  tbb::parallel_for((i64)0, (i64)syms.size(), [&](i64 i) {
     syms[i]->aux_idx = i;
+  });
 
   // Assign offsets in additional tables for each dynamic symbol.
-  for (Symbol<E> *sym : syms) {
-    if (sym->flags & NEEDS_DYNSYM)
-      ctx.dynsym->add_symbol(ctx, sym);
-
-    if (sym->flags & NEEDS_GOT)
-      ctx.got->add_got_symbol(ctx, sym);
-
-    if (sym->flags & NEEDS_PLT) {
-      if (sym->flags & NEEDS_GOT) {
-        // If we need to create a canonical PLT, we can't use .plt.got
-        // because otherwise .plt.got and .got would refer each other,
-        // resulting in an infinite loop at runtime.
-        if (!ctx.arg.pic && sym->is_imported)
-          ctx.plt->add_symbol(ctx, sym);
-        else
-          ctx.pltgot->add_symbol(ctx, sym);
-      } else {
-        ctx.plt->add_symbol(ctx, sym);
+  //
+  // A symbol's index in a table is determined by the number of slots
+  // that the preceding symbols need in the same table. We compute them
+  // with a parallel prefix sum over the symbol list, so that each symbol
+  // can be added to tables independently while the contents of the
+  // tables stay in the same deterministic order.
+
+  // If we need to create a canonical PLT, we can't use .plt.got because
+  // otherwise .plt.got and .got would refer each other, resulting in an
+  // infinite loop at runtime.
+  auto uses_pltgot = [&](Symbol<E> *sym) {
+    return (sym->flags & NEEDS_GOT) && (ctx.arg.pic || !sym->is_imported);
+  };
+
+  // A .plt.got entry doesn't need a dynamic symbol by itself because it
+  // jumps to the address in .got.
+  auto needs_dynsym = [&](Symbol<E> *sym) {
+    u8 flags = sym->flags;
+    return (flags & (NEEDS_DYNSYM | NEEDS_TLSGD | NEEDS_TLSDESC |
+                     NEEDS_COPYREL)) ||
+           ((flags & NEEDS_PLT) && !uses_pltgot(sym)) ||
+           ((flags & (NEEDS_GOT | NEEDS_GOTTP)) && sym->is_imported);
+  };
+
+  struct T {
+    i64 dynsym = 0;
+    i64 got = 0;
+    i64 got_syms = 0;
+    i64 gottp_syms = 0;
+    i64 tlsgd_syms = 0;
+    i64 tlsdesc_syms = 0;
+    i64 plt_syms = 0;
+    i64 pltgot_syms = 0;
+    i64 copyrel_syms = 0;
+    bool tlsld = false;
+  };
+
+  std::vector<Symbol<E> *> copyrel_syms;
+
+  auto scan = [&](const tbb::blocked_range<i64> &r, T sum, bool is_final) {
+    for (i64 i = r.begin(); i < r.end(); i++) {
+      Symbol<E> *sym = syms[i];
+      u8 flags = sym->flags;
+
+      if (needs_dynsym(sym)) {
+        if (is_final) {
+          sym->set_dynsym_idx(ctx, -2);
+          ctx.dynsym->symbols[sum.dynsym + 1] = sym;
+        }
+        sum.dynsym++;
       }
-    }
 
-    if (sym->flags & NEEDS_GOTTP)
-      ctx.got->add_gottp_symbol(ctx, sym);
+      if (flags & NEEDS_GOT) {
+        if (is_final) {
+          sym->set_got_idx(ctx, sum.got);
+          ctx.got->got_syms[sum.got_syms] = sym;
+        }
+        sum.got++;
+        sum.got_syms++;
+      }
 
-    if (sym->flags & NEEDS_TLSGD)
-      ctx.got->add_tlsgd_symbol(ctx, sym);
+      if (flags & NEEDS_PLT) {
+        if (uses_pltgot(sym)) {
+          if (is_final) {
+            sym->set_pltgot_idx(ctx, sum.pltgot_syms);
+            ctx.pltgot->symbols[sum.pltgot_syms] = sym;
+          }
+          sum.pltgot_syms++;
+        } else {
+          if (is_final) {
+            // .got.plt begins with three reserved words.
+            sym->set_plt_idx(ctx, E::plt_hdr_size / E::plt_size + sum.plt_syms);
+            sym->set_gotplt_idx(ctx, 3 + sum.plt_syms);
+            ctx.plt->symbols[sum.plt_syms] = sym;
+          }
+          sum.plt_syms++;
+        }
+      }
 
-    if (sym->flags & NEEDS_TLSDESC)
-      ctx.got->add_tlsdesc_symbol(ctx, sym);
+      if (flags & NEEDS_GOTTP) {
+        if (is_final) {
+          sym->set_gottp_idx(ctx, sum.got);
+          ctx.got->gottp_syms[sum.gottp_syms] = sym;
+        }
+        sum.got++;
+        sum.gottp_syms++;
+      }
 
-    if (sym->flags & NEEDS_TLSLD)
-      ctx.got->add_tlsld(ctx);
+      if (flags & NEEDS_TLSGD) {
+        if (is_final) {
+          sym->set_tlsgd_idx(ctx, sum.got);
+          ctx.got->tlsgd_syms[sum.tlsgd_syms] = sym;
+        }
+        sum.got += 2;
+        sum.tlsgd_syms++;
+      }
 
-    if (sym->flags & NEEDS_COPYREL) {
-      assert(sym->file->is_dso);
-      SharedFile<E> *file = (SharedFile<E> *)sym->file;
-      sym->copyrel_readonly = file->is_readonly(ctx, sym);
+      if (flags & NEEDS_TLSDESC) {
+        if (is_final) {
+          sym->set_tlsdesc_idx(ctx, sum.got);
+          ctx.got->tlsdesc_syms[sum.tlsdesc_syms] = sym;
+        }
+        sum.got += 2;
+        sum.tlsdesc_syms++;
+      }
 
-      if (sym->copyrel_readonly)
-        ctx.dynbss_relro->add_symbol(ctx, sym);
-      else
-        ctx.dynbss->add_symbol(ctx, sym);
+      // There's only one TLSLD slot, which is allocated for the first
+      // symbol that needs it.
+      if ((flags & NEEDS_TLSLD) && !sum.tlsld) {
+        if (is_final)
+          ctx.got->tlsld_idx = sum.got;
+        sum.got += 2;
+        sum.tlsld = true;
+      }
 
-      for (Symbol<E> *alias : file->find_aliases(sym)) {
-        alias->has_copyrel = true;
-        alias->value = sym->value;
-        alias->copyrel_readonly = sym->copyrel_readonly;
-        ctx.dynsym->add_symbol(ctx, alias);
+      if (flags & NEEDS_COPYREL) {
+        if (is_final)
+          copyrel_syms[sum.copyrel_syms] = sym;
+        sum.copyrel_syms++;
       }
     }
+    return sum;
+  };
+
+  auto combine = [](const T &x, const T &y) {
+    T sum;
+    sum.dynsym = x.dynsym + y.dynsym;
+    sum.got = x.got + y.got;
+    sum.got_syms = x.got_syms + y.got_syms;
+    sum.gottp_syms = x.gottp_syms + y.gottp_syms;
+    sum.tlsgd_syms = x.tlsgd_syms + y.tlsgd_syms;
+    sum.tlsdesc_syms = x.tlsdesc_syms + y.tlsdesc_syms;
+    sum.plt_syms = x.plt_syms + y.plt_syms;
+    sum.pltgot_syms = x.pltgot_syms + y.pltgot_syms;
+    sum.copyrel_syms = x.copyrel_syms + y.copyrel_syms;
+    sum.tlsld = x.tlsld || y.tlsld;
+
+    // If both halves allocated a TLSLD slot, the right one is a duplicate.
+    if (x.tlsld && y.tlsld)
+      sum.got -= 2;
+    return sum;
+  };
 
-    sym->flags = 0;
+  tbb::blocked_range<i64> range(0, syms.size(), 10000);
+
+  // Count the number of slots first to size the tables.
+  T total = tbb::parallel_reduce(range, T(),
+    [&](const tbb::blocked_range<i64> &r, T sum) {
+      return scan(r, sum, false);
+    },
+    combine);
+
+  ctx.dynsym->symbols.resize(total.dynsym + 1);
+  ctx.got->got_syms.resize(total.got_syms);
+  ctx.got->gottp_syms.resize(total.gottp_syms);
+  ctx.got->tlsgd_syms.resize(total.tlsgd_syms);
+  ctx.got->tlsdesc_syms.resize(total.tlsdesc_syms);
+  ctx.plt->symbols.resize(total.plt_syms);
+  ctx.pltgot->symbols.resize(total.pltgot_syms);
+  copyrel_syms.resize(total.copyrel_syms);
+
+  // Then fill them.
+  tbb::parallel_scan(range, T(), scan, combine, tbb::simple_partitioner());
+
+  ctx.got->shdr.sh_size = total.got * E::word_size;
+  ctx.pltgot->shdr.sh_size = total.pltgot_syms * E::pltgot_size;
+
+  if (total.plt_syms) {
+    ctx.plt->shdr.sh_size = E::plt_hdr_size + total.plt_syms * E::plt_size;
+    ctx.gotplt->shdr.sh_size = (3 + total.plt_syms) * E::word_size;
+    ctx.relplt->shdr.sh_size = total.plt_syms * sizeof(ElfRel<E>);
   }
+
+  // Copy relocations are rare, so we handle them serially.
+  for (Symbol<E> *sym : copyrel_syms) {
+    assert(sym->file->is_dso);
+    SharedFile<E> *file = (SharedFile<E> *)sym->file;
+    sym->copyrel_readonly = file->is_readonly(ctx, sym);
+
+    if (sym->copyrel_readonly)
+      ctx.dynbss_relro->add_symbol(ctx, sym);
+    else
+      ctx.dynbss->add_symbol(ctx, sym);
+
+    // Aliases have NEEDS_DYNSYM, so they are already in .dynsym.
+    for (Symbol<E> *alias : file->find_aliases(sym)) {
+      alias->has_copyrel = true;
+      alias->value = sym->value;
+      alias->copyrel_readonly = sym->copyrel_readonly;
+    }
+  }
+
+  tbb::parallel_for((i64)0, (i64)syms.size(), [&](i64 i) {
+    syms[i]->flags = 0;
+  });
+}
+
+template <typename E>
+void construct_relr(Context<E> &ctx) {
+  Timer t(ctx, "construct_relr");
+
+  tbb::parallel_for_each(ctx.output_sections,
+                         [&](std::unique_ptr<OutputSection<E>> &osec) {
+    osec->construct_relr(ctx);
+  });
+
+  ctx.got->construct_relr(ctx);
 }
 
 template <typename E>
@@ -698,9 +866,10 @@ void compute_import_export(Context<E> &ctx) {
   if (!ctx.arg.shared) {
     tbb::parallel_for_each(ctx.dsos, [&](SharedFile<E> *file) {
       for (Symbol<E> *sym : file->globals) {
-        if (sym->file && !sym->file->is_dso && sym->visibility != STV_HIDDEN) {
-          std::lock_guard lock(sym->mu);
-          sym->is_exported = true;
+        if (sym->file && !sym->file->is_dso) {
+          std::lock_guard lock(sym->get_mutex(ctx));
+          if (sym->visibility != STV_HIDDEN)
+            sym->is_exported = true;
         }
       }
     });
@@ -743,6 +912,84 @@ void clear_padding(Context<E> &ctx) {
   zero(ctx.chunks.back(), ctx.output_file->filesize);
 }
 
+// Copy the contents of chunks to the output file.
+template <typename E>
+void copy_chunks(Context<E> &ctx) {
+  Timer t(ctx, "copy_buf");
+
+  auto copy = [&](Chunk<E> *chunk) {
+    std::string name(chunk->name);
+    if (name.empty())
+      name = "(header)";
+    Timer t2(ctx, name, &t);
+
+    chunk->copy_buf(ctx);
+  };
+
+  // Build ID is computed over the entire output file, so we can't
+  // write out any part of the file before all chunks are copied.
+  if (!ctx.output_file->is_streaming || ctx.buildid) {
+    tbb::parallel_for_each(ctx.chunks, copy);
+    ctx.checkpoint();
+
+    // Dynamic linker works better with sorted .rela.dyn section,
+    // so we sort them.
+    ctx.reldyn->sort(ctx);
+    return;
+  }
+
+  // A streaming output file writes out chunks as soon as they become
+  // final. .rela.dyn is written by other allocated chunks, .dynamic is
+  // rewritten after sorting .rela.dyn, and .strtab is written by .symtab,
+  // so they are finalized only after their writers are done.
+  OutputFile<E> &out = *ctx.output_file;
+  std::vector<Chunk<E> *> alloc;
+  std::vector<Chunk<E> *> nonalloc;
+
+  for (Chunk<E> *chunk : ctx.chunks) {
+    if (chunk->shdr.sh_flags & SHF_ALLOC)
+      alloc.push_back(chunk);
+    else
+      nonalloc.push_back(chunk);
+  }
+
+  tbb::parallel_for_each(alloc, [&](Chunk<E> *chunk) {
+    copy(chunk);
+    if (chunk != ctx.reldyn.get() && chunk != ctx.dynamic.get())
+      out.finalize_chunk(ctx, chunk);
+  });
+
+  ctx.checkpoint();
+  ctx.reldyn->sort(ctx);
+  out.finalize_chunk(ctx, ctx.reldyn.get());
+  if (ctx.dynamic)
+    out.finalize_chunk(ctx, ctx.dynamic.get());
+
+  // Non-allocated sections such as debug info sections usually make up
+  // the most of a large output file. We copy them in windows of limited
+  // size so that we don't have to keep too much unwritten data in memory.
+  constexpr i64 window_size = 256 * 1024 * 1024;
+
+  for (i64 i = 0; i < nonalloc.size();) {
+    i64 size = nonalloc[i]->shdr.sh_size;
+    i64 j = i + 1;
+    while (j < nonalloc.size() && size + nonalloc[j]->shdr.sh_size <= window_size)
+      size += nonalloc[j++]->shdr.sh_size;
+
+    tbb::parallel_for_each(nonalloc.begin() + i, nonalloc.begin() + j,
+                           [&](Chunk<E> *chunk) {
+      copy(chunk);
+      if (chunk != ctx.strtab.get())
+        out.finalize_chunk(ctx, chunk);
+    });
+    i = j;
+  }
+
+  ctx.checkpoint();
+  if (ctx.strtab)
+    out.finalize_chunk(ctx, ctx.strtab.get());
+}
+
 // We want to sort output chunks in the following order.
 //
 //   ELF header
@@ -865,16 +1112,24 @@ static i64 get_num_irelative_relocs(Context<E> &ctx) {
 
 template <typename E>
 void fix_synthetic_symbols(Context<E> &ctx) {
-  auto start = [](Symbol<E> *sym, auto &chunk) {
+  // Linker-synthesized symbols are absolute symbols in the internal
+  // file by default. We set their section indices for .symtab.
+  auto set_shndx = [&](Symbol<E> *sym, i64 shndx) {
+    if (sym->file == ctx.internal_obj)
+      ctx.internal_obj->elf_syms[sym->sym_idx].st_shndx =
+        shndx ? shndx : SHN_ABS;
+  };
+
+  auto start = [&](Symbol<E> *sym, auto &chunk) {
     if (sym && chunk) {
-      sym->shndx = chunk->shndx;
+      set_shndx(sym, chunk->shndx);
       sym->value = chunk->shdr.sh_addr;
     }
   };
 
-  auto stop = [](Symbol<E> *sym, auto &chunk) {
+  auto stop = [&](Symbol<E> *sym, auto &chunk) {
     if (sym && chunk) {
-      sym->shndx = chunk->shndx;
+      set_shndx(sym, chunk->shndx);
       sym->value = chunk->shdr.sh_addr + chunk->shdr.sh_size;
     }
   };
@@ -890,10 +1145,10 @@ void fix_synthetic_symbols(Context<E> &ctx) {
   // __ehdr_start and __executable_start
   for (Chunk<E> *chunk : ctx.chunks) {
     if (chunk->shndx == 1) {
-      ctx.__ehdr_start->shndx = 1;
+      set_shndx(ctx.__ehdr_start, 1);
       ctx.__ehdr_start->value = ctx.ehdr->shdr.sh_addr;
 
-      ctx.__executable_start->shndx = 1;
+      set_shndx(ctx.__executable_start, 1);
       ctx.__executable_start->value = ctx.ehdr->shdr.sh_addr;
       break;
     }
@@ -903,7 +1158,7 @@ void fix_synthetic_symbols(Context<E> &ctx) {
   start(ctx.__rel_iplt_start, ctx.reldyn);
 
   // __rel_iplt_end
-  ctx.__rel_iplt_end->shndx = ctx.reldyn->shndx;
+  set_shndx(ctx.__rel_iplt_end, ctx.reldyn->shndx);
   ctx.__rel_iplt_end->value = ctx.reldyn->shdr.sh_addr +
     get_num_irelative_relocs(ctx) * sizeof(ElfRel<E>);
 
@@ -971,6 +1226,17 @@ void fix_synthetic_symbols(Context<E> &ctx) {
   }
 }
 
+template <typename E>
+void pre_resolve_relocs(Context<E> &ctx) {
+  Timer t(ctx, "pre_resolve_relocs");
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    for (std::unique_ptr<InputSection<E>> &isec : file->sections)
+      if (isec && isec->is_alive && (isec->shdr.sh_flags & SHF_ALLOC))
+        isec->pre_resolve_relocs(ctx);
+  });
+}
+
 template <typename E>
 void compress_debug_sections(Context<E> &ctx) {
   Timer t(ctx, "compress_debug_sections");
@@ -983,7 +1249,8 @@ void compress_debug_sections(Context<E> &ctx) {
       return;
 
     Chunk<E> *comp = nullptr;
-    if (ctx.arg.compress_debug_sections == COMPRESS_GABI)
+    if (ctx.arg.compress_debug_sections == COMPRESS_GABI ||
+        ctx.arg.compress_debug_sections == COMPRESS_ZSTD)
       comp = new GabiCompressedSection<E>(ctx, chunk);
     else if (ctx.arg.compress_debug_sections == COMPRESS_GNU)
       comp = new GnuCompressedSection<E>(ctx, chunk);
@@ -1013,13 +1280,16 @@ void compress_debug_sections(Context<E> &ctx) {
   template void compute_section_sizes(Context<E> &ctx);                 \
   template void claim_unresolved_symbols(Context<E> &ctx);              \
   template void scan_rels(Context<E> &ctx);                             \
+  template void construct_relr(Context<E> &ctx);                        \
   template void apply_version_script(Context<E> &ctx);                  \
   template void parse_symbol_version(Context<E> &ctx);                  \
   template void compute_import_export(Context<E> &ctx);                 \
   template void clear_padding(Context<E> &ctx);                         \
+  template void copy_chunks(Context<E> &ctx);                           \
   template i64 get_section_rank(Context<E> &ctx, Chunk<E> *chunk);      \
   template i64 set_osec_offsets(Context<E> &ctx);                       \
   template void fix_synthetic_symbols(Context<E> &ctx);                 \
+  template void pre_resolve_relocs(Context<E> &ctx);                    \
   template void compress_debug_sections(Context<E> &ctx);
 
 INSTANTIATE(X86_64);
@@ -0,0 +1,346 @@
+// This file implements input section reordering within an output
+// section. By default, input sections are laid out in the order they
+// appear in the command line. That order is not necessarily good for
+// runtime performance, because hot functions that call each other may
+// end up far apart in a huge .text, wasting iTLB and i-cache entries.
+//
+// We reorder sections based on one of the following inputs:
+//
+// 1. --symbol-ordering-file. The file contains a list of symbol names.
+//    Sections containing the listed symbols are placed at the beginning
+//    of their output sections in that order.
+//
+// 2. .llvm.call-graph-profile sections. If an object file is compiled
+//    with profile-guided optimization, the compiler emits the section
+//    which contains a list of caller-callee pairs and their call counts.
+//    We cluster sections using the C3 heuristics described in "Optimizing
+//    Function Placement for Large-Scale Data-Center Applications" by
+//    Ottoni and Maher so that functions calling each other frequently
+//    are placed close together.
+//
+// If both are available, --symbol-ordering-file takes precedence. This
+// is compatible with lld.
+
+#include "mold.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+
+namespace mold::elf {
+
+template <typename E>
+using SectionOrder = std::unordered_map<InputSection<E> *, i64>;
+
+template <typename E>
+static SectionOrder<E> read_symbol_ordering_file(Context<E> &ctx) {
+  std::span<std::string_view> names = ctx.arg.symbol_ordering_file;
+
+  std::unordered_map<std::string_view, i64> map;
+  for (i64 i = 0; i < names.size(); i++)
+    map.insert({names[i], i});
+
+  // Symbol names in the file may refer local symbols, so we need to
+  // visit all symbols instead of just looking up the symbol table.
+  std::unique_ptr<std::atomic_bool[]> found(
+    new std::atomic_bool[names.size()]{});
+  std::vector<std::vector<std::pair<InputSection<E> *, i64>>>
+    vec(ctx.objs.size());
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    ObjectFile<E> *file = ctx.objs[i];
+
+    for (Symbol<E> *sym : file->symbols) {
+      if (sym->file != file)
+        continue;
+
+      auto it = map.find(sym->name());
+      if (it == map.end())
+        continue;
+      found[it->second] = true;
+
+      InputSection<E> *isec = sym->input_section;
+      if (isec && isec->is_alive)
+        vec[i].push_back({isec, it->second});
+    }
+  });
+
+  for (i64 i = 0; i < names.size(); i++)
+    if (!found[i] && map[names[i]] == i)
+      Warn(ctx) << "symbol ordering file: no such symbol: " << names[i];
+
+  SectionOrder<E> order;
+  for (std::vector<std::pair<InputSection<E> *, i64>> &v : vec) {
+    for (auto [isec, priority] : v) {
+      auto [it, inserted] = order.insert({isec, priority});
+      if (!inserted)
+        it->second = std::min(it->second, priority);
+    }
+  }
+  return order;
+}
+
+template <typename E>
+struct CallGraphEdge {
+  InputSection<E> *from;
+  InputSection<E> *to;
+  u64 weight;
+};
+
+// Reads .llvm.call-graph-profile. Each entry of the section is a 64-bit
+// weight, and the caller and the callee of the entry are represented
+// as a pair of R_*_NONE relocations in the accompanying relocation
+// section. LLVM emits that section as SHT_REL even for RELA targets,
+// so we accept both.
+template <typename E>
+static std::vector<CallGraphEdge<E>>
+read_call_graph_profile(Context<E> &ctx, ObjectFile<E> &file) {
+  if (file.cgprofile_sec_idx == -1)
+    return {};
+
+  typedef std::conditional_t<E::word_size == 8, Elf64Rel, Elf32Rel> Rel;
+  typedef std::conditional_t<E::word_size == 8, Elf64Rela, Elf32Rela> Rela;
+
+  std::span<u64> weights =
+    file.template get_data<u64>(ctx, file.cgprofile_sec_idx);
+  std::vector<u32> syms;
+
+  for (const ElfShdr<E> &shdr : file.elf_sections) {
+    if (shdr.sh_info != file.cgprofile_sec_idx)
+      continue;
+
+    if (shdr.sh_type == SHT_REL) {
+      for (Rel &rel : file.template get_data<Rel>(ctx, shdr))
+        syms.push_back(rel.r_sym);
+      break;
+    }
+
+    if (shdr.sh_type == SHT_RELA) {
+      for (Rela &rel : file.template get_data<Rela>(ctx, shdr))
+        syms.push_back(rel.r_sym);
+      break;
+    }
+  }
+
+  if (syms.size() != weights.size() * 2)
+    Fatal(ctx) << file << ": invalid .llvm.call-graph-profile section";
+
+  auto get_section = [&](u32 sym_idx) -> InputSection<E> * {
+    if (sym_idx >= file.symbols.size())
+      Fatal(ctx) << file << ": invalid symbol index in "
+                 << ".llvm.call-graph-profile: " << sym_idx;
+
+    Symbol<E> &sym = *file.symbols[sym_idx];
+    if (!sym.file || sym.file->is_dso || !sym.input_section ||
+        !sym.input_section->is_alive)
+      return nullptr;
+    return sym.input_section;
+  };
+
+  std::vector<CallGraphEdge<E>> vec;
+
+  for (i64 i = 0; i < weights.size(); i++) {
+    InputSection<E> *from = get_section(syms[i * 2]);
+    InputSection<E> *to = get_section(syms[i * 2 + 1]);
+
+    // Edges between different output sections are meaningless because
+    // we cannot move sections across output sections.
+    if (from && to && from->output_section &&
+        from->output_section == to->output_section)
+      vec.push_back({from, to, weights[i]});
+  }
+  return vec;
+}
+
+// The C3 algorithm. We first create a cluster for each section. Then,
+// visiting clusters in descending order of density (call count per
+// byte), we merge a cluster into the cluster of its most likely caller
+// unless the merged cluster becomes too large or too sparse. Finally,
+// we sort the resulting clusters by density.
+template <typename E>
+static SectionOrder<E> compute_call_graph_order(Context<E> &ctx) {
+  std::vector<std::vector<CallGraphEdge<E>>> edges(ctx.objs.size());
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    edges[i] = read_call_graph_profile(ctx, *ctx.objs[i]);
+  });
+
+  struct Cluster {
+    double density() const {
+      return size ? (double)weight / size : 0;
+    }
+
+    // Clusters form circular linked lists.
+    i64 next;
+    i64 prev;
+    i64 size;
+    u64 weight = 0;
+    u64 initial_weight = 0;
+    i64 best_pred = -1;
+    u64 best_pred_weight = 0;
+  };
+
+  std::vector<InputSection<E> *> sections;
+  std::vector<Cluster> clusters;
+  std::unordered_map<InputSection<E> *, i64> map;
+
+  auto get_node = [&](InputSection<E> *isec) {
+    auto [it, inserted] = map.insert({isec, sections.size()});
+    if (inserted) {
+      i64 idx = sections.size();
+      sections.push_back(isec);
+      clusters.push_back({idx, idx, (i64)isec->shdr.sh_size});
+    }
+    return it->second;
+  };
+
+  for (std::vector<CallGraphEdge<E>> &vec : edges) {
+    for (CallGraphEdge<E> &edge : vec) {
+      i64 from = get_node(edge.from);
+      i64 to = get_node(edge.to);
+      clusters[to].weight += edge.weight;
+
+      if (from != to && (clusters[to].best_pred == -1 ||
+                         clusters[to].best_pred_weight < edge.weight)) {
+        clusters[to].best_pred = from;
+        clusters[to].best_pred_weight = edge.weight;
+      }
+    }
+  }
+
+  if (clusters.empty())
+    return {};
+
+  for (Cluster &c : clusters)
+    c.initial_weight = c.weight;
+
+  static constexpr i64 MAX_CLUSTER_SIZE = 1024 * 1024;
+  static constexpr double MAX_DENSITY_DEGRADATION = 8;
+
+  std::vector<i64> leaders(clusters.size());
+  std::vector<i64> sorted(clusters.size());
+  for (i64 i = 0; i < clusters.size(); i++)
+    leaders[i] = sorted[i] = i;
+
+  auto get_leader = [&](i64 idx) {
+    while (leaders[idx] != idx)
+      idx = leaders[idx] = leaders[leaders[idx]];
+    return idx;
+  };
+
+  auto by_density = [&](i64 a, i64 b) {
+    return clusters[a].density() > clusters[b].density();
+  };
+
+  sort(sorted, by_density);
+
+  for (i64 idx : sorted) {
+    Cluster &c = clusters[idx];
+
+    // Don't merge if the edge is unlikely.
+    if (c.best_pred == -1 || c.best_pred_weight * 10 <= c.initial_weight)
+      continue;
+
+    i64 pred_idx = get_leader(c.best_pred);
+    if (pred_idx == idx)
+      continue;
+
+    Cluster &pred = clusters[pred_idx];
+    if (c.size + pred.size > MAX_CLUSTER_SIZE)
+      continue;
+
+    double density = (double)(pred.weight + c.weight) / (pred.size + c.size);
+    if (density < pred.density() / MAX_DENSITY_DEGRADATION)
+      continue;
+
+    // Append `c` to `pred`.
+    leaders[idx] = pred_idx;
+
+    i64 tail1 = pred.prev;
+    i64 tail2 = c.prev;
+    pred.prev = tail2;
+    clusters[tail2].next = pred_idx;
+    c.prev = tail1;
+    clusters[tail1].next = idx;
+
+    pred.size += c.size;
+    pred.weight += c.weight;
+    c.size = 0;
+    c.weight = 0;
+  }
+
+  sorted.clear();
+  for (i64 i = 0; i < clusters.size(); i++)
+    if (clusters[i].size > 0)
+      sorted.push_back(i);
+  sort(sorted, by_density);
+
+  SectionOrder<E> order;
+  i64 priority = 0;
+
+  for (i64 leader : sorted) {
+    i64 idx = leader;
+    do {
+      order[sections[idx]] = priority++;
+      idx = clusters[idx].next;
+    } while (idx != leader);
+  }
+  return order;
+}
+
+template <typename E>
+void sort_sections_by_order(Context<E> &ctx) {
+  Timer t(ctx, "sort_sections_by_order");
+
+  SectionOrder<E> order;
+  if (!ctx.arg.symbol_ordering_file.empty())
+    order = read_symbol_ordering_file(ctx);
+  else if (ctx.arg.call_graph_profile_sort)
+    order = compute_call_graph_order(ctx);
+
+  if (order.empty())
+    return;
+
+  // Sections with a priority are placed at the beginning of an output
+  // section. The other sections keep their original order. .init and
+  // .fini are not sorted because their contents are concatenated to
+  // form a single function.
+  tbb::parallel_for_each(ctx.output_sections,
+                         [&](std::unique_ptr<OutputSection<E>> &osec) {
+    if (osec->name == ".init" || osec->name == ".fini" ||
+        osec->name == ".init_array" || osec->name == ".fini_array")
+      return;
+
+    std::vector<std::pair<i64, InputSection<E> *>> vec;
+    bool found = false;
+
+    for (InputSection<E> *isec : osec->members) {
+      auto it = order.find(isec);
+      if (it == order.end()) {
+        vec.push_back({INT64_MAX, isec});
+      } else {
+        vec.push_back({it->second, isec});
+        found = true;
+      }
+    }
+
+    if (!found)
+      return;
+
+    sort(vec, [](const std::pair<i64, InputSection<E> *> &a,
+                 const std::pair<i64, InputSection<E> *> &b) {
+      return a.first < b.first;
+    });
+
+    for (i64 i = 0; i < vec.size(); i++)
+      osec->members[i] = vec[i].second;
+  });
+}
+
+#define INSTANTIATE(E)                                                  \
+  template void sort_sections_by_order(Context<E> &ctx);
+
+INSTANTIATE(X86_64);
+INSTANTIATE(I386);
+INSTANTIATE(ARM64);
+
+} // namespace mold::elf
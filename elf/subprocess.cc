@@ -17,6 +17,8 @@
 
 #define DAEMON_TIMEOUT 30
 
+extern char **environ;
+
 namespace mold::elf {
 
 // Exiting from a program with large memory usage is slow --
@@ -249,6 +251,267 @@ void daemonize(Context<E> &ctx, std::function<void()> *wait_for_client,
   };
 }
 
+// The socket of `mold --server` is created in a directory that only
+// the current user can access, so that other users can neither
+// intercept link requests nor send requests to the server.
+template <typename E>
+static std::string get_server_dir(Context<E> &ctx) {
+  if (!ctx.arg.server_dir.empty())
+    return ctx.arg.server_dir;
+  return "/tmp/mold-server-" + std::to_string(getuid());
+}
+
+static bool is_private_dir(const std::string &path) {
+  struct stat st;
+  return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+         st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+// Returns true if the process on the other end of a given socket
+// is run by the current user.
+static bool is_same_user(i64 conn) {
+#ifdef __linux__
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    return false;
+  return cred.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(conn, &uid, &gid) == -1)
+    return false;
+  return uid == getuid();
+#endif
+}
+
+template <typename E>
+static void write_full(Context<E> &ctx, i64 fd, const void *buf, i64 size) {
+  for (i64 i = 0; i < size;) {
+    i64 n = write(fd, (u8 *)buf + i, size - i);
+    if (n == -1)
+      Fatal(ctx) << "write failed: " << errno_string();
+    i += n;
+  }
+}
+
+static bool read_full(i64 fd, void *buf, i64 size) {
+  for (i64 i = 0; i < size;) {
+    i64 n = read(fd, (u8 *)buf + i, size - i);
+    if (n <= 0)
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+// If --use-server is given and a server started by `mold --server` is
+// running, delegate the current link to it. We send the server our
+// stdout and stderr, the current directory, the environment variables
+// and the command line. The server replies with one byte when it
+// accepts the request and another byte when the link succeeds.
+//
+// If the server does not accept the request (e.g. because it was
+// started for another target), we link by ourselves.
+template <typename E>
+void try_connect_server(Context<E> &ctx) {
+  std::string dir = get_server_dir(ctx);
+  std::string path = dir + "/socket";
+
+  struct sockaddr_un name = {};
+  if (!is_private_dir(dir) || path.size() >= sizeof(name.sun_path))
+    return;
+
+  name.sun_family = AF_UNIX;
+  memcpy(name.sun_path, path.data(), path.size());
+
+  i64 conn = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (conn == -1)
+    Fatal(ctx) << "socket failed: " << errno_string();
+
+  if (connect(conn, (struct sockaddr *)&name, sizeof(name)) != 0 ||
+      !is_same_user(conn)) {
+    close(conn);
+    return;
+  }
+
+  send_fd(ctx, conn, STDOUT_FILENO);
+  send_fd(ctx, conn, STDERR_FILENO);
+
+  char *cwd = getcwd(nullptr, 0);
+  if (!cwd)
+    Fatal(ctx) << "getcwd failed: " << errno_string();
+
+  std::string msg = cwd;
+  msg += '\0';
+  free(cwd);
+
+  i64 num_envs = 0;
+  for (char **env = environ; *env; env++, num_envs++) {
+    msg += *env;
+    msg += '\0';
+  }
+
+  for (std::string_view arg : ctx.cmdline_args) {
+    msg += arg;
+    msg += '\0';
+  }
+
+  i64 hdr[] = {E::e_machine, num_envs, (i64)msg.size()};
+  write_full(ctx, conn, hdr, sizeof(hdr));
+  write_full(ctx, conn, msg.data(), msg.size());
+
+  char buf[1];
+  if (read(conn, buf, 1) != 1) {
+    close(conn);
+    return;
+  }
+
+  // The server has accepted our request. Any error has already been
+  // reported to our stderr by the server if it does not send us the
+  // second byte.
+  i64 r = read(conn, buf, 1);
+  close(conn);
+  exit(r == 1 ? 0 : 1);
+}
+
+// Listens to the server socket forever. For each request, we fork a
+// child process, which inherits all input files that have already been
+// parsed by the server. This function returns only in the child with
+// ctx.cmdline_args set to the client's command line.
+template <typename E>
+void start_server(Context<E> &ctx, std::function<void()> *on_accept,
+                  std::function<void()> *on_complete) {
+  std::string dir = get_server_dir(ctx);
+  std::string path = dir + "/socket";
+
+  if (mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST)
+    Fatal(ctx) << "cannot create " << dir << ": " << errno_string();
+  if (!is_private_dir(dir))
+    Fatal(ctx) << dir << ": must be a directory owned by the current user"
+               << " and accessible only by that user";
+
+  struct sockaddr_un name = {};
+  if (path.size() >= sizeof(name.sun_path))
+    Fatal(ctx) << path << ": socket path too long";
+
+  name.sun_family = AF_UNIX;
+  memcpy(name.sun_path, path.data(), path.size());
+
+  i64 sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    Fatal(ctx) << "socket failed: " << errno_string();
+
+  u32 orig_mask = umask(0177);
+
+  if (bind(sock, (struct sockaddr *)&name, sizeof(name)) == -1) {
+    if (errno != EADDRINUSE)
+      Fatal(ctx) << "bind failed: " << errno_string();
+
+    unlink(path.c_str());
+    if (bind(sock, (struct sockaddr *)&name, sizeof(name)) == -1)
+      Fatal(ctx) << "bind failed: " << errno_string();
+  }
+
+  umask(orig_mask);
+
+  if (listen(sock, SOMAXCONN) == -1)
+    Fatal(ctx) << "listen failed: " << errno_string();
+
+  // Remove the socket file on SIGINT or SIGTERM.
+  socket_tmpfile = strdup(path.c_str());
+  install_signal_handler();
+
+  // We don't care about the exit status of children.
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    i64 conn = accept(sock, NULL, NULL);
+    if (conn == -1) {
+      if (errno == EINTR)
+        continue;
+      Fatal(ctx) << "accept failed: " << errno_string();
+    }
+
+    if (!is_same_user(conn)) {
+      close(conn);
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+      Fatal(ctx) << "fork failed: " << errno_string();
+
+    if (pid > 0) {
+      // Parent
+      close(conn);
+      continue;
+    }
+
+    // Child
+    close(sock);
+    signal(SIGCHLD, SIG_DFL);
+    socket_tmpfile = nullptr;
+
+    dup2(recv_fd(ctx, conn), STDOUT_FILENO);
+    dup2(recv_fd(ctx, conn), STDERR_FILENO);
+
+    i64 hdr[3];
+    if (!read_full(conn, hdr, sizeof(hdr)))
+      _exit(1);
+
+    // Let the client link by itself if it is for another target.
+    if (hdr[0] != E::e_machine)
+      _exit(1);
+
+    // The payload is the working directory, `hdr[1]` environment
+    // variables and the command line as NUL-terminated strings. If
+    // it's unreasonably large, let the client link by itself.
+    i64 num_envs = hdr[1];
+    i64 size = hdr[2];
+    if (num_envs < 0 || size <= 0 || size > (64 << 20))
+      _exit(1);
+
+    u8 *buf = new u8[size];
+    ctx.string_pool.push_back(std::unique_ptr<u8[]>(buf));
+    if (!read_full(conn, buf, size) || buf[size - 1] != '\0')
+      _exit(1);
+
+    std::vector<std::string_view> strs;
+    for (i64 i = 0; i < size;) {
+      std::string_view str((char *)buf + i);
+      strs.push_back(str);
+      i += str.size() + 1;
+    }
+
+    if (strs.size() < num_envs + 2)
+      _exit(1);
+
+    // Link as if we were run in the client's directory with the
+    // client's environment variables.
+    if (chdir(std::string(strs[0]).c_str()) == -1)
+      _exit(1);
+
+    static std::vector<char *> envs;
+    for (i64 i = 1; i < num_envs + 1; i++)
+      envs.push_back((char *)strs[i].data());
+    envs.push_back(nullptr);
+    environ = envs.data();
+
+    ctx.cmdline_args = {strs.begin() + num_envs + 1, strs.end()};
+
+    auto send_byte = [=]() {
+      char buf[] = {1};
+      int n = write(conn, buf, 1);
+      assert(n == 1);
+    };
+
+    *on_accept = send_byte;
+    *on_complete = send_byte;
+    return;
+  }
+}
+
 template <typename E>
 static std::string get_self_path(Context<E> &ctx) {
   char buf[4096];
@@ -316,6 +579,9 @@ void process_run_subcommand(Context<E> &ctx, int argc, char **argv) {
 
 #define INSTANTIATE(E)                                                  \
   template void try_resume_daemon(Context<E> &);                        \
+  template void try_connect_server(Context<E> &);                       \
+  template void start_server(Context<E> &, std::function<void()> *,     \
+                             std::function<void()> *);                  \
   template void daemonize(Context<E> &, std::function<void()> *,        \
                           std::function<void()> *);                     \
   template void process_run_subcommand(Context<E> &, int, char **)
@@ -23,6 +23,7 @@ Options:
     -no_adhoc_codesign
   -arch <ARCH_NAME>           Specify target architecture
   -bundle                     Produce a mach-o bundle
+  -cache_path_tbd <DIR>       Cache parsed TBD files in a given directory
   -dead_strip                 Remove unreachable functions and data
   -dead_strip_dylibs          Remove unreachable dylibs from dependencies
   -demangle                   Demangle C++ symbols in log messages (default)
@@ -37,6 +38,7 @@ Options:
   -headerpad_max_install_names
                               Allocate MAXPATHLEN byte padding after load commands
   -help                       Report usage information
+  -icf=[none,safe,all]        Fold identical code
   -l<LIB>                     Search for a given library
   -lto_library <FILE>         Ignored
   -map <FILE>                 Write map file to a given file
@@ -48,6 +50,7 @@ Options:
   -pagezero_size <SIZE>       Specify the size of the __PAGEZERO segment
   -platform_version <PLATFORM> <MIN_VERSION> <SDK_VERSION>
                               Set platform, platform version and SDK version
+  -print_dead_strip           Print statistics of removed subsections
   -rpath <PATH>               Add PATH to the runpath search path list
   -syslibroot <DIR>           Prepend DIR to library search paths
   -t                          Print out each file the linker loads
@@ -190,6 +193,8 @@ void parse_nonpositional_args(Context<E> &ctx,
         Fatal(ctx) << "unknown -arch: " << arg;
     } else if (read_flag("-bundle")) {
       ctx.output_type = MH_BUNDLE;
+    } else if (read_arg("-cache_path_tbd")) {
+      ctx.arg.cache_path_tbd = arg;
     } else if (read_flag("-color-diagnostics") ||
                read_flag("--color-diagnostics")) {
     } else if (read_flag("-dead_strip")) {
@@ -220,6 +225,18 @@ void parse_nonpositional_args(Context<E> &ctx,
     } else if (read_arg("-framework")) {
       remaining.push_back("-framework");
       remaining.push_back(std::string(arg));
+    } else if (read_joined("-icf=") || read_joined("--icf=")) {
+      if (arg == "all") {
+        ctx.arg.icf = true;
+        ctx.arg.icf_safe = false;
+      } else if (arg == "safe") {
+        ctx.arg.icf = true;
+        ctx.arg.icf_safe = true;
+      } else if (arg == "none") {
+        ctx.arg.icf = false;
+      } else {
+        Fatal(ctx) << "unknown -icf argument: " << arg;
+      }
     } else if (read_arg("-lto_library")) {
     } else if (read_joined("-l")) {
       remaining.push_back("-l");
@@ -244,6 +261,10 @@ void parse_nonpositional_args(Context<E> &ctx,
       ctx.arg.platform = parse_platform(ctx, arg);
       ctx.arg.platform_min_version = parse_version(ctx, arg2);
       ctx.arg.platform_sdk_version = parse_version(ctx, arg3);
+    } else if (read_flag("-print_dead_strip") ||
+               read_flag("--print-dead-strip")) {
+      ctx.arg.print_dead_strip = true;
+      Counter::enabled = true;
     } else if (read_arg("-rpath")) {
       ctx.arg.rpath.push_back(std::string(arg));
     } else if (read_flag("-search_dylibs_first")) {
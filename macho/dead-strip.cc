@@ -1,48 +1,69 @@
 #include "mold.h"
 
+#include <tbb/concurrent_vector.h>
+#include <tbb/parallel_for_each.h>
+
 namespace mold::macho {
 
 template <typename E>
-static std::vector<Subsection<E> *> collect_root_set(Context<E> &ctx) {
-  std::vector<Subsection<E> *> rootset;
+static bool mark_subsec(Subsection<E> *subsec) {
+  return subsec && !subsec->is_alive.exchange(true);
+}
+
+template <typename E>
+static tbb::concurrent_vector<Subsection<E> *>
+collect_root_set(Context<E> &ctx) {
+  Timer t(ctx, "collect_root_set");
+  tbb::concurrent_vector<Subsection<E> *> rootset;
 
   auto mark = [&](Symbol<E> *sym) {
-    if (sym && sym->subsec)
+    if (sym && mark_subsec(sym->subsec))
       rootset.push_back(sym->subsec);
   };
 
   mark(intern(ctx, ctx.arg.entry));
 
   if (ctx.output_type == MH_DYLIB || ctx.output_type == MH_BUNDLE)
-    for (ObjectFile<E> *file : ctx.objs)
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
       for (Symbol<E> *sym : file->syms)
         if (sym->file == file && sym->is_extern)
           mark(sym);
+    });
 
   return rootset;
 }
 
 template <typename E>
-static void visit(Context<E> &ctx, Subsection<E> &subsec) {
-  if (subsec.is_alive.exchange(true))
-    return;
+static void visit(Context<E> &ctx, Subsection<E> &subsec,
+                  tbb::feeder<Subsection<E> *> &feeder, i64 depth) {
+  assert(subsec.is_alive);
+
+  // For better performance, we recurse a few levels inline before
+  // handing new subsections off to other threads via `feeder.add`.
+  // Handing them off also keeps deep call chains from exhausting
+  // the stack.
+  auto add = [&](Subsection<E> *subsec) {
+    if (mark_subsec(subsec)) {
+      if (depth < 3)
+        visit(ctx, *subsec, feeder, depth + 1);
+      else
+        feeder.add(subsec);
+    }
+  };
 
   for (Relocation<E> &rel : subsec.get_rels()) {
-    if (rel.sym) {
-      if (rel.sym->subsec)
-        visit(ctx, *rel.sym->subsec);
-    } else {
-      visit(ctx, *rel.subsec);
-    }
+    if (rel.sym)
+      add(rel.sym->subsec);
+    else
+      add(rel.subsec);
   }
 
   for (UnwindRecord<E> &rec : subsec.get_unwind_records()) {
     rec.is_alive = true;
-    visit(ctx, *rec.subsec);
-    if (rec.lsda)
-      visit(ctx, *rec.lsda);
-    if (Symbol<E> *sym = rec.personality; sym && sym->subsec)
-      visit(ctx, *sym->subsec);
+    add(rec.subsec);
+    add(rec.lsda);
+    if (rec.personality)
+      add(rec.personality->subsec);
   }
 }
 
@@ -60,44 +81,73 @@ static bool refers_live_subsection(Subsection<E> &subsec) {
   return false;
 }
 
+// Mark all reachable subsections
 template <typename E>
-static void mark(Context<E> &ctx, const std::vector<Subsection<E> *> &rootset) {
-  for (Subsection<E> *subsec : rootset)
-    visit(ctx, *subsec);
-
-  bool repeat;
-  do {
-    repeat = false;
-    for (ObjectFile<E> *file : ctx.objs) {
-      for (std::unique_ptr<Subsection<E>> &subsec : file->subsections) {
+static void mark(Context<E> &ctx,
+                 tbb::concurrent_vector<Subsection<E> *> &rootset) {
+  Timer t(ctx, "mark");
+
+  auto propagate = [&](tbb::concurrent_vector<Subsection<E> *> &vec) {
+    tbb::parallel_for_each(vec, [&](Subsection<E> *subsec,
+                                    tbb::feeder<Subsection<E> *> &feeder) {
+      visit(ctx, *subsec, feeder, 0);
+    });
+  };
+
+  propagate(rootset);
+
+  // Subsections with S_ATTR_LIVE_SUPPORT are alive if they refer
+  // a live subsection. Repeat until we reach a fixed point.
+  for (;;) {
+    tbb::concurrent_vector<Subsection<E> *> vec;
+
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+      for (std::unique_ptr<Subsection<E>> &subsec : file->subsections)
         if ((subsec->isec.hdr.attr & S_ATTR_LIVE_SUPPORT) &&
-            !subsec->is_alive &&
-            refers_live_subsection(*subsec)) {
-          visit(ctx, *subsec);
-          repeat = true;
-        }
-      }
-    }
-  } while (repeat);
+            !subsec->is_alive && refers_live_subsection(*subsec) &&
+            mark_subsec(subsec.get()))
+          vec.push_back(subsec.get());
+    });
+
+    if (vec.empty())
+      break;
+    propagate(vec);
+  }
 }
 
+// Remove unreachable subsections
 template <typename E>
 static void sweep(Context<E> &ctx) {
-  for (ObjectFile<E> *file : ctx.objs) {
-    erase(file->subsections, [](const std::unique_ptr<Subsection<E>> &subsec) {
-      return !subsec->is_alive;
-    });
-  }
+  Timer t(ctx, "sweep");
+  static Counter live("dead_strip_live_subsecs");
+  static Counter removed("dead_strip_removed_subsecs");
+  static Counter removed_bytes("dead_strip_removed_bytes");
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    for (std::unique_ptr<Subsection<E>> &subsec : file->subsections) {
+      if (subsec->is_alive) {
+        live++;
+      } else {
+        removed++;
+        removed_bytes += subsec->input_size;
+      }
+    }
 
-  for (ObjectFile<E> *file : ctx.objs)
     for (Symbol<E> *&sym : file->syms)
       if (sym->file == file && sym->subsec && !sym->subsec->is_alive)
         sym = nullptr;
+
+    erase(file->subsections, [](const std::unique_ptr<Subsection<E>> &subsec) {
+      return !subsec->is_alive;
+    });
+  });
 }
 
 template <typename E>
 void dead_strip(Context<E> &ctx) {
-  std::vector<Subsection<E> *> rootset = collect_root_set(ctx);
+  Timer t(ctx, "dead_strip");
+
+  tbb::concurrent_vector<Subsection<E> *> rootset = collect_root_set(ctx);
   mark(ctx, rootset);
   sweep(ctx);
 }
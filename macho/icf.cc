@@ -0,0 +1,450 @@
+// This file implements Identical Code Folding for Mach-O. The algorithm
+// is the same as the one in elf/icf.cc, so please read the comment in
+// that file for the details. The unit of folding is subsection instead
+// of input section, since a Mach-O object file compiled with
+// .subsections_via_symbols is split into subsections at symbol
+// boundaries.
+//
+// Two subsections are considered identical if they have the same
+// contents, alignment, unwind records and relocations. Relocations are
+// considered identical if they refer the same subsection in terms of ICF.
+//
+// With -icf=safe, we do not fold subsections whose addresses may be
+// significant, i.e. ones that are referred by non-branch relocations or
+// are exported from a dylib or a bundle.
+
+#include "mold.h"
+
+#include <array>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
+
+#ifdef __APPLE__
+#  define COMMON_DIGEST_FOR_OPENSSL
+#  include <CommonCrypto/CommonDigest.h>
+#  define SHA256(data, len, md) CC_SHA256(data, len, md)
+#else
+#  include <openssl/sha.h>
+#endif
+
+namespace mold::macho {
+
+static constexpr i64 HASH_SIZE = 16;
+
+typedef std::array<u8, HASH_SIZE> Digest;
+
+template <typename E>
+static u64 get_priority(const Subsection<E> &subsec) {
+  return ((u64)subsec.isec.file.priority << 32) | subsec.input_addr;
+}
+
+template <typename E>
+static void mark_addr_taken(Context<E> &ctx) {
+  Timer t(ctx, "mark_addr_taken");
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    for (std::unique_ptr<Subsection<E>> &subsec : file->subsections) {
+      for (Relocation<E> &rel : subsec->get_rels()) {
+        if (rel.type == E::branch_rel && rel.is_pcrel)
+          continue;
+        Subsection<E> *target = rel.sym ? rel.sym->subsec : rel.subsec;
+        if (target)
+          target->is_addr_taken = true;
+      }
+    }
+
+    if (ctx.output_type != MH_EXECUTE)
+      for (Symbol<E> *sym : file->syms)
+        if (sym && sym->file == file && sym->is_extern && sym->subsec)
+          sym->subsec->is_addr_taken = true;
+  });
+}
+
+template <typename E>
+static bool is_eligible(Context<E> &ctx, Subsection<E> &subsec) {
+  const MachSection &hdr = subsec.isec.hdr;
+  return (hdr.attr & S_ATTR_PURE_INSTRUCTIONS) && hdr.type == S_REGULAR &&
+         subsec.input_size > 0 && !(ctx.arg.icf_safe && subsec.is_addr_taken);
+}
+
+template <typename E>
+static bool is_leaf(Subsection<E> &subsec) {
+  if (subsec.nrels > 0)
+    return false;
+
+  for (UnwindRecord<E> &rec : subsec.get_unwind_records())
+    if (rec.personality || rec.lsda)
+      return false;
+  return true;
+}
+
+// Digests are computed with one-shot SHA256() over a buffer because
+// the SHA256_Init/Update/Final family is deprecated in OpenSSL 3.
+static Digest digest_final(std::string_view data) {
+  u8 buf[SHA256_SIZE];
+  SHA256((u8 *)data.data(), data.size(), buf);
+
+  Digest digest;
+  memcpy(digest.data(), buf, HASH_SIZE);
+  return digest;
+}
+
+template <typename E>
+static Digest compute_digest(Context<E> &ctx, Subsection<E> &subsec) {
+  std::string buf;
+
+  auto hash = [&](auto val) {
+    buf.append((char *)&val, sizeof(val));
+  };
+
+  auto hash_string = [&](std::string_view str) {
+    hash(str.size());
+    buf += str;
+  };
+
+  auto hash_subsec = [&](Subsection<E> *target) {
+    if (target->icf_leader) {
+      hash('1');
+      hash((u64)target->icf_leader);
+    } else if (target->icf_eligible) {
+      hash('2');
+    } else {
+      hash('3');
+      hash((u64)target);
+    }
+  };
+
+  auto hash_symbol = [&](Symbol<E> &sym) {
+    if (!sym.file || sym.file->is_dylib || !sym.subsec) {
+      hash('4');
+      hash((u64)&sym);
+    } else {
+      hash_subsec(sym.subsec);
+      hash(sym.value);
+    }
+  };
+
+  hash_string(subsec.get_contents());
+  hash((u64)&subsec.isec.osec);
+  hash(subsec.p2align);
+  hash(subsec.nunwind);
+  hash(subsec.nrels);
+
+  for (UnwindRecord<E> &rec : subsec.get_unwind_records()) {
+    hash(rec.offset);
+    hash(rec.code_len);
+    hash(rec.encoding);
+    hash((u64)rec.personality);
+    if (rec.lsda) {
+      hash_subsec(rec.lsda);
+      hash(rec.lsda_offset);
+    }
+  }
+
+  for (Relocation<E> &rel : subsec.get_rels()) {
+    hash(rel.offset);
+    hash(rel.type);
+    hash(rel.p2size);
+    hash(rel.is_pcrel);
+    hash(rel.addend);
+
+    if (rel.sym)
+      hash_symbol(*rel.sym);
+    else
+      hash_subsec(rel.subsec);
+  }
+
+  return digest_final(buf);
+}
+
+template <typename E>
+static Digest compute_leaf_digest(Subsection<E> &subsec) {
+  std::string buf;
+
+  auto hash = [&](auto val) {
+    buf.append((char *)&val, sizeof(val));
+  };
+
+  std::string_view contents = subsec.get_contents();
+  buf += contents;
+  hash(contents.size());
+  hash((u64)&subsec.isec.osec);
+  hash(subsec.p2align);
+  hash(subsec.nunwind);
+
+  for (UnwindRecord<E> &rec : subsec.get_unwind_records()) {
+    hash(rec.offset);
+    hash(rec.code_len);
+    hash(rec.encoding);
+  }
+  return digest_final(buf);
+}
+
+// Assigns the same leader to subsections with the same digest. A leader
+// is the subsection that appears first in the command line order, so
+// the result is deterministic.
+template <typename E>
+static void group_by_digest(std::span<Subsection<E> *> subsecs,
+                            std::span<Digest> digests) {
+  std::vector<u32> indices(subsecs.size());
+  for (i64 i = 0; i < indices.size(); i++)
+    indices[i] = i;
+
+  tbb::parallel_sort(indices.begin(), indices.end(), [&](u32 a, u32 b) {
+    if (digests[a] != digests[b])
+      return digests[a] < digests[b];
+    return get_priority(*subsecs[a]) < get_priority(*subsecs[b]);
+  });
+
+  Subsection<E> *leader = nullptr;
+  for (i64 i = 0; i < indices.size(); i++) {
+    if (i == 0 || digests[indices[i - 1]] != digests[indices[i]])
+      leader = subsecs[indices[i]];
+    subsecs[indices[i]]->icf_leader = leader;
+  }
+}
+
+template <typename E>
+static std::vector<Subsection<E> *>
+gather_subsections(Context<E> &ctx, bool leaf) {
+  std::vector<i64> num_subsecs(ctx.objs.size());
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    for (std::unique_ptr<Subsection<E>> &subsec : ctx.objs[i]->subsections)
+      if (subsec->icf_eligible && subsec->icf_leaf == leaf)
+        num_subsecs[i]++;
+  });
+
+  std::vector<i64> indices(ctx.objs.size() + 1);
+  for (i64 i = 0; i < ctx.objs.size(); i++)
+    indices[i + 1] = indices[i] + num_subsecs[i];
+
+  std::vector<Subsection<E> *> vec(indices.back());
+
+  tbb::parallel_for((i64)0, (i64)ctx.objs.size(), [&](i64 i) {
+    i64 idx = indices[i];
+    for (std::unique_ptr<Subsection<E>> &subsec : ctx.objs[i]->subsections)
+      if (subsec->icf_eligible && subsec->icf_leaf == leaf)
+        vec[idx++] = subsec.get();
+  });
+  return vec;
+}
+
+template <typename E>
+static void merge_leaf_nodes(Context<E> &ctx) {
+  Timer t(ctx, "merge_leaf_nodes");
+
+  static Counter eligible("icf_eligibles");
+  static Counter non_eligible("icf_non_eligibles");
+  static Counter leaf("icf_leaf_nodes");
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    for (std::unique_ptr<Subsection<E>> &subsec : file->subsections) {
+      if (!is_eligible(ctx, *subsec)) {
+        non_eligible++;
+      } else if (is_leaf(*subsec)) {
+        leaf++;
+        subsec->icf_eligible = true;
+        subsec->icf_leaf = true;
+      } else {
+        eligible++;
+        subsec->icf_eligible = true;
+      }
+    }
+  });
+
+  std::vector<Subsection<E> *> leaves = gather_subsections(ctx, true);
+  std::vector<Digest> digests(leaves.size());
+
+  tbb::parallel_for((i64)0, (i64)leaves.size(), [&](i64 i) {
+    digests[i] = compute_leaf_digest(*leaves[i]);
+  });
+
+  group_by_digest<E>(leaves, digests);
+}
+
+template <typename E>
+static void gather_edges(Context<E> &ctx, std::span<Subsection<E> *> subsecs,
+                         std::vector<u32> &edges,
+                         std::vector<u32> &edge_indices) {
+  Timer t(ctx, "gather_edges");
+
+  auto get_target = [](Relocation<E> &rel) -> Subsection<E> * {
+    Subsection<E> *target = rel.sym ? rel.sym->subsec : rel.subsec;
+    if (rel.sym && (!rel.sym->file || rel.sym->file->is_dylib))
+      return nullptr;
+    if (target && target->icf_eligible && !target->icf_leaf)
+      return target;
+    return nullptr;
+  };
+
+  std::vector<i64> num_edges(subsecs.size());
+  edge_indices.resize(subsecs.size());
+
+  tbb::parallel_for((i64)0, (i64)subsecs.size(), [&](i64 i) {
+    for (Relocation<E> &rel : subsecs[i]->get_rels())
+      if (get_target(rel))
+        num_edges[i]++;
+  });
+
+  for (i64 i = 0; i < (i64)num_edges.size() - 1; i++)
+    edge_indices[i + 1] = edge_indices[i] + num_edges[i];
+
+  edges.resize(subsecs.empty() ? 0 : edge_indices.back() + num_edges.back());
+
+  tbb::parallel_for((i64)0, (i64)subsecs.size(), [&](i64 i) {
+    i64 idx = edge_indices[i];
+    for (Relocation<E> &rel : subsecs[i]->get_rels())
+      if (Subsection<E> *target = get_target(rel))
+        edges[idx++] = target->icf_idx;
+  });
+}
+
+static i64 propagate(std::span<std::vector<Digest>> digests,
+                     std::span<u32> edges, std::span<u32> edge_indices,
+                     bool &slot, tbb::affinity_partitioner &ap) {
+  static Counter round("icf_round");
+  round++;
+
+  i64 num_digests = digests[0].size();
+  tbb::enumerable_thread_specific<i64> changed;
+
+  tbb::parallel_for((i64)0, num_digests, [&](i64 i) {
+    if (digests[slot][i] == digests[!slot][i])
+      return;
+
+    i64 begin = edge_indices[i];
+    i64 end = (i + 1 == num_digests) ? edges.size() : edge_indices[i + 1];
+
+    std::string buf;
+    buf.reserve((end - begin + 1) * HASH_SIZE);
+    buf.append((char *)digests[2][i].data(), HASH_SIZE);
+
+    for (i64 j : edges.subspan(begin, end - begin))
+      buf.append((char *)digests[slot][j].data(), HASH_SIZE);
+
+    digests[!slot][i] = digest_final(buf);
+
+    if (digests[slot][i] != digests[!slot][i])
+      changed.local()++;
+  }, ap);
+
+  slot = !slot;
+  return changed.combine(std::plus());
+}
+
+static i64 count_num_classes(std::span<Digest> digests,
+                             tbb::affinity_partitioner &ap) {
+  std::vector<Digest> vec(digests.begin(), digests.end());
+  tbb::parallel_sort(vec);
+
+  tbb::enumerable_thread_specific<i64> num_classes;
+  tbb::parallel_for((i64)0, (i64)vec.size() - 1, [&](i64 i) {
+    if (vec[i] != vec[i + 1])
+      num_classes.local()++;
+  }, ap);
+  return num_classes.combine(std::plus());
+}
+
+template <typename E>
+void icf_sections(Context<E> &ctx) {
+  Timer t(ctx, "icf");
+
+  if (ctx.arg.icf_safe)
+    mark_addr_taken(ctx);
+
+  merge_leaf_nodes(ctx);
+
+  // Prepare for the propagation rounds.
+  std::vector<Subsection<E> *> subsecs = gather_subsections(ctx, false);
+
+  tbb::parallel_for((i64)0, (i64)subsecs.size(), [&](i64 i) {
+    subsecs[i]->icf_idx = i;
+  });
+
+  std::vector<std::vector<Digest>> digests(3);
+  digests[0].resize(subsecs.size());
+  tbb::parallel_for((i64)0, (i64)subsecs.size(), [&](i64 i) {
+    digests[0][i] = compute_digest(ctx, *subsecs[i]);
+  });
+  digests[1].resize(digests[0].size());
+  digests[2] = digests[0];
+
+  std::vector<u32> edges;
+  std::vector<u32> edge_indices;
+  gather_edges<E>(ctx, subsecs, edges, edge_indices);
+
+  bool slot = 0;
+
+  // Execute the propagation rounds until convergence is obtained.
+  if (!subsecs.empty()) {
+    Timer t(ctx, "propagate");
+    tbb::affinity_partitioner ap;
+
+    i64 num_changed = -1;
+    for (;;) {
+      i64 n = propagate(digests, edges, edge_indices, slot, ap);
+      if (n == num_changed)
+        break;
+      num_changed = n;
+    }
+
+    i64 num_classes = -1;
+    for (;;) {
+      for (i64 i = 0; i < 10; i++)
+        propagate(digests, edges, edge_indices, slot, ap);
+
+      i64 n = count_num_classes(digests[slot], ap);
+      if (n == num_classes)
+        break;
+      num_classes = n;
+    }
+  }
+
+  // Group subsections by SHA digest.
+  {
+    Timer t(ctx, "group");
+    group_by_digest<E>(subsecs, digests[slot]);
+  }
+
+  // Redirect references to folded subsections to their leaders and
+  // remove folded subsections.
+  {
+    Timer t(ctx, "reassign");
+    static Counter folded("icf_folded_subsecs");
+
+    auto get_leader = [](Subsection<E> *subsec) {
+      return subsec->icf_leader ? subsec->icf_leader : subsec;
+    };
+
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+      for (Symbol<E> *sym : file->syms)
+        if (sym && sym->file == file && sym->subsec)
+          sym->subsec = get_leader(sym->subsec);
+
+      for (std::unique_ptr<Subsection<E>> &subsec : file->subsections)
+        for (Relocation<E> &rel : subsec->get_rels())
+          if (rel.subsec)
+            rel.subsec = get_leader(rel.subsec);
+    });
+
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+      erase(file->subsections, [&](std::unique_ptr<Subsection<E>> &subsec) {
+        if (get_leader(subsec.get()) == subsec.get())
+          return false;
+        folded++;
+        return true;
+      });
+    });
+  }
+}
+
+#define INSTANTIATE(E)                          \
+  template void icf_sections(Context<E> &)
+
+INSTANTIATE(ARM64);
+INSTANTIATE(X86_64);
+
+} // namespace mold::macho
@@ -674,6 +674,7 @@ struct ARM64 {
   static constexpr u32 cputype = CPU_TYPE_ARM64;
   static constexpr u32 cpusubtype = CPU_SUBTYPE_ARM64_ALL;
   static constexpr u32 abs_rel = ARM64_RELOC_UNSIGNED;
+  static constexpr u32 branch_rel = ARM64_RELOC_BRANCH26;
   static constexpr u32 word_size = 8;
   static constexpr u32 stub_size = 12;
   static constexpr u32 stub_helper_hdr_size = 24;
@@ -684,6 +685,7 @@ struct X86_64 {
   static constexpr u32 cputype = CPU_TYPE_X86_64;
   static constexpr u32 cpusubtype = CPU_SUBTYPE_X86_64_ALL;
   static constexpr u32 abs_rel = X86_64_RELOC_UNSIGNED;
+  static constexpr u32 branch_rel = X86_64_RELOC_BRANCH;
   static constexpr u32 word_size = 8;
   static constexpr u32 stub_size = 6;
   static constexpr u32 stub_helper_hdr_size = 16;
@@ -9,6 +9,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <tbb/parallel_for_each.h>
 
 namespace mold::macho {
 
@@ -161,12 +162,59 @@ static void create_synthetic_chunks(Context<E> &ctx) {
 }
 
 template <typename E>
-static void scan_unwind_info(Context<E> &ctx) {
+static void resolve_symbols(Context<E> &ctx) {
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    if (file->is_alive)
+      file->resolve_regular_symbols(ctx);
+    else
+      file->resolve_lazy_symbols(ctx);
+  });
+
+  // Mark reachable objects to decide which archive members to include
+  // into an output. Newly-found live files are fed back to the loop.
+  std::vector<ObjectFile<E> *> live_objs;
   for (ObjectFile<E> *file : ctx.objs)
+    if (file->is_alive)
+      live_objs.push_back(file);
+
+  tbb::parallel_for_each(live_objs,
+                         [&](ObjectFile<E> *file,
+                             tbb::feeder<ObjectFile<E> *> &feeder) {
+    file->mark_live_objects(ctx, [&](ObjectFile<E> *obj) { feeder.add(obj); });
+  });
+
+  // Now that we know which files are alive, redo symbol resolution
+  // from scratch using only the live files.
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    file->clear_symbols();
+  });
+
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    if (file->is_alive)
+      file->resolve_regular_symbols(ctx);
+  });
+
+  tbb::parallel_for_each(ctx.dylibs, [&](DylibFile<E> *dylib) {
+    dylib->resolve_symbols(ctx);
+  });
+}
+
+template <typename E>
+static void scan_relocations(Context<E> &ctx) {
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
+    for (std::unique_ptr<Subsection<E>> &subsec : file->subsections)
+      subsec->scan_relocations(ctx);
+  });
+}
+
+template <typename E>
+static void scan_unwind_info(Context<E> &ctx) {
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
     for (UnwindRecord<E> &rec : file->unwind_records)
       if (!ctx.arg.dead_strip || rec.is_alive)
         if (rec.personality)
           rec.personality->flags |= NEEDS_GOT;
+  });
 }
 
 template <typename E>
@@ -276,20 +324,28 @@ static void read_file(Context<E> &ctx, MappedFile<Context<E>> *mf,
   if (get_file_type(mf) == FileType::MACH_UNIVERSAL)
     mf = strip_universal_header(ctx, mf);
 
+  auto add_obj = [&](ObjectFile<E> *file) {
+    ctx.objs.push_back(file);
+    ctx.tg.run([file, &ctx] { file->parse(ctx); });
+  };
+
   switch (get_file_type(mf)) {
   case FileType::TAPI:
-  case FileType::MACH_DYLIB:
-    ctx.dylibs.push_back(DylibFile<E>::create(ctx, mf));
+  case FileType::MACH_DYLIB: {
+    DylibFile<E> *file = DylibFile<E>::create(ctx, mf);
+    ctx.dylibs.push_back(file);
     if (is_needed || !ctx.arg.dead_strip_dylibs)
-      ctx.dylibs.back()->is_needed = true;
+      file->is_needed = true;
+    ctx.tg.run([file, &ctx] { file->parse(ctx); });
     break;
+  }
   case FileType::MACH_OBJ:
-    ctx.objs.push_back(ObjectFile<E>::create(ctx, mf, ""));
+    add_obj(ObjectFile<E>::create(ctx, mf, ""));
     break;
   case FileType::AR:
     for (MappedFile<Context<E>> *child : read_archive_members(ctx, mf))
       if (get_file_type(child) == FileType::MACH_OBJ)
-        ctx.objs.push_back(ObjectFile<E>::create(ctx, child, mf->name));
+        add_obj(ObjectFile<E>::create(ctx, child, mf->name));
     break;
   default:
     break;
@@ -372,7 +428,10 @@ static int do_main(int argc, char **argv) {
   if (ctx.arg.arch == CPU_TYPE_X86_64)
     return do_main<X86_64>(argc, argv);
 
+  // Input files are parsed in the background while we are reading
+  // the command line.
   read_input_files(ctx, file_args);
+  ctx.tg.wait();
 
   i64 priority = 1;
   for (ObjectFile<E> *file : ctx.objs)
@@ -383,33 +442,13 @@ static int do_main(int argc, char **argv) {
   for (i64 i = 0; i < ctx.dylibs.size(); i++)
     ctx.dylibs[i]->dylib_idx = i + 1;
 
-  for (ObjectFile<E> *file : ctx.objs)
-    file->parse(ctx);
-  for (DylibFile<E> *dylib : ctx.dylibs)
-    dylib->parse(ctx);
-
   if (ctx.arg.ObjC)
-    for (ObjectFile<E> *file : ctx.objs)
+    tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
       if (!file->archive_name.empty() && file->is_objc_object(ctx))
         file->is_alive = true;
+    });
 
-  for (ObjectFile<E> *file : ctx.objs) {
-    if (file->is_alive)
-      file->resolve_regular_symbols(ctx);
-    else
-      file->resolve_lazy_symbols(ctx);
-  }
-
-  std::vector<ObjectFile<E> *> live_objs;
-  for (ObjectFile<E> *file : ctx.objs)
-    if (file->is_alive)
-      live_objs.push_back(file);
-
-  for (i64 i = 0; i < live_objs.size(); i++)
-    append(live_objs, live_objs[i]->mark_live_objects(ctx));
-
-  for (DylibFile<E> *dylib : ctx.dylibs)
-    dylib->resolve_symbols(ctx);
+  resolve_symbols(ctx);
 
   if (ctx.output_type == MH_EXECUTE && !intern(ctx, ctx.arg.entry)->file)
     Error(ctx) << "undefined entry point symbol: " << ctx.arg.entry;
@@ -426,23 +465,29 @@ static int do_main(int argc, char **argv) {
       SyncOut(ctx) << *file;
   }
 
-  for (ObjectFile<E> *file : ctx.objs)
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
     file->convert_common_symbols(ctx);
+  });
 
-  if (ctx.arg.dead_strip)
+  if (ctx.arg.dead_strip) {
     dead_strip(ctx);
+    if (ctx.arg.print_dead_strip)
+      Counter::print();
+  }
+
+  if (ctx.arg.icf)
+    icf_sections(ctx);
 
   create_synthetic_chunks(ctx);
 
-  for (ObjectFile<E> *file : ctx.objs)
+  tbb::parallel_for_each(ctx.objs, [&](ObjectFile<E> *file) {
     file->check_duplicate_symbols(ctx);
+  });
 
   for (i64 i = 0; i < ctx.segments.size(); i++)
     ctx.segments[i]->seg_idx = i + 1;
 
-  for (ObjectFile<E> *file : ctx.objs)
-    for (std::unique_ptr<Subsection<E> > &subsec : file->subsections)
-      subsec->scan_relocations(ctx);
+  scan_relocations(ctx);
 
   scan_unwind_info(ctx);
 
@@ -456,8 +501,14 @@ static int do_main(int argc, char **argv) {
   ctx.output_file = OutputFile<E>::open(ctx, ctx.arg.output, output_size, 0777);
   ctx.buf = ctx.output_file->buf;
 
-  for (std::unique_ptr<OutputSegment<E>> &seg : ctx.segments)
+  // Page hashes for the code signature are computed for each segment
+  // as soon as the segment is written, overlapping with copying the
+  // other segments.
+  tbb::parallel_for_each(ctx.segments,
+                         [&](std::unique_ptr<OutputSegment<E>> &seg) {
     seg->copy_buf(ctx);
+    ctx.code_sig.hash_segment(ctx, *seg);
+  });
   ctx.code_sig.write_signature(ctx);
 
   ctx.output_file->close(ctx);
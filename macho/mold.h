@@ -3,11 +3,15 @@
 #include "macho.h"
 #include "../mold.h"
 
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <span>
 #include <tbb/concurrent_hash_map.h>
 #include <tbb/spin_mutex.h>
+#include <tbb/task_group.h>
 #include <unordered_map>
 #include <variant>
 
@@ -81,7 +85,9 @@ public:
   void resolve_regular_symbols(Context<E> &ctx);
   void resolve_lazy_symbols(Context<E> &ctx);
   bool is_objc_object(Context<E> &ctx);
-  std::vector<ObjectFile *> mark_live_objects(Context<E> &ctx);
+  void mark_live_objects(Context<E> &ctx,
+                         std::function<void(ObjectFile<E> *)> feeder);
+  void clear_symbols();
   void convert_common_symbols(Context<E> &ctx);
   void check_duplicate_symbols(Context<E> &ctx);
 
@@ -189,6 +195,13 @@ public:
   u32 raddr = -1;
   u16 p2align = 0;
   std::atomic_bool is_alive = false;
+
+  // For ICF
+  Subsection<E> *icf_leader = nullptr;
+  u32 icf_idx = -1;
+  bool icf_eligible = false;
+  bool icf_leaf = false;
+  std::atomic_bool is_addr_taken = false;
 };
 
 template <typename E>
@@ -415,12 +428,16 @@ private:
     u32 flags = 0;
     u64 addr = 0;
     u32 offset = -1;
+    u32 header_size = 0;
+    u32 size = 0;
+    u32 num_entries = 0;
     std::vector<TrieNode> children;
   };
 
   static i64 common_prefix_len(std::span<Entry> entries, i64 len);
   static TrieNode construct_trie(std::span<Entry> entries, i64 len);
-  static i64 set_offset(TrieNode &node, i64 offset);
+  static i64 compute_size(TrieNode &node);
+  static void set_offset(TrieNode &node);
   void write_trie(u8 *buf, TrieNode &node);
 
   TrieNode root;
@@ -526,6 +543,7 @@ public:
   }
 
   void compute_size(Context<E> &ctx) override;
+  void hash_segment(Context<E> &ctx, OutputSegment<E> &seg);
   void write_signature(Context<E> &ctx);
 
   static constexpr i64 BLOCK_SIZE = 4096;
@@ -685,10 +703,15 @@ protected:
 // yaml.cc
 //
 
-struct YamlNode {
-  std::variant<std::string_view,
-               std::vector<YamlNode>,
-               std::map<std::string_view, YamlNode>> data;
+// We don't build a YAML document tree. Instead, the tokenizer returns a
+// flat token stream which refers the input string, and a reader walks
+// the stream to pick up only what it needs. Tokens are produced one
+// line at a time as the reader consumes them.
+struct YamlToken {
+  enum { STRING = 1, INDENT, DEDENT, END };
+
+  u8 kind = 0;
+  std::string_view str;
 };
 
 struct YamlError {
@@ -696,8 +719,26 @@ struct YamlError {
   i64 pos;
 };
 
-std::variant<std::vector<YamlNode>, YamlError>
-parse_yaml(std::string_view str);
+class YamlTokenizer {
+public:
+  YamlTokenizer(std::string_view input) : input(input), rest(input) {}
+
+  std::optional<YamlError> tokenize_line();
+  bool at_eof() const { return done; }
+
+  std::deque<YamlToken> tokens;
+
+private:
+  void tokenize_bare_string(std::string_view &str);
+
+  std::optional<YamlError> tokenize_list(std::string_view &str);
+  std::optional<YamlError> tokenize_string(std::string_view &str, char end);
+
+  std::string_view input;
+  std::string_view rest;
+  std::vector<i64> indents = {0};
+  bool done = false;
+};
 
 //
 // tapi.cc
@@ -730,6 +771,13 @@ void parse_nonpositional_args(Context<E> &ctx,
 template <typename E>
 void dead_strip(Context<E> &ctx);
 
+//
+// icf.cc
+//
+
+template <typename E>
+void icf_sections(Context<E> &ctx);
+
 //
 // main.cc
 //
@@ -773,6 +821,9 @@ struct Context {
     bool dylib = false;
     bool dynamic = true;
     bool fatal_warnings = false;
+    bool icf = false;
+    bool icf_safe = false;
+    bool print_dead_strip = false;
     bool trace = false;
     i64 arch = CPU_TYPE_ARM64;
     i64 headerpad = 256;
@@ -780,6 +831,7 @@ struct Context {
     i64 platform = PLATFORM_MACOS;
     i64 platform_min_version = 0;
     i64 platform_sdk_version = 0;
+    std::string cache_path_tbd;
     std::string chroot;
     std::string entry = "_main";
     std::string map;
@@ -795,6 +847,8 @@ struct Context {
 
   bool has_error = false;
 
+  tbb::task_group tg;
+
   tbb::concurrent_hash_map<std::string_view, Symbol<E>> symbol_map;
 
   std::unique_ptr<OutputFile<E>> output_file;
@@ -443,28 +443,38 @@ bool ObjectFile<E>::is_objc_object(Context<E> &ctx) {
 }
 
 template <typename E>
-std::vector<ObjectFile<E> *> ObjectFile<E>::mark_live_objects(Context<E> &ctx) {
-  std::vector<ObjectFile<E> *> vec;
+void
+ObjectFile<E>::mark_live_objects(Context<E> &ctx,
+                                 std::function<void(ObjectFile<E> *)> feeder) {
   assert(this->is_alive);
 
+  // This function only reads symbols. Symbols are not updated until
+  // all live files are known, so that which files are pulled in does
+  // not depend on the order in which they are visited.
   for (i64 i = 0; i < this->syms.size(); i++) {
     MachSym &msym = mach_syms[i];
-    if (!msym.ext)
+    if (!msym.ext || !msym.is_undef())
       continue;
 
     Symbol<E> &sym = *this->syms[i];
-    std::lock_guard lock(sym.mu);
+    if (sym.file && !sym.file->is_alive.exchange(true))
+      feeder((ObjectFile<E> *)sym.file);
+  }
+}
 
-    if (msym.is_undef()) {
-      if (sym.file && !sym.file->is_alive.exchange(true))
-        vec.push_back((ObjectFile<E> *)sym.file);
-      continue;
+template <typename E>
+void ObjectFile<E>::clear_symbols() {
+  for (i64 i = 0; i < this->syms.size(); i++) {
+    Symbol<E> &sym = *this->syms[i];
+    if (mach_syms[i].ext && sym.file == this) {
+      sym.file = nullptr;
+      sym.subsec = nullptr;
+      sym.value = 0;
+      sym.is_extern = false;
+      sym.is_lazy = false;
+      sym.is_common = false;
     }
-
-    if (get_rank(this, msym, false) < get_rank(sym))
-      override_symbol(ctx, i);
   }
-  return vec;
 }
 
 template <typename E>
@@ -2,6 +2,9 @@
 
 #include <shared_mutex>
 #include <sys/mman.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
 
 #ifdef __APPLE__
 #  define COMMON_DIGEST_FOR_OPENSSL
@@ -402,12 +405,12 @@ void OutputSection<E>::copy_buf(Context<E> &ctx) {
   u8 *buf = ctx.buf + this->hdr.offset;
   assert(this->hdr.type != S_ZEROFILL);
 
-  for (Subsection<E> *subsec : members) {
+  tbb::parallel_for_each(members, [&](Subsection<E> *subsec) {
     std::string_view data = subsec->get_contents();
     u8 *loc = buf + subsec->get_addr(ctx) - this->hdr.addr;
     memcpy(loc, data.data(), data.size());
     subsec->apply_reloc(ctx, loc);
-  }
+  });
 }
 
 template <typename E>
@@ -498,9 +501,10 @@ void OutputSegment<E>::copy_buf(Context<E> &ctx) {
   if (cmd.get_segname() == "__TEXT")
     memset(ctx.buf + cmd.fileoff, 0x90, cmd.filesize);
 
-  for (Chunk<E> *sec : chunks)
+  tbb::parallel_for_each(chunks, [&](Chunk<E> *sec) {
     if (sec->hdr.type != S_ZEROFILL)
       sec->copy_buf(ctx);
+  });
 }
 
 RebaseEncoder::RebaseEncoder() {
@@ -718,21 +722,44 @@ void ExportEncoder::add(std::string_view name, u32 flags, u64 addr) {
   entries.push_back({name, flags, addr});
 }
 
+// Subtries are built and laid out in parallel only if they are large
+// enough to amortize the cost of spawning tasks.
+template <typename Fn>
+static void for_each_child(i64 num_entries, i64 num_children, Fn fn) {
+  if (num_entries < 1024)
+    for (i64 i = 0; i < num_children; i++)
+      fn(i);
+  else
+    tbb::parallel_for((i64)0, num_children, fn);
+}
+
 i64 ExportEncoder::finish() {
-  sort(entries, [](const Entry &a, const Entry &b) {
+  tbb::parallel_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) {
     return a.name < b.name;
   });
 
   TrieNode trie = construct_trie(entries, 0);
 
-  if (trie.prefix.empty())
+  if (trie.prefix.empty()) {
     root = std::move(trie);
-  else
+  } else {
+    root.num_entries = trie.num_entries;
     root.children.push_back(std::move(trie));
+  }
+
+  // The size of a node depends on the offsets of its children because
+  // they are encoded in ULEB128, so we repeat until the layout
+  // converges. Each iteration computes the sizes of all nodes using
+  // the offsets from the previous iteration and then assigns new
+  // offsets from the sizes.
+  root.offset = 0;
+  i64 size = compute_size(root);
+  set_offset(root);
 
-  i64 size = set_offset(root, 0);
   for (;;) {
-    i64 sz = set_offset(root, 0);
+    i64 sz = compute_size(root);
+    set_offset(root);
     if (sz == size)
       return sz;
     size = sz;
@@ -750,6 +777,7 @@ i64 ExportEncoder::common_prefix_len(std::span<Entry> entries, i64 len) {
 ExportEncoder::TrieNode
 ExportEncoder::construct_trie(std::span<Entry> entries, i64 len) {
   TrieNode node;
+  node.num_entries = entries.size();
 
   i64 new_len = common_prefix_len(entries, len);
   if (new_len > len) {
@@ -762,20 +790,25 @@ ExportEncoder::construct_trie(std::span<Entry> entries, i64 len) {
     }
   }
 
+  std::vector<std::span<Entry>> groups;
+
   for (i64 i = 0; i < entries.size();) {
     i64 j = i + 1;
     u8 c = entries[i].name[new_len];
     while (j < entries.size() && c == entries[j].name[new_len])
       j++;
-    node.children.push_back(construct_trie(entries.subspan(i, j - i), new_len));
+    groups.push_back(entries.subspan(i, j - i));
     i = j;
   }
+
+  node.children.resize(groups.size());
+  for_each_child(node.num_entries, groups.size(), [&](i64 i) {
+    node.children[i] = construct_trie(groups[i], new_len);
+  });
   return node;
 }
 
-i64 ExportEncoder::set_offset(TrieNode &node, i64 offset) {
-  node.offset = offset;
-
+i64 ExportEncoder::compute_size(TrieNode &node) {
   i64 size = 0;
   if (node.is_leaf) {
     size = uleb_size(node.flags) + uleb_size(node.addr);
@@ -791,11 +824,32 @@ i64 ExportEncoder::set_offset(TrieNode &node, i64 offset) {
     size += child.prefix.size() + 1 + uleb_size(child.offset);
   }
 
+  node.header_size = size;
+
+  for_each_child(node.num_entries, node.children.size(), [&](i64 i) {
+    compute_size(node.children[i]);
+  });
+
   for (TrieNode &child : node.children)
-    size += set_offset(child, offset + size);
+    size += child.size;
+  node.size = size;
   return size;
 }
 
+// Assigns offsets to the descendants of a given node. Each subtree
+// is laid out contiguously right after its parent node.
+void ExportEncoder::set_offset(TrieNode &node) {
+  i64 offset = node.offset + node.header_size;
+  for (TrieNode &child : node.children) {
+    child.offset = offset;
+    offset += child.size;
+  }
+
+  for_each_child(node.num_entries, node.children.size(), [&](i64 i) {
+    set_offset(node.children[i]);
+  });
+}
+
 void ExportEncoder::write_trie(u8 *start, TrieNode &node) {
   u8 *buf = start + node.offset;
 
@@ -814,8 +868,9 @@ void ExportEncoder::write_trie(u8 *start, TrieNode &node) {
     buf += write_uleb(buf, child.offset);
   }
 
-  for (TrieNode &child : node.children)
-    write_trie(start, child);
+  for_each_child(node.num_entries, node.children.size(), [&](i64 i) {
+    write_trie(start, node.children[i]);
+  });
 }
 
 template <typename E>
@@ -976,6 +1031,35 @@ void CodeSignatureSection<E>::compute_size(Context<E> &ctx) {
                    num_blocks * SHA256_SIZE;
 }
 
+// Computes SHA-256 hashes of the 4 KiB pages that belong to a given
+// segment. Since segments are aligned to page boundaries, each page
+// belongs to exactly one segment, so this can be called for a segment
+// as soon as its contents are written, without waiting for the others.
+template <typename E>
+void CodeSignatureSection<E>::hash_segment(Context<E> &ctx,
+                                           OutputSegment<E> &seg) {
+  i64 filename_size = align_to(path_filename(ctx.arg.output).size() + 1, 16);
+  u8 *hashes = ctx.buf + this->hdr.offset + sizeof(CodeSignatureHeader) +
+               sizeof(CodeSignatureBlobIndex) +
+               sizeof(CodeSignatureDirectory) + filename_size;
+
+  i64 code_limit = this->hdr.offset;
+  i64 begin = seg.cmd.fileoff;
+  i64 end = std::min<i64>(seg.cmd.fileoff + seg.cmd.filesize, code_limit);
+  if (begin >= end)
+    return;
+
+  assert(begin % BLOCK_SIZE == 0);
+  i64 num_blocks = align_to(end, BLOCK_SIZE) / BLOCK_SIZE;
+
+  tbb::parallel_for(begin / BLOCK_SIZE, num_blocks, [&](i64 i) {
+    i64 size = std::min<i64>((i + 1) * BLOCK_SIZE, code_limit) - i * BLOCK_SIZE;
+    SHA256(ctx.buf + i * BLOCK_SIZE, size, hashes + i * SHA256_SIZE);
+  });
+}
+
+// Writes the code signature header. Page hashes must have been computed
+// by hash_segment() for all segments before calling this function.
 template <typename E>
 void CodeSignatureSection<E>::write_signature(Context<E> &ctx) {
   u8 *buf = ctx.buf + this->hdr.offset;
@@ -1017,14 +1101,6 @@ void CodeSignatureSection<E>::write_signature(Context<E> &ctx) {
     dir.exec_seg_flags = CS_EXECSEG_MAIN_BINARY;
 
   memcpy(buf, filename.data(), filename.size());
-  buf += filename_size;
-
-  for (i64 i = 0; i < num_blocks; i++) {
-    u8 *start = ctx.buf + i * BLOCK_SIZE;
-    u8 *end = ctx.buf + std::min<i64>((i + 1) * BLOCK_SIZE, this->hdr.offset);
-    SHA256(start, end - start, buf);
-    buf += SHA256_SIZE;
-  }
 
   // A hack borrowed from lld.
   msync(ctx.buf, ctx.output_file->filesize, MS_INVALIDATE);
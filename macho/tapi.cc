@@ -1,72 +1,327 @@
 #include "mold.h"
 
+#include <iomanip>
 #include <optional>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xxh3.h>
 
 namespace mold::macho {
 
-static std::vector<YamlNode>
-get_vector(YamlNode &node, std::string_view key) {
-  if (auto *map = std::get_if<std::map<std::string_view, YamlNode>>(&node.data))
-    if (auto it = map->find(key); it != map->end())
-      if (auto *vec = std::get_if<std::vector<YamlNode>>(&it->second.data))
-        return *vec;
-  return {};
+// TbdReader reads a YAML token stream of a TBD file and directly picks
+// up the fields we need without constructing a document tree. Strings
+// in the resulting TextDylibs refer the original file contents.
+//
+// Tokens are pulled from the tokenizer as they are consumed, so only a
+// few lookahead tokens are buffered at any moment.
+//
+// Fields of an unexpected type are ignored.
+template <typename E>
+class TbdReader {
+public:
+  TbdReader(Context<E> &ctx, MappedFile<Context<E>> *mf,
+            std::string_view arch)
+    : ctx(ctx), mf(mf), arch(arch), tokenizer(mf->get_contents()) {
+    std::string_view contents = mf->get_contents();
+    eof_token = {YamlToken::END, contents.substr(contents.size())};
+  }
+
+  std::vector<TextDylib> read();
+
+private:
+  std::optional<TextDylib> read_document();
+  void read_targeted_list(std::string_view name,
+                          std::vector<std::string_view> &out);
+  bool contains_arch();
+
+  template <typename Fn> void read_element(Fn fn);
+  template <typename Fn> void read_map(Fn fn);
+  template <typename Fn> void read_list(Fn fn);
+  std::optional<std::string_view> read_scalar();
+  void skip();
+
+  void error(std::string_view msg, const char *pos = nullptr);
+
+  void fill(i64 n);
+  YamlToken &peek(i64 i);
+  void consume(i64 n);
+
+  bool is_map() {
+    return peek(0).kind == YamlToken::STRING && peek(1).kind == ':';
+  }
+
+  bool at_end() {
+    return peek(0).kind == YamlToken::END || peek(0).kind == YamlToken::DEDENT;
+  }
+
+  Context<E> &ctx;
+  MappedFile<Context<E>> *mf;
+  std::string_view arch;
+  YamlTokenizer tokenizer;
+  YamlToken eof_token;
+};
+
+// Tokenizes the input until at least `n` tokens are buffered or the
+// input is exhausted.
+template <typename E>
+void TbdReader<E>::fill(i64 n) {
+  while (tokenizer.tokens.size() < n && !tokenizer.at_eof()) {
+    if (std::optional<YamlError> err = tokenizer.tokenize_line()) {
+      std::string_view contents = mf->get_contents();
+      error(err->msg, contents.data() + err->pos);
+    }
+  }
 }
 
-static std::optional<std::string_view>
-get_string(YamlNode &node, std::string_view key) {
-  if (auto *map = std::get_if<std::map<std::string_view, YamlNode>>(&node.data))
-    if (auto it = map->find(key); it != map->end())
-      if (auto *str = std::get_if<std::string_view>(&it->second.data))
-        return *str;
-  return {};
+template <typename E>
+YamlToken &TbdReader<E>::peek(i64 i) {
+  fill(i + 1);
+  if (i < tokenizer.tokens.size())
+    return tokenizer.tokens[i];
+  return eof_token;
 }
 
-static bool contains(const std::vector<YamlNode> &vec, std::string_view key) {
-  for (const YamlNode &mem : vec)
-    if (const std::string_view *s = std::get_if<std::string_view>(&mem.data))
-      if (*s == key)
-        return true;
-  return false;
+template <typename E>
+void TbdReader<E>::consume(i64 n) {
+  fill(n);
+  for (i64 i = 0; i < n && !tokenizer.tokens.empty(); i++)
+    tokenizer.tokens.pop_front();
 }
 
-static std::optional<TextDylib> to_tbd(YamlNode &node, std::string_view arch) {
-  if (!contains(get_vector(node, "targets"), arch))
-    return {};
+template <typename E>
+void TbdReader<E>::error(std::string_view msg, const char *pos) {
+  std::string_view contents = mf->get_contents();
+  if (!pos)
+    pos = peek(0).str.data();
+  i64 lineno = std::count(contents.data(), pos, '\n');
+  Fatal(ctx) << mf->name << ":" << (lineno + 1)
+             << ": YAML parse error: " << msg;
+}
+
+// Any element may be enclosed with INDENT and DEDENT.
+template <typename E>
+template <typename Fn>
+void TbdReader<E>::read_element(Fn fn) {
+  if (peek(0).kind == YamlToken::INDENT) {
+    consume(1);
+    read_element(fn);
+    if (peek(0).kind != YamlToken::DEDENT)
+      return error("stray token");
+    consume(1);
+    return;
+  }
+  fn();
+}
+
+// Calls `fn` with each key of a map. `fn` must consume the value.
+template <typename E>
+template <typename Fn>
+void TbdReader<E>::read_map(Fn fn) {
+  read_element([&] {
+    if (!is_map())
+      return skip();
+
+    while (!at_end()) {
+      if (!is_map())
+        return error("map key expected");
+      std::string_view key = peek(0).str;
+      consume(2);
+      fn(key);
+    }
+  });
+}
+
+// Calls `fn` for each member of a block or flow list. `fn` must
+// consume the member.
+template <typename E>
+template <typename Fn>
+void TbdReader<E>::read_list(Fn fn) {
+  read_element([&] {
+    if (peek(0).kind == '-') {
+      while (!at_end()) {
+        if (peek(0).kind != '-')
+          return error("list element expected");
+        consume(1);
+        fn();
+      }
+      return;
+    }
+
+    if (peek(0).kind == '[') {
+      const char *start = peek(0).str.data();
+      consume(1);
+
+      while (peek(0).kind != ']' && peek(0).kind != YamlToken::END) {
+        fn();
+        if (peek(0).kind == ']')
+          break;
+        if (peek(0).kind != ',')
+          return error("comma expected");
+        consume(1);
+      }
+
+      if (peek(0).kind == YamlToken::END)
+        return error("unterminated flow list", start);
+      consume(1);
+      return;
+    }
+
+    skip();
+  });
+}
+
+template <typename E>
+std::optional<std::string_view> TbdReader<E>::read_scalar() {
+  std::optional<std::string_view> val;
+
+  read_element([&] {
+    if (peek(0).kind == YamlToken::STRING && !is_map()) {
+      val = peek(0).str;
+      consume(1);
+    } else {
+      skip();
+    }
+  });
+  return val;
+}
+
+template <typename E>
+void TbdReader<E>::skip() {
+  read_element([&] {
+    if (peek(0).kind == '-' || peek(0).kind == '[')
+      read_list([&] { skip(); });
+    else if (is_map())
+      read_map([&](std::string_view key) { skip(); });
+    else if (peek(0).kind == YamlToken::STRING)
+      consume(1);
+    else
+      error("scalar expected");
+  });
+}
+
+template <typename E>
+bool TbdReader<E>::contains_arch() {
+  bool found = false;
+  read_list([&] {
+    if (read_scalar() == arch)
+      found = true;
+  });
+  return found;
+}
+
+// Reads a map of the form `{ targets: [...], <name>: [...] }` and
+// appends the strings in <name> to `out` if the targets contain our
+// arch. The keys may appear in any order.
+template <typename E>
+void TbdReader<E>::read_targeted_list(std::string_view name,
+                                      std::vector<std::string_view> &out) {
+  std::optional<bool> matched;
+  std::vector<std::string_view> vec;
 
+  read_map([&](std::string_view key) {
+    if (key == "targets") {
+      matched = contains_arch();
+    } else if (key == name && matched != false) {
+      read_list([&] {
+        if (std::optional<std::string_view> val = read_scalar())
+          vec.push_back(*val);
+      });
+    } else {
+      skip();
+    }
+  });
+
+  if (matched == true)
+    append(out, vec);
+}
+
+template <typename E>
+std::optional<TextDylib> TbdReader<E>::read_document() {
   TextDylib tbd;
+  std::vector<std::string_view> reexports;
+  bool matched = false;
+
+  read_map([&](std::string_view key) {
+    if (key == "targets") {
+      matched = contains_arch();
+    } else if (key == "uuids") {
+      read_list([&] {
+        std::optional<std::string_view> target;
+        std::optional<std::string_view> value;
+
+        read_map([&](std::string_view key) {
+          if (key == "target")
+            target = read_scalar();
+          else if (key == "value")
+            value = read_scalar();
+          else
+            skip();
+        });
 
-  for (YamlNode &mem : get_vector(node, "uuids"))
-    if (auto target = get_string(mem, "target"))
-      if (*target == arch)
-        if (auto value = get_string(mem, "value"))
+        if (target == arch && value)
           tbd.uuid = *value;
+      });
+    } else if (key == "install-name") {
+      if (std::optional<std::string_view> val = read_scalar())
+        tbd.install_name = *val;
+    } else if (key == "current-version") {
+      if (std::optional<std::string_view> val = read_scalar())
+        tbd.current_version = *val;
+    } else if (key == "parent-umbrella") {
+      read_list([&] {
+        bool matched = false;
+        std::optional<std::string_view> umbrella;
 
-  if (auto val = get_string(node, "install-name"))
-    tbd.install_name = *val;
+        read_map([&](std::string_view key) {
+          if (key == "targets")
+            matched = contains_arch();
+          else if (key == "umbrella")
+            umbrella = read_scalar();
+          else
+            skip();
+        });
 
-  if (auto val = get_string(node, "current-version"))
-    tbd.current_version = *val;
+        if (matched && umbrella)
+          tbd.parent_umbrella = *umbrella;
+      });
+    } else if (key == "reexported-libraries") {
+      read_list([&] { read_targeted_list("libraries", tbd.reexported_libs); });
+    } else if (key == "exports") {
+      read_list([&] { read_targeted_list("symbols", tbd.exports); });
+    } else if (key == "reexports") {
+      read_list([&] { read_targeted_list("symbols", reexports); });
+    } else {
+      skip();
+    }
+  });
 
-  for (YamlNode &mem : get_vector(node, "parent-umbrella"))
-    if (contains(get_vector(mem, "targets"), arch))
-      if (auto val = get_string(mem, "umbrella"))
-        tbd.parent_umbrella = *val;
+  if (!matched)
+    return {};
+  append(tbd.exports, reexports);
+  return tbd;
+}
 
-  for (YamlNode &mem : get_vector(node, "reexported-libraries"))
-    if (contains(get_vector(mem, "targets"), arch))
-      for (YamlNode &mem : get_vector(mem, "libraries"))
-        if (auto *lib = std::get_if<std::string_view>(&mem.data))
-          tbd.reexported_libs.push_back(*lib);
+template <typename E>
+std::vector<TextDylib> TbdReader<E>::read() {
+  std::vector<TextDylib> vec;
 
-  for (std::string_view key : {"exports", "reexports"})
-    for (YamlNode &mem : get_vector(node, key))
-      if (contains(get_vector(mem, "targets"), arch))
-        for (YamlNode &mem : get_vector(mem, "symbols"))
-          if (auto *sym = std::get_if<std::string_view>(&mem.data))
-            tbd.exports.push_back(*sym);
+  for (;;) {
+    fill(1);
+    if (tokenizer.tokens.empty())
+      break;
 
-  return tbd;
+    if (peek(0).kind == YamlToken::END) {
+      consume(1);
+      continue;
+    }
+
+    if (std::optional<TextDylib> tbd = read_document())
+      vec.push_back(std::move(*tbd));
+
+    if (peek(0).kind != YamlToken::END)
+      error("stray token");
+  }
+  return vec;
 }
 
 template <typename E>
@@ -91,27 +346,149 @@ static TextDylib squash(Context<E> &ctx, std::span<TextDylib> tbds) {
   return main;
 }
 
+// Large TBD files such as libSystem's take non-negligible time to
+// parse. If -cache_path_tbd is given, we save a parsed TBD file to
+// that directory in a simple binary format and mmap it in later runs.
+//
+// A cache file is identified by the path, size and mtime of a TBD file
+// and the target arch. The identifier is also stored to the cache file
+// itself to guard against hash collisions.
+static constexpr std::string_view TBD_CACHE_MAGIC = "MOLDTBD1";
+
+template <typename E>
+static std::optional<TextDylib>
+read_tbd_cache(Context<E> &ctx, const std::string &path, std::string_view key) {
+  MappedFile<Context<E>> *mf = MappedFile<Context<E>>::open(ctx, path);
+  if (!mf)
+    return {};
+
+  std::string_view data = mf->get_contents();
+  bool ok = data.starts_with(TBD_CACHE_MAGIC);
+  if (ok)
+    data = data.substr(TBD_CACHE_MAGIC.size());
+
+  auto read_u32 = [&] {
+    u32 val = 0;
+    if (data.size() < 4) {
+      ok = false;
+      return val;
+    }
+    memcpy(&val, data.data(), 4);
+    data = data.substr(4);
+    return val;
+  };
+
+  auto read_string = [&] {
+    u32 len = read_u32();
+    if (data.size() < len) {
+      ok = false;
+      return std::string_view();
+    }
+    std::string_view str = data.substr(0, len);
+    data = data.substr(len);
+    return str;
+  };
+
+  auto read_vector = [&] {
+    std::vector<std::string_view> vec;
+    for (u32 i = 0, n = read_u32(); ok && i < n; i++)
+      vec.push_back(read_string());
+    return vec;
+  };
+
+  if (!ok || read_string() != key || !ok)
+    return {};
+
+  TextDylib tbd;
+  tbd.uuid = read_string();
+  tbd.install_name = read_string();
+  tbd.current_version = read_string();
+  tbd.parent_umbrella = read_string();
+  tbd.reexported_libs = read_vector();
+  tbd.exports = read_vector();
+
+  if (!ok || !data.empty())
+    return {};
+  return tbd;
+}
+
+template <typename E>
+static void write_tbd_cache(Context<E> &ctx, const std::string &path,
+                            std::string_view key, TextDylib &tbd) {
+  std::string buf(TBD_CACHE_MAGIC);
+
+  auto write_u32 = [&](u32 val) {
+    buf.append((char *)&val, 4);
+  };
+
+  auto write_string = [&](std::string_view str) {
+    write_u32(str.size());
+    buf.append(str);
+  };
+
+  auto write_vector = [&](std::span<std::string_view> vec) {
+    write_u32(vec.size());
+    for (std::string_view str : vec)
+      write_string(str);
+  };
+
+  write_string(key);
+  write_string(tbd.uuid);
+  write_string(tbd.install_name);
+  write_string(tbd.current_version);
+  write_string(tbd.parent_umbrella);
+  write_vector(tbd.reexported_libs);
+  write_vector(tbd.exports);
+
+  mkdir(ctx.arg.cache_path_tbd.c_str(), 0755);
+
+  // Other mold processes may be reading or writing the same file,
+  // so we write to a temporary file first and then rename it.
+  //
+  // The cache is just an optimization, so a failure to write it is
+  // silently ignored.
+  std::string tmp = path + ".XXXXXX";
+  i64 fd = mkstemp(tmp.data());
+  if (fd == -1)
+    return;
+
+  bool ok = (write(fd, buf.data(), buf.size()) == buf.size());
+  close(fd);
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) == -1)
+    unlink(tmp.c_str());
+}
+
 template <typename E>
 static TextDylib parse(Context<E> &ctx, MappedFile<Context<E>> *mf,
                        std::string_view arch) {
-  std::string_view contents = mf->get_contents();
-  std::variant<std::vector<YamlNode>, YamlError> res = parse_yaml(contents);
+  std::string key;
+  std::string cache_path;
+
+  if (!ctx.arg.cache_path_tbd.empty()) {
+    std::stringstream ss;
+    ss << get_realpath(mf->name) << '\0' << mf->size << '\0' << mf->mtime
+       << '\0' << arch;
+    key = ss.str();
+
+    std::stringstream ss2;
+    ss2 << ctx.arg.cache_path_tbd << "/" << std::hex << std::setfill('0')
+        << std::setw(16) << XXH3_64bits(key.data(), key.size()) << ".tbd";
+    cache_path = ss2.str();
 
-  if (YamlError *err = std::get_if<YamlError>(&res)) {
-    i64 lineno = std::count(contents.begin(), contents.begin() + err->pos, '\n');
-    Fatal(ctx) << mf->name << ":" << (lineno + 1)
-               << ": YAML parse error: " << err->msg;
+    if (std::optional<TextDylib> tbd = read_tbd_cache(ctx, cache_path, key))
+      return *tbd;
   }
 
-  std::vector<YamlNode> &nodes = std::get<std::vector<YamlNode>>(res);
-  if (nodes.empty())
+  std::vector<TextDylib> vec = TbdReader<E>(ctx, mf, arch).read();
+  if (vec.empty())
     Fatal(ctx) << mf->name << ": malformed TBD file";
 
-  std::vector<TextDylib> vec;
-  for (YamlNode &node : nodes)
-    if (std::optional<TextDylib> dylib = to_tbd(node, arch))
-      vec.push_back(*dylib);
-  return squash(ctx, vec);
+  TextDylib tbd = squash(ctx, vec);
+
+  if (!cache_path.empty())
+    write_tbd_cache(ctx, cache_path, key, tbd);
+  return tbd;
 }
 
 template <>
@@ -7,6 +7,7 @@
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <span>
@@ -280,6 +281,14 @@ public:
   }
 
   std::pair<T *, bool> insert(std::string_view key, u64 hash, const T &val) {
+    std::pair<T *, bool> res = try_insert(key, hash, val);
+    assert((!keys || res.first) && "ConcurrentMap is full");
+    return res;
+  }
+
+  // Same as insert() but returns {nullptr, false} instead of failing
+  // if there's no room for a new key.
+  std::pair<T *, bool> try_insert(std::string_view key, u64 hash, const T &val) {
     if (!keys)
       return {nullptr, false};
 
@@ -312,8 +321,6 @@ public:
       idx = (idx & ~mask) | ((idx + 1) & mask);
       retry++;
     }
-
-    assert(false && "ConcurrentMap is full");
     return {nullptr, false};
   }
 
@@ -438,17 +445,46 @@ std::string_view demangle(std::string_view name);
 // compress.cc
 //
 
-class ZlibCompressor {
+class Compressor {
 public:
-  ZlibCompressor(std::string_view input);
-  void write_to(u8 *buf);
-  i64 size() const;
+  virtual ~Compressor() = default;
+  virtual void write_to(u8 *buf) = 0;
+  virtual i64 size() const = 0;
+};
+
+// A callback to write the uncompressed contents of the i'th shard to
+// a given buffer. This is used to compress data without having the
+// entire uncompressed data in memory.
+typedef std::function<void(i64 i, u8 *buf)> ShardWriter;
+
+class ZlibCompressor : public Compressor {
+public:
+  ZlibCompressor(std::span<i64> shard_sizes, ShardWriter write_shard);
+  void write_to(u8 *buf) override;
+  i64 size() const override;
 
 private:
   std::vector<std::vector<u8>> shards;
   u64 checksum = 0;
 };
 
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public Compressor {
+public:
+  ZstdCompressor(std::span<i64> shard_sizes, ShardWriter write_shard,
+                 i64 level);
+  void write_to(u8 *buf) override;
+  i64 size() const override;
+
+  // Returns an error message if compression failed, or nullptr.
+  const char *get_error() const;
+
+private:
+  std::vector<std::vector<u8>> shards;
+  std::atomic_size_t error = 0;
+};
+#endif
+
 class GzipCompressor {
 public:
   GzipCompressor(std::string_view input);
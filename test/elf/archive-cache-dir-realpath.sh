@@ -0,0 +1,48 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+const char *world() { return "world"; }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+const char *hello() { return "Hello"; }
+EOF
+
+cat <<EOF | cc -o $t/c.o -c -xc -
+#include <stdio.h>
+const char *world();
+int main() { printf("%s\n", world()); }
+EOF
+
+cat <<EOF | cc -o $t/d.o -c -xc -
+#include <stdio.h>
+const char *hello();
+int main() { printf("%s\n", hello()); }
+EOF
+
+# Two different archives with the same relative path, size and mtime
+rm -rf $t/d1 $t/d2 $t/cache
+mkdir -p $t/d1 $t/d2
+cp $t/a.o $t/d1/x.o
+cp $t/b.o $t/d2/x.o
+(cd $t/d1; ar rcs lib.a x.o)
+(cd $t/d2; ar rcs lib.a x.o)
+touch -r $t/d1/lib.a $t/d2/lib.a
+[ $(stat -c %s $t/d1/lib.a) = $(stat -c %s $t/d2/lib.a) ]
+
+(cd $t/d1; clang -fuse-ld=$mold -o exe ../c.o lib.a \
+   -Wl,--archive-cache-dir=$t/cache)
+$t/d1/exe | grep -q world
+
+(cd $t/d2; clang -fuse-ld=$mold -o exe ../d.o lib.a \
+   -Wl,--archive-cache-dir=$t/cache)
+$t/d2/exe | grep -q Hello
+
+echo OK
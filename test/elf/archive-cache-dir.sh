@@ -0,0 +1,42 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+const char *hello() { return "Hello"; }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+const char *world() { return "world"; }
+EOF
+
+cat <<EOF | cc -o $t/c.o -c -xc -
+#include <stdio.h>
+
+const char *hello();
+
+int main() {
+  printf("%s\n", hello());
+}
+EOF
+
+rm -rf $t/d.a $t/cache
+(cd $t; ar rcs d.a a.o b.o)
+
+clang -fuse-ld=$mold -o $t/exe1 $t/c.o $t/d.a -Wl,--archive-cache-dir=$t/cache
+$t/exe1 | grep -q Hello
+ls $t/cache | grep -q '\.idx$'
+
+# The second link reads the index from the cache.
+clang -fuse-ld=$mold -o $t/exe2 $t/c.o $t/d.a -Wl,--archive-cache-dir=$t/cache
+cmp $t/exe1 $t/exe2
+
+clang -fuse-ld=$mold -o $t/exe3 $t/c.o $t/d.a
+cmp $t/exe1 $t/exe3
+
+echo OK
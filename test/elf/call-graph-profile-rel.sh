@@ -0,0 +1,35 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+# LLVM emits .llvm.call-graph-profile with SHT_REL relocations even
+# for x86-64.
+cat <<EOF | llvm-mc -filetype=obj -triple=x86_64-unknown-linux -o $t/a.o -
+  .globl fa, fb, fc, fd
+  .section .text.fa, "ax", @progbits
+fa: ret
+  .section .text.fb, "ax", @progbits
+fb: ret
+  .section .text.fc, "ax", @progbits
+fc: ret
+  .section .text.fd, "ax", @progbits
+fd: ret
+
+  .cg_profile fd, fb, 100
+  .cg_profile fb, fa, 50
+EOF
+
+cat <<EOF | cc -c -o $t/b.o -xc -
+int main() {}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o
+nm -n $t/exe | awk '$3 ~ /^f[a-d]$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^fd fb fa fc $' $t/log
+
+echo OK
@@ -0,0 +1,51 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+# Each entry of .llvm.call-graph-profile is a call count, and its
+# caller and callee are given by a pair of R_X86_64_NONE relocations.
+cat <<EOF | cc -c -o $t/a.o -x assembler -
+  .globl fa, fb, fc, fd
+  .section .text.fa, "ax", @progbits
+fa: ret
+  .section .text.fb, "ax", @progbits
+fb: ret
+  .section .text.fc, "ax", @progbits
+fc: ret
+  .section .text.fd, "ax", @progbits
+fd: ret
+
+  .section .llvm.call-graph-profile, "e", @0x6fff4c09
+  .reloc ., R_X86_64_NONE, fd
+  .reloc ., R_X86_64_NONE, fb
+  .quad 100
+  .reloc ., R_X86_64_NONE, fb
+  .reloc ., R_X86_64_NONE, fa
+  .quad 50
+EOF
+
+cat <<EOF | cc -c -o $t/b.o -xc -
+int main() {}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o
+nm -n $t/exe | awk '$3 ~ /^f[a-d]$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^fd fb fa fc $' $t/log
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--no-call-graph-profile-sort
+nm -n $t/exe | awk '$3 ~ /^f[a-d]$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^fa fb fc fd $' $t/log
+
+# --symbol-ordering-file takes precedence.
+echo fc > $t/symbols
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o \
+  -Wl,--symbol-ordering-file=$t/symbols
+nm -n $t/exe | awk '$3 ~ /^f[a-d]$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^fc fa fb fd $' $t/log
+
+echo OK
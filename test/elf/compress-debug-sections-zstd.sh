@@ -0,0 +1,39 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -c -g -o $t/a.o -xc -
+#include <stdio.h>
+
+int main() {
+  printf("Hello world\n");
+  return 0;
+}
+EOF
+
+# mold may be built without zstd.
+$mold --compress-debug-sections=zstd --version >& /dev/null ||
+  { echo skipped; exit; }
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--compress-debug-sections=zstd
+$t/exe | grep -q 'Hello world'
+readelf -t $t/exe | grep -A4 ' .debug_info' | grep -q ZSTD
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--compress-debug-sections=zstd:19
+readelf -t $t/exe | grep -A4 ' .debug_info' | grep -q ZSTD
+
+# Out-of-range compression levels are rejected.
+! $mold --compress-debug-sections=zstd:1000 -o $t/exe $t/a.o 2> $t/log
+grep -q 'zstd compression level must be between' $t/log
+
+# zstd-compressed input sections are decompressed.
+objcopy --compress-debug-sections=zstd $t/a.o $t/c.o 2> /dev/null || { echo OK; exit; }
+clang -fuse-ld=$mold -o $t/exe $t/c.o
+readelf --debug-dump=info $t/exe | grep -q DW_TAG_compile_unit
+
+echo OK
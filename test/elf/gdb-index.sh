@@ -0,0 +1,41 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -g -ggnu-pubnames -xc -
+void hello();
+static int foo() { return 3; }
+int main() { hello(); return foo() - 3; }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -g -ggnu-pubnames -xc -
+#include <stdio.h>
+int bar = 5;
+void hello() { printf("Hello world\n"); }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--gdb-index
+$t/exe | grep -q 'Hello world'
+
+readelf --debug-dump=gdb_index $t/exe > $t/log
+grep -q 'Version 7' $t/log
+grep -Eq '^\[ *[0-9]+\] main: 0 \[global, function\]' $t/log
+grep -Eq '^\[ *[0-9]+\] foo: 0 \[static, function\]' $t/log
+grep -Eq '^\[ *[0-9]+\] hello: 1 \[global, function\]' $t/log
+grep -Eq '^\[ *[0-9]+\] bar: 1 \[global, variable\]' $t/log
+
+# main() should be covered by an address range of CU 0.
+main=$((0x$(nm $t/exe | awk '$3 == "main" { print $1 }')))
+grep -A3 'Address table' $t/log | grep ' 0$' | while read lo hi cu; do
+  [ $((0x$lo)) -le $main -a $main -lt $((0x$hi)) ] && echo found
+done | grep -q found
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o
+! readelf -WS $t/exe | grep -q .gdb_index || false
+
+echo OK
@@ -0,0 +1,47 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+# Skip if libc is musl because musl does not support GNU FUNC
+echo 'int main() {}' | cc -o $t/exe -xc -
+ldd $t/exe | grep -q ld-musl && { echo OK; exit; }
+
+cat <<EOF | cc -fPIC -o $t/a.o -c -xc -
+#include <stdio.h>
+
+__attribute__((ifunc("resolve_foobar")))
+static void foobar(void);
+
+static void real_foobar(void) {
+  printf("Hello world\n");
+}
+
+typedef void Func();
+
+static Func *resolve_foobar(void) {
+  return real_foobar;
+}
+
+Func *ptr = foobar;
+
+int main() {
+  ptr();
+  foobar();
+}
+EOF
+
+clang -fuse-ld=$mold -pie -o $t/exe $t/a.o
+$t/exe | grep -q 'Hello world'
+
+# A local IFUNC symbol is called via .plt.got, which doesn't need
+# a dynamic symbol.
+readelf --dyn-syms $t/exe > $t/log
+! grep -q foobar $t/log || false
+[ "$(grep -c LOCAL $t/log)" = 1 ]
+
+echo OK
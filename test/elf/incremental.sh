@@ -0,0 +1,95 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+int get_b();
+int main() {
+  printf("%d\n", get_b());
+}
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+int get_b() { return 1; }
+EOF
+
+rm -f $t/exe $t/exe.mold-incremental
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > /dev/null
+$t/exe | grep -q '^1$'
+test -e $t/exe.mold-incremental
+
+# b.o has changed, so it should be patched into the existing file.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int get_b() { return 2; }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+grep -q patch_chunks $t/log
+$t/exe | grep -q '^2$'
+
+# Grown sections should be placed in the slack space.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int x[] = {3, 4, 5, 6};
+static int sum(int *p, int n) {
+  int r = 0;
+  for (int i = 0; i < n; i++)
+    r += p[i];
+  return r;
+}
+int get_b() { return sum(x, 4); }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+grep -q patch_chunks $t/log
+$t/exe | grep -q '^18$'
+
+# If a section doesn't fit in the slack space, we do a full link.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int x[100000] = {7};
+int get_b() { return x[0]; }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+! grep -q patch_chunks $t/log || false
+$t/exe | grep -q '^7$'
+
+# The full link reserves fresh slack space, so we can patch again.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int x[100000] = {8};
+int get_b() { return x[0]; }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+grep -q patch_chunks $t/log
+$t/exe | grep -q '^8$'
+
+# A new imported symbol changes the size of .dynsym, so we do a full
+# link, after which we can patch again.
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <unistd.h>
+int x[100000] = {9};
+int get_b() { return x[0] + (getpid() < 0); }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+! grep -q patch_chunks $t/log || false
+$t/exe | grep -q '^9$'
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <unistd.h>
+int x[100000] = {10};
+int get_b() { return x[0] + (getpid() < 0); }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o -Wl,--incremental,--perf > $t/log
+grep -q patch_chunks $t/log
+$t/exe | grep -q '^10$'
+
+echo OK
@@ -0,0 +1,91 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -fPIC -c -o $t/a.o -xc -
+#include <stdio.h>
+
+int a = 1, b = 2, c = 3;
+int *p[] = { &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c,
+             &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c,
+             &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c,
+             &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c,
+             &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c };
+
+struct { char x; int *y; } __attribute__((packed)) s = { 0, &b };
+
+int main() {
+  int sum = 0;
+  for (int i = 0; i < sizeof(p) / sizeof(p[0]); i++)
+    sum += *p[i];
+  printf("%d %d\n", sum, *s.y);
+}
+EOF
+
+clang -fuse-ld=$mold -pie -o $t/exe $t/a.o -Wl,-z,pack-relative-relocs
+$t/exe | grep -q '^150 2$'
+
+readelf -WS $t/exe | grep -q '\.relr\.dyn'
+readelf -d $t/exe | grep -q '(RELR)'
+readelf -d $t/exe | grep -q '(RELRSZ)'
+readelf -d $t/exe | grep -q '(RELRENT)'
+
+# An unaligned relocation is kept in .rela.dyn.
+readelf -r $t/exe | grep -q R_X86_64_RELATIVE
+
+clang -fuse-ld=$mold -pie -o $t/exe $t/a.o
+$t/exe | grep -q '^150 2$'
+! readelf -WS $t/exe | grep -q '\.relr\.dyn' || false
+
+# Duplicate relocations at the same offset are encoded only once.
+cat <<EOF | cc -c -o $t/d.o -x assembler -
+  .section foo, "aw"
+  .p2align 3
+  .globl ptr
+ptr:
+  .reloc ., R_X86_64_64, val
+  .reloc ., R_X86_64_64, val
+  .quad 0
+val:
+  .quad 42
+EOF
+
+cat <<EOF | cc -fPIC -c -o $t/e.o -xc -
+#include <stdio.h>
+extern long *ptr;
+int main() { printf("%ld\n", *ptr); }
+EOF
+
+clang -fuse-ld=$mold -pie -o $t/exe $t/d.o $t/e.o -Wl,-z,pack-relative-relocs
+$t/exe | grep -q '^42$'
+readelf -r $t/exe | sed -n '/\.relr\.dyn/,/^$/p' > $t/log
+[ -z "$(sort $t/log | uniq -d)" ]
+
+# GLIBC_ABI_DT_RELR is required even if nothing is imported from libc.
+cat <<EOF | cc -fPIC -c -o $t/b.o -xc -
+static int x = 5;
+int *y = &x;
+int get() { return *y; }
+EOF
+
+clang -fuse-ld=$mold -shared -nostdlib -o $t/b.so $t/b.o \
+  -Wl,--no-as-needed -lc -Wl,-z,pack-relative-relocs
+readelf -d $t/b.so | grep -q '(RELR)'
+readelf -V $t/b.so | grep -q 'File: libc.so.6'
+readelf -V $t/b.so | grep -q 'Name: GLIBC_ABI_DT_RELR'
+
+cat <<EOF | cc -c -o $t/c.o -xc -
+#include <stdio.h>
+int get();
+int main() { printf("%d\n", get()); }
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/c.o $t/b.so
+LD_LIBRARY_PATH=$t $t/exe | grep -q '^5$'
+
+echo OK
@@ -0,0 +1,50 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -fPIC -
+#include <stdio.h>
+
+extern int bar;
+int foo = 3;
+int *ptr = &foo;
+static const char *msg = "Hello world";
+
+void hello() {
+  printf("%s %d %d\n", msg, *ptr, bar);
+}
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -fPIC -
+int bar = 5;
+void hello();
+
+int main() {
+  hello();
+  return 0;
+}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe1 $t/a.o $t/b.o -Wl,--build-id=none
+clang -fuse-ld=$mold -o $t/exe2 $t/a.o $t/b.o -Wl,--build-id=none \
+  -Wl,--pre-resolve-relocs
+cmp $t/exe1 $t/exe2
+$t/exe2 | grep -q 'Hello world 3 5'
+
+clang -fuse-ld=$mold -o $t/exe3 $t/a.o $t/b.o -Wl,--build-id=none -no-pie
+clang -fuse-ld=$mold -o $t/exe4 $t/a.o $t/b.o -Wl,--build-id=none -no-pie \
+  -Wl,--pre-resolve-relocs
+cmp $t/exe3 $t/exe4
+$t/exe4 | grep -q 'Hello world 3 5'
+
+clang -fuse-ld=$mold -o $t/c.so $t/a.o -shared -Wl,--build-id=none
+clang -fuse-ld=$mold -o $t/d.so $t/a.o -shared -Wl,--build-id=none \
+  -Wl,--pre-resolve-relocs
+cmp $t/c.so $t/d.so
+
+echo OK
@@ -0,0 +1,28 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -g -xc -
+#include <stdio.h>
+
+int main() {
+  printf("Hello world\n");
+  return 0;
+}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe1 $t/a.o -Wl,--build-id=none
+clang -fuse-ld=$mold -o $t/exe2 $t/a.o -Wl,--build-id=none -Wl,--preallocate
+cmp $t/exe1 $t/exe2
+$t/exe2 | grep -q 'Hello world'
+
+clang -fuse-ld=$mold -o $t/exe3 $t/a.o -Wl,--build-id=none \
+  -Wl,--async-write -Wl,--preallocate
+cmp $t/exe1 $t/exe3
+
+echo OK
@@ -0,0 +1,42 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+
+int main() {
+  printf("Hello world\n");
+  return 0;
+}
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <stdio.h>
+
+int main() {
+  printf("Howdy world\n");
+  return 0;
+}
+EOF
+
+rm -f $t/exe
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--reuse-output
+$t/exe | grep -q 'Hello world'
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--reuse-output -Wl,--stats > $t/log
+grep -q 'rewritten_output_bytes=0$' $t/log
+$t/exe | grep -q 'Hello world'
+
+clang -fuse-ld=$mold -o $t/exe $t/b.o -Wl,--reuse-output
+$t/exe | grep -q 'Howdy world'
+
+clang -fuse-ld=$mold -o $t/exe2 $t/b.o
+cmp $t/exe $t/exe2
+
+echo OK
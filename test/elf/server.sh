@@ -0,0 +1,79 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+void hello();
+int main() {
+  hello();
+}
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <stdio.h>
+void hello() {
+  printf("Hello world\n");
+}
+EOF
+
+rm -rf $t/server
+$mold --server --server-dir=$t/server $t/b.o &
+pid=$!
+trap "kill -9 $pid" EXIT
+
+for i in $(seq 1 50); do
+  test -S $t/server/socket && break
+  sleep 0.1
+done
+
+test "$(stat -c %a $t/server)" = 700
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o \
+  -Wl,--use-server,--server-dir=$t/server
+$t/exe | grep -q 'Hello world'
+
+! clang -fuse-ld=$mold -o $t/exe $t/a.o \
+  -Wl,--use-server,--server-dir=$t/server 2> $t/log || false
+grep -q 'undefined symbol: .*hello' $t/log
+
+# Relative paths are resolved against the client's directory, even if
+# the server has parsed a file of the same name, size and mtime.
+mkdir -p $t/d1 $t/d2
+echo 'void hello() { puts("Hello d1"); }' | cc -o $t/d1/b.o -c -xc -include stdio.h -
+echo 'void hello() { puts("Hello d2"); }' | cc -o $t/d2/b.o -c -xc -include stdio.h -
+touch -r $t/d1/b.o $t/d2/b.o
+
+rm -rf $t/server2
+(cd $t/d1; exec $mold --server --server-dir=$t/server2 b.o) &
+pid2=$!
+trap "kill -9 $pid $pid2" EXIT
+
+for i in $(seq 1 50); do
+  test -S $t/server2/socket && break
+  sleep 0.1
+done
+
+(cd $t/d2; clang -fuse-ld=$mold -o exe ../a.o b.o \
+   -Wl,--use-server,--server-dir=$t/server2)
+$t/d2/exe | grep -q 'Hello d2'
+
+# Stop the server so that a link delegated to it would hang.
+kill -STOP $pid
+
+# Without --use-server, we link by ourselves.
+timeout 30 clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o \
+  -Wl,--server-dir=$t/server
+$t/exe | grep -q 'Hello world'
+
+# A server directory accessible by other users is ignored.
+chmod 755 $t/server
+timeout 30 clang -fuse-ld=$mold -o $t/exe $t/a.o $t/b.o \
+  -Wl,--use-server,--server-dir=$t/server
+$t/exe | grep -q 'Hello world'
+
+echo OK
@@ -0,0 +1,38 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+int main() {
+  printf("Hello world\n");
+}
+EOF
+
+rm -f $t/exe $t/exe.mold-state
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--skip-if-unchanged,--perf > /dev/null
+$t/exe | grep -q 'Hello world'
+test -e $t/exe.mold-state
+
+# Nothing has changed, so the previous output should be reused.
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--skip-if-unchanged,--perf > $t/log
+! grep -q read_input_files $t/log || false
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+int main() {
+  printf("Hello world 2\n");
+}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,--skip-if-unchanged,--perf > $t/log
+grep -q read_input_files $t/log
+$t/exe | grep -q 'Hello world 2'
+
+echo OK
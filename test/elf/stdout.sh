@@ -20,4 +20,15 @@ clang -Wl,-build-id=sha1 -fuse-ld=$mold $t/a.o -o - > $t/exe
 chmod 755 $t/exe
 $t/exe | grep -q 'Hello world'
 
+clang -fuse-ld=$mold $t/a.o -o $t/exe2
+clang -fuse-ld=$mold $t/a.o -o - > $t/exe3
+cmp $t/exe2 $t/exe3
+
+rm -f $t/fifo
+mkfifo $t/fifo
+cat $t/fifo > $t/exe4 &
+clang -fuse-ld=$mold $t/a.o -o $t/fifo
+wait
+cmp $t/exe2 $t/exe4
+
 echo OK
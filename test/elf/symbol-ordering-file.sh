@@ -0,0 +1,34 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/elf/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | clang -c -o $t/a.o -ffunction-sections -xc -
+void foo() {}
+void bar() {}
+void baz() {}
+int main() { foo(); bar(); baz(); }
+EOF
+
+cat <<EOF > $t/symbols
+baz
+foo
+nonexistent
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o 2> $t/log \
+  -Wl,--symbol-ordering-file=$t/symbols
+grep -q 'no such symbol: nonexistent' $t/log
+
+nm -n $t/exe | awk '$3 ~ /^(foo|bar|baz)$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^baz foo bar $' $t/log
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o
+nm -n $t/exe | awk '$3 ~ /^(foo|bar|baz)$/ { print $3 }' | tr '\n' ' ' > $t/log
+grep -q '^foo bar baz $' $t/log
+
+echo OK
@@ -0,0 +1,45 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../ld64.mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/macho/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+
+int bar() {
+  return 5;
+}
+
+int foo1(int x) {
+  return bar() + x;
+}
+
+int foo2(int x) {
+  return bar() + x;
+}
+
+int foo3() {
+  bar();
+  return 5;
+}
+
+int main() {
+  printf("%d %d\n", (long)foo1 == (long)foo2, (long)foo1 == (long)foo3);
+  return 0;
+}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,-icf=all
+$t/exe | grep -q '1 0'
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,-icf=safe
+$t/exe | grep -q '0 0'
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o
+$t/exe | grep -q '0 0'
+
+echo OK
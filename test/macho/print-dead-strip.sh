@@ -0,0 +1,32 @@
+#!/bin/bash
+export LANG=
+set -e
+cd $(dirname $0)
+mold=`pwd`/../../ld64.mold
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/../../out/test/macho/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+
+void hello() {
+  printf("Hello world\n");
+}
+
+void howdy() {
+  printf("Howdy world\n");
+}
+
+int main() {
+  hello();
+}
+EOF
+
+clang -fuse-ld=$mold -o $t/exe $t/a.o -Wl,-dead_strip \
+  -Wl,-print_dead_strip > $t/log
+$t/exe | grep -q 'Hello world'
+grep -Eq 'dead_strip_removed_subsecs=[1-9]' $t/log
+grep -Eq 'dead_strip_live_subsecs=[1-9]' $t/log
+
+echo OK